@@ -0,0 +1,298 @@
+//
+// Created by 13345 on 2024/4/20.
+// 共享数据保护方式的性能测试
+//
+
+#include <string>
+
+// read_write_lock.h 要求先定义 dns_entry
+class dns_entry
+{
+public:
+    std::string address;
+    unsigned ttl;
+    dns_entry() : ttl(0) {}
+    dns_entry(std::string const& address_, unsigned ttl_) : address(address_), ttl(ttl_) {}
+};
+
+// lazy_initialization.h 要求先定义 some_resource
+class some_resource
+{
+public:
+    int data;
+    some_resource() : data(42) {}
+    void do_something() {}
+    int value() const
+    {
+        return data;
+    }
+};
+
+#include "read_write_lock.h"
+#include "distributed_shared_mutex.h"
+#include "hierarchical_mutex.h"
+#include "profiled_mutex.h"
+#include "lazy_initialization.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+std::vector<unsigned> thread_counts()
+{
+    unsigned const hardware_threads = std::thread::hardware_concurrency();
+    unsigned const max_threads = 2 * (hardware_threads != 0 ? hardware_threads : 2);
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n <= max_threads; n *= 2)
+        counts.push_back(n);
+    return counts;
+}
+
+// num_readers 个线程不停查询，一个写线程每 10ms 更新一个条目，返回读者的总查询速度
+template<typename Cache>
+double dns_lookup_throughput(Cache& cache, unsigned domains, unsigned num_readers, unsigned lookups_per_reader)
+{
+    std::atomic<bool> go(false);
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        unsigned i = 0;
+        while (!done.load())
+        {
+            cache.update_or_add_entry("host" + std::to_string(i % domains) + ".example.com",
+                                      dns_entry("10.0.0." + std::to_string(i % 256), 60));
+            ++i;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+    std::vector<std::string> names(domains);
+    for (unsigned i = 0; i < domains; ++i)
+        names[i] = "host" + std::to_string(i) + ".example.com";
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < num_readers; ++t)
+    {
+        readers.emplace_back([&, t] {
+            std::mt19937 rng(t + 1);
+            unsigned long ttl_sum = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < lookups_per_reader; ++i)
+                ttl_sum += cache.find_entry(names[rng() % domains]).ttl;
+            if (ttl_sum == 1)
+                std::printf("unexpected checksum\n");
+        });
+    }
+    auto const start = bench_clock::now();
+    go = true;
+    for (auto& th : readers)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    done = true;
+    writer.join();
+    return num_readers * static_cast<double>(lookups_per_reader) / seconds;
+}
+
+// 每个线程反复加读锁、读一个共享变量、放读锁，返回总的加锁次数/秒
+template<typename SharedMutex>
+double read_lock_throughput(unsigned num_threads, unsigned ops_per_thread)
+{
+    SharedMutex m;
+    long shared_value = 42;
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&] {
+            long sum = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+            {
+                std::shared_lock<SharedMutex> lk(m);
+                sum += shared_value;
+            }
+            if (sum == 1)
+                std::printf("unexpected checksum\n");
+        });
+    }
+    auto const start = bench_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return num_threads * static_cast<double>(ops_per_thread) / seconds;
+}
+
+void bench_read_lock()
+{
+    std::printf("== read-only lock_shared/unlock_shared pairs per second\n");
+    std::printf("%8s %16s %16s\n", "readers", "shared_mutex", "distributed");
+    for (unsigned n : thread_counts())
+    {
+        double const standard = read_lock_throughput<std::shared_mutex>(n, 2000000);
+        double const distributed = read_lock_throughput<distributed_shared_mutex>(n, 2000000);
+        std::printf("%8u %16.0f %16.0f\n", n, standard, distributed);
+    }
+}
+
+void bench_dns_cache()
+{
+    unsigned const domains = 1000;
+    unsigned const lookups = 1000000;
+    std::printf("== dns_cache lookups/s, %u domains, one writer updating every 10ms\n", domains);
+    std::printf("%8s %16s %16s %16s\n", "readers", "shared_mutex", "distributed", "rcu");
+    for (unsigned n : thread_counts())
+    {
+        dns_cache locked;
+        basic_dns_cache<distributed_shared_mutex> distributed;
+        rcu_dns_cache rcu;
+        for (unsigned i = 0; i < domains; ++i)
+        {
+            locked.update_or_add_entry("host" + std::to_string(i) + ".example.com", dns_entry("10.0.0.1", 60));
+            distributed.update_or_add_entry("host" + std::to_string(i) + ".example.com", dns_entry("10.0.0.1", 60));
+        }
+        // RCU 每次更新都要复制整个 map，批量加载时用 update 只复制一次
+        rcu.update([domains](std::map<std::string, dns_entry>& entries) {
+            for (unsigned i = 0; i < domains; ++i)
+                entries["host" + std::to_string(i) + ".example.com"] = dns_entry("10.0.0.1", 60);
+        });
+        double const locked_ops = dns_lookup_throughput(locked, domains, n, lookups);
+        double const distributed_ops = dns_lookup_throughput(distributed, domains, n, lookups);
+        double const rcu_ops = dns_lookup_throughput(rcu, domains, n, lookups);
+        std::printf("%8u %16.0f %16.0f %16.0f\n", n, locked_ops, distributed_ops, rcu_ops);
+    }
+}
+
+// 单线程 lock/unlock 一对的平均耗时（纳秒）
+template<typename Mutex>
+double lock_unlock_ns(Mutex& m, unsigned iterations)
+{
+    auto const start = bench_clock::now();
+    for (unsigned i = 0; i < iterations; ++i)
+    {
+        std::lock_guard<Mutex> lk(m);
+    }
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / iterations;
+}
+
+void bench_hierarchical_mutex()
+{
+    unsigned const iterations = 10000000;
+    std::mutex plain;
+    basic_hierarchical_mutex<hierarchy_check> checked(1000);
+    basic_hierarchical_mutex<no_hierarchy_check> unchecked(1000);
+    profiled_mutex<std::mutex> sampled("sampled");
+    profiled_mutex<std::mutex> every("every");
+    every.set_sample_period(1);
+    std::printf("== uncontended lock/unlock, ns per pair\n");
+    std::printf("%-28s %8.1f\n", "std::mutex", lock_unlock_ns(plain, iterations));
+    std::printf("%-28s %8.1f\n", "hierarchy_check", lock_unlock_ns(checked, iterations));
+    std::printf("%-28s %8.1f (sizeof %zu)\n", "no_hierarchy_check", lock_unlock_ns(unchecked, iterations),
+                sizeof(unchecked));
+    std::printf("%-28s %8.1f\n", "profiled, sample 1/64", lock_unlock_ns(sampled, iterations));
+    std::printf("%-28s %8.1f\n", "profiled, every acquisition", lock_unlock_ns(every, iterations));
+}
+
+// 两个调用位置以不同的频率争用同一把锁，然后打印分析结果
+void bench_lock_profile()
+{
+    profiled_mutex<std::mutex> hot("hot_lock");
+    profiled_mutex<std::mutex> cold("cold_lock");
+    long hot_counter = 0;
+    long cold_counter = 0;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&hot, &cold, &hot_counter, &cold_counter, t] {
+            for (unsigned i = 0; i < 200000; ++i)
+            {
+                if (i % 4 == t % 4)
+                {
+                    std::lock_guard<profiled_mutex<std::mutex>> lk(cold);
+                    ++cold_counter;
+                }
+                else
+                {
+                    std::lock_guard<profiled_mutex<std::mutex>> lk(hot);
+                    ++hot_counter;
+                    if (i % 1000 == 0)
+                        std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    std::printf("== lock profile, 4 threads\n");
+    lock_profiler::instance().report(stdout);
+}
+
+some_resource& local_static_resource()
+{
+    static some_resource instance;
+    return instance;
+}
+
+// 每个线程访问 ops_per_thread 次延迟初始化的资源，返回总的每秒访问数
+template<typename Access>
+double lazy_access_throughput(unsigned num_threads, unsigned ops_per_thread, Access access)
+{
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&go, &access, ops_per_thread] {
+            long sum = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+            {
+                sum += access();
+                // 编译器屏障：阻止把对初始化状态的检查提到循环外面
+                asm volatile("" ::: "memory");
+            }
+            if (sum == 1)
+                std::printf("unexpected checksum\n");
+        });
+    }
+    auto const start = bench_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return num_threads * static_cast<double>(ops_per_thread) / seconds;
+}
+
+void bench_lazy()
+{
+    unsigned const ops = 20000000;
+    std::printf("== lazy initialized resource, accesses/s\n");
+    std::printf("%8s %16s %16s %16s %16s\n", "threads", "call_once", "local_static", "lazy", "cached_get");
+    for (unsigned n : thread_counts())
+    {
+        double const once_ops = lazy_access_throughput(n, ops, [] {
+            std::call_once(resource_flag, init_resource);
+            return resource_ptr->value();
+        });
+        double const static_ops = lazy_access_throughput(n, ops, [] {return local_static_resource().value();});
+        double const lazy_ops = lazy_access_throughput(n, ops, [] {return lazy_resource->value();});
+        double const cached_ops = lazy_access_throughput(n, ops, [] {return cached_get<lazy_resource>().value();});
+        std::printf("%8u %16.0f %16.0f %16.0f %16.0f\n", n, once_ops, static_ops, lazy_ops, cached_ops);
+    }
+}
+
+int main()
+{
+    bench_read_lock();
+    bench_dns_cache();
+    bench_hierarchical_mutex();
+    bench_lock_profile();
+    bench_lazy();
+    return 0;
+}
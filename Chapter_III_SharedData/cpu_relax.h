@@ -0,0 +1,18 @@
+//
+// Created by 13345 on 2024/4/22.
+// 自旋等待时的提示指令：降低功耗，并让出超线程的执行资源
+//
+
+#ifndef CPP_CONCURRENCY_CPU_RELAX_H
+#define CPP_CONCURRENCY_CPU_RELAX_H
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+#endif //CPP_CONCURRENCY_CPU_RELAX_H
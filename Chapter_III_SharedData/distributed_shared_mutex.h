@@ -0,0 +1,150 @@
+//
+// Created by 13345 on 2024/4/22.
+// 分布式读写锁（big-reader lock）：每个读者槽位单独占一个缓存行，
+// 线程第一次加读锁时分配一个固定的槽位，加读锁和放读锁只修改自己槽位的计数，读者之间不再争用同一个缓存行。
+// 写者先设置 writer 标志（之后新来的读者会退让，写者优先，不会被源源不断的读者饿死），再等待所有槽位的计数归零。
+// 代价是写锁要扫描所有槽位，适合读远多于写的场景。接口与 std::shared_mutex 相同，可以直接替换。
+//
+
+#ifndef CPP_CONCURRENCY_DISTRIBUTED_SHARED_MUTEX_H
+#define CPP_CONCURRENCY_DISTRIBUTED_SHARED_MUTEX_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "cpu_relax.h"
+
+class distributed_shared_mutex
+{
+private:
+    static unsigned const max_slots = 64;
+    static unsigned const spin_count = 64;
+
+    struct alignas(64) slot
+    {
+        std::atomic<unsigned> readers;
+        slot() : readers(0) {}
+    };
+
+    unsigned const num_slots;
+    std::unique_ptr<slot[]> slots;
+    std::atomic<bool> writer;
+    std::mutex writer_mutex;
+
+    static unsigned default_slots()
+    {
+        unsigned const hardware_threads = std::thread::hardware_concurrency();
+        unsigned n = 1;
+        while (n < hardware_threads * 2 && n < max_slots)
+            n *= 2;
+        return n;
+    }
+
+    // 线程按到达顺序轮流分配槽位，线程数不超过槽位数时每个线程独占一个
+    static unsigned thread_index()
+    {
+        static std::atomic<unsigned> next_index(0);
+        static thread_local unsigned const index = next_index.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    slot& my_slot() const
+    {
+        return slots[thread_index() & (num_slots - 1)];
+    }
+
+    static void backoff(unsigned& spins)
+    {
+        if (++spins < spin_count)
+            cpu_relax();
+        else
+            std::this_thread::yield();
+    }
+
+    void wait_for_writer() const
+    {
+        unsigned spins = 0;
+        while (writer.load(std::memory_order_relaxed))
+            backoff(spins);
+    }
+
+    void wait_for_readers() const
+    {
+        for (unsigned i = 0; i < num_slots; ++i)
+        {
+            unsigned spins = 0;
+            while (slots[i].readers.load(std::memory_order_seq_cst) != 0)
+                backoff(spins);
+        }
+    }
+
+public:
+    distributed_shared_mutex() : num_slots(default_slots()), slots(new slot[num_slots]), writer(false) {}
+    distributed_shared_mutex(distributed_shared_mutex const&)=delete;
+    distributed_shared_mutex& operator=(distributed_shared_mutex const&)=delete;
+
+    void lock_shared()
+    {
+        slot& s = my_slot();
+        while (true)
+        {
+            wait_for_writer();
+            // 先登记再检查 writer，与写者的“先置标志再检查计数”配对（都用 seq_cst），两边至少有一方能看到对方
+            s.readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!writer.load(std::memory_order_seq_cst))
+                return;
+            s.readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    bool try_lock_shared()
+    {
+        if (writer.load(std::memory_order_relaxed))
+            return false;
+        slot& s = my_slot();
+        s.readers.fetch_add(1, std::memory_order_seq_cst);
+        if (!writer.load(std::memory_order_seq_cst))
+            return true;
+        s.readers.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+
+    void unlock_shared()
+    {
+        my_slot().readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    void lock()
+    {
+        writer_mutex.lock();
+        writer.store(true, std::memory_order_seq_cst);
+        wait_for_readers();
+    }
+
+    bool try_lock()
+    {
+        if (!writer_mutex.try_lock())
+            return false;
+        writer.store(true, std::memory_order_seq_cst);
+        for (unsigned i = 0; i < num_slots; ++i)
+        {
+            if (slots[i].readers.load(std::memory_order_seq_cst) != 0)
+            {
+                writer.store(false, std::memory_order_release);
+                writer_mutex.unlock();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void unlock()
+    {
+        writer.store(false, std::memory_order_release);
+        writer_mutex.unlock();
+    }
+};
+
+#endif //CPP_CONCURRENCY_DISTRIBUTED_SHARED_MUTEX_H
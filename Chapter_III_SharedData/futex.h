@@ -0,0 +1,89 @@
+//
+// Created by 13345 on 2024/4/28.
+// futex 等待/唤醒，以及按地址哈希的全局等待表（parking lot）
+// 锁本身只需要一个字节来记录“已加锁”和“有人在等”，等待的线程不放在锁里，而是按锁的地址散列到全局的桶中，
+// 在桶的 sequence 字上用 futex 睡眠。不同地址可能落到同一个桶，所以唤醒时唤醒整个桶，被唤醒的线程自己重新检查条件。
+// 非 Linux 平台退化为 yield 轮询。
+//
+
+#ifndef CPP_CONCURRENCY_FUTEX_H
+#define CPP_CONCURRENCY_FUTEX_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "futex needs a plain 32-bit word");
+
+// word 的值仍为 expected 时睡眠，可能被假唤醒
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    if (word.load(std::memory_order_acquire) == expected)
+        std::this_thread::yield();
+#endif
+}
+
+inline void futex_wake(std::atomic<std::uint32_t>& word, int count)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+    (void)word;
+    (void)count;
+#endif
+}
+
+class parking_lot
+{
+private:
+    static unsigned const num_buckets = 256;
+
+    struct alignas(64) bucket
+    {
+        std::atomic<std::uint32_t> sequence;
+        std::atomic<std::uint32_t> waiters;
+        bucket() : sequence(0), waiters(0) {}
+    };
+
+    static bucket& bucket_for(void const* address)
+    {
+        static bucket buckets[num_buckets];
+        std::uintptr_t const a = reinterpret_cast<std::uintptr_t>(address);
+        // 斐波那契散列，取高位
+        return buckets[(a * 0x9E3779B97F4A7C15ull) >> (64 - 8)];
+    }
+
+public:
+    // 登记后如果 should_park() 仍为真就睡眠，直到同一个桶被 unpark_all。
+    // 唤醒方先修改状态再 unpark_all，这里先登记再检查状态（都是 seq_cst），所以不会错过唤醒
+    template<typename Predicate>
+    static void park(void const* address, Predicate should_park)
+    {
+        bucket& b = bucket_for(address);
+        b.waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::uint32_t const sequence = b.sequence.load(std::memory_order_seq_cst);
+        if (should_park())
+            futex_wait(b.sequence, sequence);
+        b.waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    static void unpark_all(void const* address)
+    {
+        bucket& b = bucket_for(address);
+        b.sequence.fetch_add(1, std::memory_order_seq_cst);
+        if (b.waiters.load(std::memory_order_seq_cst) != 0)
+            futex_wake(b.sequence, INT_MAX);
+    }
+};
+
+#endif //CPP_CONCURRENCY_FUTEX_H
@@ -1,21 +1,27 @@
 //
 // Created by 13345 on 2023/7/10.
 // 代码清单3.8，简单的层级互斥，对应操作系统中防止死锁中的资源按序分配
+// 层级检查是一个策略：hierarchy_check 每次加锁解锁都读写 thread_local 的当前层级，违反时抛出 logic_error；
+// no_hierarchy_check 什么也不做（也不保存层级值），定义了 NDEBUG 的发布版本默认使用它，与直接使用 std::mutex 没有区别。
 //
 
 #ifndef CPP_CONCURRENCY_HIERARCHICAL_MUTEX_H
 #define CPP_CONCURRENCY_HIERARCHICAL_MUTEX_H
 
+#include <climits>
 #include <mutex>
 #include <stdexcept>
 
-class hierarchical_mutex
+class hierarchy_check
 {
-    std::mutex internal_mutex;
     unsigned long const hierarchy_value;
     unsigned long previous_hierarchy_value;
-    static thread_local unsigned long this_thread_hierarchy_value;
-    void check_for_hierarchy_violation()
+    static inline thread_local unsigned long this_thread_hierarchy_value = ULONG_MAX;
+
+public:
+    explicit hierarchy_check(unsigned long value) : hierarchy_value(value), previous_hierarchy_value(0) {}
+
+    void check_for_hierarchy_violation() const
     {
         if (this_thread_hierarchy_value <= hierarchy_value)
         {
@@ -29,34 +35,63 @@ class hierarchical_mutex
         this_thread_hierarchy_value = hierarchy_value;
     }
 
+    void restore_hierarchy_value()
+    {
+        if (this_thread_hierarchy_value != hierarchy_value)
+            throw std::logic_error("mutex hierarchy violated");
+        this_thread_hierarchy_value = previous_hierarchy_value;
+    }
+};
+
+class no_hierarchy_check
+{
+public:
+    explicit no_hierarchy_check(unsigned long) {}
+    void check_for_hierarchy_violation() const {}
+    void update_hierarchy_value() {}
+    void restore_hierarchy_value() {}
+};
+
+// 策略作为私有基类，no_hierarchy_check 是空类，不占空间
+template<typename Policy, typename Mutex=std::mutex>
+class basic_hierarchical_mutex : private Policy
+{
+    Mutex internal_mutex;
+
 public:
-    explicit hierarchical_mutex(unsigned long value) : hierarchy_value(value), previous_hierarchy_value(0) {}
-    void lock()
+    explicit basic_hierarchical_mutex(unsigned long value) : Policy(value) {}
+    basic_hierarchical_mutex(basic_hierarchical_mutex const&)=delete;
+    basic_hierarchical_mutex& operator=(basic_hierarchical_mutex const&)=delete;
 
+    void lock()
     {
-        check_for_hierarchy_violation();
+        this->check_for_hierarchy_violation();
         internal_mutex.lock();
-        update_hierarchy_value();
+        this->update_hierarchy_value();
     }
 
     void unlock()
     {
-        if (this_thread_hierarchy_value != hierarchy_value)
-            throw std::logic_error("mutex hierarchy violated");
-        this_thread_hierarchy_value = previous_hierarchy_value;
+        this->restore_hierarchy_value();
         internal_mutex.unlock();
     }
 
     bool try_lock()
     {
-        check_for_hierarchy_violation();
-        if (!internal_mutex.lock())
+        this->check_for_hierarchy_violation();
+        if (!internal_mutex.try_lock())
             return false;
-        update_hierarchy_value();
+        this->update_hierarchy_value();
         return true;
     }
 };
 
-thread_local unsigned long hierarchical_mutex::this_thread_hierarchy_value(ULONG_MAX);
+#ifdef NDEBUG
+typedef no_hierarchy_check default_hierarchy_policy;
+#else
+typedef hierarchy_check default_hierarchy_policy;
+#endif
+
+typedef basic_hierarchical_mutex<default_hierarchy_policy> hierarchical_mutex;
 
 #endif //CPP_CONCURRENCY_HIERARCHICAL_MUTEX_H
@@ -0,0 +1,135 @@
+//
+// Created by 13345 on 2024/5/6.
+// 延迟初始化 lazy<T>：对象直接构造在 lazy 内部的存储中，不需要 shared_ptr
+// 初始化完成后每次访问只是一次 acquire 读加一次比较（x86 上就是普通的读），比 call_once 加 shared_ptr 解引用少一层间接访问。
+// 状态字有四种取值：未初始化 → 正在初始化 →（有线程在等）→ 已完成。
+// 抢到初始化权的线程构造对象，其他线程在状态字上用 futex 睡眠；构造函数抛出异常时状态退回未初始化并唤醒等待者，
+// 下一个访问的线程重新尝试初始化，与 call_once 的语义相同。
+// 构造函数都是 constexpr，命名空间作用域的 lazy 对象是常量初始化的，在任何动态初始化之前就已经就绪，
+// 其他源文件的静态初始化中访问它也是安全的。因此工厂是函数指针而不是 std::function。
+//
+
+#ifndef CPP_CONCURRENCY_LAZY_H
+#define CPP_CONCURRENCY_LAZY_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "futex.h"
+
+template<typename T>
+class lazy
+{
+private:
+    enum : std::uint32_t
+    {
+        uninitialized,
+        initializing,
+        initializing_with_waiters,
+        ready
+    };
+
+    std::atomic<std::uint32_t> state;
+    T (*factory)();
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    static T default_factory()
+    {
+        return T();
+    }
+
+    T* pointer()
+    {
+        return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    T& get_slow()
+    {
+        while (true)
+        {
+            std::uint32_t s = state.load(std::memory_order_acquire);
+            if (s == ready)
+                return *pointer();
+            if (s == uninitialized)
+            {
+                if (!state.compare_exchange_strong(s, initializing, std::memory_order_acquire, std::memory_order_acquire))
+                    continue;
+                try
+                {
+                    new (storage) T(factory());
+                }
+                catch (...)
+                {
+                    // 退回未初始化，让等待者中的一个重新尝试
+                    if (state.exchange(uninitialized, std::memory_order_release) == initializing_with_waiters)
+                        futex_wake(state, INT_MAX);
+                    throw;
+                }
+                if (state.exchange(ready, std::memory_order_release) == initializing_with_waiters)
+                    futex_wake(state, INT_MAX);
+                return *pointer();
+            }
+            // 先登记有人在等，初始化线程完成时才会发起唤醒
+            if (s == initializing &&
+                !state.compare_exchange_strong(s, initializing_with_waiters, std::memory_order_relaxed,
+                                               std::memory_order_relaxed))
+                continue;
+            futex_wait(state, initializing_with_waiters);
+        }
+    }
+
+public:
+    typedef T value_type;
+
+    // 不带参数时用 T() 构造，T 没有默认构造函数时必须提供工厂
+    constexpr lazy() noexcept : state(uninitialized), factory(&default_factory), storage{} {}
+    constexpr explicit lazy(T (*factory_)()) noexcept : state(uninitialized), factory(factory_), storage{} {}
+    lazy(lazy const&)=delete;
+    lazy& operator=(lazy const&)=delete;
+
+    ~lazy()
+    {
+        if (state.load(std::memory_order_relaxed) == ready)
+            pointer()->~T();
+    }
+
+    T& get()
+    {
+        if (state.load(std::memory_order_acquire) == ready)
+            return *pointer();
+        return get_slow();
+    }
+
+    T& operator*()
+    {
+        return get();
+    }
+
+    T* operator->()
+    {
+        return &get();
+    }
+
+    bool initialized() const
+    {
+        return state.load(std::memory_order_acquire) == ready;
+    }
+};
+
+// 全局 lazy 对象的线程缓存版本：每个线程第一次访问后把对象地址记在自己的 thread_local 指针里，
+// 之后不再读 lazy 的状态字。当 T 和状态字在同一个缓存行上、而 T 又经常被修改时，可以避免读者和写者争用这个缓存行。
+// 用法：lazy<config> global_config; ... cached_get<global_config>().value
+template<auto& Lazy>
+typename std::remove_reference_t<decltype(Lazy)>::value_type& cached_get()
+{
+    static thread_local typename std::remove_reference_t<decltype(Lazy)>::value_type* cached = nullptr;
+    if (!cached)
+        cached = &Lazy.get();
+    return *cached;
+}
+
+#endif //CPP_CONCURRENCY_LAZY_H
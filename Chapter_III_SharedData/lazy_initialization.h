@@ -1,6 +1,7 @@
 //
 // Created by 13345 on 2023/7/10.
 // 代码清单3.11 线程安全的延迟初始化
+// 使用前需要先定义 some_resource（带有 do_something 成员函数）
 //
 
 #ifndef CPP_CONCURRENCY_LAZY_INITIALIZATION_H
@@ -9,14 +10,17 @@
 #include <memory>
 #include <mutex>
 
-std::shared_ptr<some_resource> resource_ptr;
-std::once_flag resource_flag;
-void init_resource()
+#include "lazy.h"
+
+// 头文件中定义的全局变量和函数要声明为 inline，否则被多个源文件包含时会重复定义
+inline std::shared_ptr<some_resource> resource_ptr;
+inline std::once_flag resource_flag;
+inline void init_resource()
 {
     resource_ptr.reset(new some_resource);
 }
 
-void foo()
+inline void foo()
 {
     // 如果init_resource是类成员函数，则还需传入类的this指针
     // std::call_once(resource_flag, &X::init_resource, this)
@@ -24,4 +28,12 @@ void foo()
     resource_ptr->do_something();
 }
 
+// 同样的功能用 lazy 实现：初始化之后每次访问只有一次 acquire 读，对象就在 lazy 内部
+inline lazy<some_resource> lazy_resource;
+
+inline void foo_lazy()
+{
+    lazy_resource->do_something();
+}
+
 #endif //CPP_CONCURRENCY_LAZY_INITIALIZATION_H
@@ -0,0 +1,87 @@
+//
+// Created by 13345 on 2024/4/28.
+// 只占一个字节的互斥锁：低位表示已加锁，次低位表示有线程在 parking_lot 中等待
+// 无竞争时加锁解锁各是一次原子操作，与 std::mutex 相同，但 std::mutex 在 glibc 上占 40 字节，
+// 对每个节点一把锁的数据结构（threadsafe_list 的逐节点加锁）来说，锁比数据本身还大。
+// 竞争时先自旋一小段，仍拿不到锁就置位等待标志并在全局等待表中睡眠；解锁时只有看到等待标志才需要系统调用。
+//
+
+#ifndef CPP_CONCURRENCY_PARKING_MUTEX_H
+#define CPP_CONCURRENCY_PARKING_MUTEX_H
+
+#include <atomic>
+
+#include "cpu_relax.h"
+#include "futex.h"
+
+class parking_mutex
+{
+private:
+    static unsigned char const locked_bit = 1;
+    static unsigned char const parked_bit = 2;
+    static unsigned const spin_count = 40;
+
+    std::atomic<unsigned char> state;
+
+    void lock_slow()
+    {
+        unsigned spins = 0;
+        while (true)
+        {
+            unsigned char s = state.load(std::memory_order_relaxed);
+            if (!(s & locked_bit))
+            {
+                // 保留等待标志：可能还有其他线程在睡眠
+                if (state.compare_exchange_weak(s, s | locked_bit, std::memory_order_acquire, std::memory_order_relaxed))
+                    return;
+                continue;
+            }
+            if (!(s & parked_bit))
+            {
+                if (spins < spin_count)
+                {
+                    ++spins;
+                    cpu_relax();
+                    continue;
+                }
+                if (!state.compare_exchange_weak(s, s | parked_bit, std::memory_order_relaxed, std::memory_order_relaxed))
+                    continue;
+            }
+            parking_lot::park(this, [this] {
+                return state.load(std::memory_order_seq_cst) == (locked_bit | parked_bit);
+            });
+        }
+    }
+
+public:
+    parking_mutex() : state(0) {}
+    parking_mutex(parking_mutex const&)=delete;
+    parking_mutex& operator=(parking_mutex const&)=delete;
+
+    void lock()
+    {
+        unsigned char expected = 0;
+        if (!state.compare_exchange_weak(expected, locked_bit, std::memory_order_acquire, std::memory_order_relaxed))
+            lock_slow();
+    }
+
+    bool try_lock()
+    {
+        unsigned char s = state.load(std::memory_order_relaxed);
+        while (!(s & locked_bit))
+        {
+            if (state.compare_exchange_weak(s, s | locked_bit, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    void unlock()
+    {
+        // 清除等待标志并唤醒所有等待者，没抢到锁的会重新置位后再睡
+        if (state.exchange(0, std::memory_order_seq_cst) & parked_bit)
+            parking_lot::unpark_all(this);
+    }
+};
+
+#endif //CPP_CONCURRENCY_PARKING_MUTEX_H
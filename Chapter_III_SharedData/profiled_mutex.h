@@ -0,0 +1,325 @@
+//
+// Created by 13345 on 2024/5/4.
+// 锁竞争分析：profiled_mutex<Mutex> 可以包装任何提供 lock/try_lock/unlock 的锁
+// 每次加锁先 try_lock，失败才算一次竞争。统计数据只在持有内部锁时更新，写者只有一个，不需要读-改-写的原子操作；
+// 但它们是 relaxed 原子变量，stats() 读取时不加内部锁：否则 report() 在持有登记表的锁时去获取用户的锁，
+// 而持有用户的锁的线程构造或析构另一个 profiled_mutex 时又会获取登记表的锁，两者顺序相反会死锁。
+// 读到的各项计数之间可能相差几次加锁，对统计没有影响。
+// 1) 加锁次数、竞争次数
+// 2) 等待时间和持有时间的直方图（按纳秒数的 log2 分桶）：竞争的加锁总是计时，无竞争的每 sample_period 次采样一次，
+//    避免在热路径上每次都读时钟。采样计数器是 thread_local 的，同一个线程中同一种 Mutex 的所有 profiled_mutex 共用一个，
+//    所以是按线程、按类型每 sample_period 次无竞争加锁采样一次，而不是严格地按每把锁
+// 3) 竞争最多的调用位置（调用 lock 的返回地址，可以用 addr2line 换成源码行）
+// 所有 profiled_mutex 都登记在全局的 lock_profiler 中，lock_profiler::report 按竞争次数从高到低打印。
+//
+
+#ifndef CPP_CONCURRENCY_PROFILED_MUTEX_H
+#define CPP_CONCURRENCY_PROFILED_MUTEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 不内联 lock，并取得调用者的返回地址作为调用位置；不支持的编译器上调用位置为空
+#if defined(__GNUC__)
+#define PROFILED_MUTEX_NOINLINE __attribute__((noinline))
+#define PROFILED_MUTEX_RETURN_ADDRESS() __builtin_return_address(0)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define PROFILED_MUTEX_NOINLINE __declspec(noinline)
+#define PROFILED_MUTEX_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define PROFILED_MUTEX_NOINLINE
+#define PROFILED_MUTEX_RETURN_ADDRESS() nullptr
+#endif
+
+struct lock_stats
+{
+    static unsigned const num_buckets = 32;
+
+    struct call_site
+    {
+        void const* address;
+        unsigned long contended;
+        unsigned long long wait_ns;
+    };
+
+    unsigned long acquisitions;
+    unsigned long contended;
+    // wait_histogram[i] 是等待时间在 [2^i, 2^(i+1)) 纳秒之间的次数
+    unsigned long wait_histogram[num_buckets];
+    unsigned long hold_histogram[num_buckets];
+    // 按竞争次数从高到低排序
+    std::vector<call_site> top_sites;
+
+    lock_stats() : acquisitions(0), contended(0), wait_histogram(), hold_histogram() {}
+};
+
+class profiled_mutex_base
+{
+public:
+    virtual ~profiled_mutex_base() = default;
+    virtual std::string const& name() const = 0;
+    virtual lock_stats stats() const = 0;
+};
+
+class lock_profiler
+{
+    std::mutex m;
+    std::vector<profiled_mutex_base const*> mutexes;
+
+    static void print_histogram(std::FILE* out, char const* label, unsigned long const* histogram)
+    {
+        std::fprintf(out, "    %s:", label);
+        for (unsigned i = 0; i < lock_stats::num_buckets; ++i)
+        {
+            if (histogram[i])
+                std::fprintf(out, " %lu:%lu", 1ul << i, histogram[i]);
+        }
+        std::fprintf(out, "\n");
+    }
+
+public:
+    static lock_profiler& instance()
+    {
+        static lock_profiler profiler;
+        return profiler;
+    }
+
+    void add(profiled_mutex_base const* p)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        mutexes.push_back(p);
+    }
+
+    void remove(profiled_mutex_base const* p)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        mutexes.erase(std::remove(mutexes.begin(), mutexes.end(), p), mutexes.end());
+    }
+
+    // 打印竞争最多的 top_mutexes 把锁，每把锁列出竞争最多的 top_sites 个调用位置
+    void report(std::FILE* out=stdout, std::size_t top_mutexes=10, std::size_t top_sites=5)
+    {
+        std::vector<std::pair<std::string, lock_stats>> all;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            for (auto p : mutexes)
+                all.emplace_back(p->name(), p->stats());
+        }
+        std::sort(all.begin(), all.end(), [](auto const& a, auto const& b) {
+            return a.second.contended > b.second.contended;
+        });
+        if (all.size() > top_mutexes)
+            all.resize(top_mutexes);
+        for (auto const& item : all)
+        {
+            lock_stats const& s = item.second;
+            std::fprintf(out, "%s: %lu acquisitions, %lu contended (%.1f%%)\n", item.first.c_str(),
+                         s.acquisitions, s.contended, s.acquisitions ? 100.0 * s.contended / s.acquisitions : 0.0);
+            print_histogram(out, "wait ns", s.wait_histogram);
+            print_histogram(out, "hold ns", s.hold_histogram);
+            for (std::size_t i = 0; i < s.top_sites.size() && i < top_sites; ++i)
+            {
+                lock_stats::call_site const& site = s.top_sites[i];
+                std::fprintf(out, "    site %p: %lu contended, %.0f ns average wait\n", site.address,
+                             site.contended, static_cast<double>(site.wait_ns) / site.contended);
+            }
+        }
+    }
+};
+
+template<typename Mutex>
+class profiled_mutex : public profiled_mutex_base
+{
+private:
+    typedef std::chrono::steady_clock clock;
+    static unsigned const max_sites = 32;
+
+    Mutex internal_mutex;
+    std::string const mutex_name;
+    unsigned sample_period;
+
+    struct site_counter
+    {
+        std::atomic<void const*> address;
+        std::atomic<unsigned long> contended;
+        std::atomic<unsigned long long> wait_ns;
+    };
+
+    // 以下成员只在持有 internal_mutex 时修改，stats() 不加锁读取
+    std::atomic<unsigned long> acquisitions;
+    std::atomic<unsigned long> contended;
+    std::atomic<unsigned long> wait_histogram[lock_stats::num_buckets];
+    std::atomic<unsigned long> hold_histogram[lock_stats::num_buckets];
+    site_counter sites[max_sites];
+    // 持有时间是否在计时，以及开始的时刻，只有持有锁的线程访问
+    bool timing_hold;
+    clock::time_point hold_start;
+
+    static unsigned bucket_of(clock::duration d)
+    {
+        unsigned long long const ns = static_cast<unsigned long long>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        unsigned bucket = 0;
+        while (bucket + 1 < lock_stats::num_buckets && (ns >> (bucket + 1)) != 0)
+            ++bucket;
+        return bucket;
+    }
+
+    // 只有持有 internal_mutex 的线程修改，不需要读-改-写
+    template<typename T>
+    static void add(std::atomic<T>& counter, T n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    bool should_sample() const
+    {
+        static thread_local unsigned counter = 0;
+        return ++counter % sample_period == 0;
+    }
+
+    void record_site(void const* address, clock::duration wait)
+    {
+        unsigned long long const ns = static_cast<unsigned long long>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count());
+        // 地址散列后线性探测；表满时计入最后一个槽位
+        unsigned i = static_cast<unsigned>((reinterpret_cast<std::uintptr_t>(address) >> 2) % max_sites);
+        for (unsigned probe = 0; probe < max_sites; ++probe, i = (i + 1) % max_sites)
+        {
+            void const* const current = sites[i].address.load(std::memory_order_relaxed);
+            if (current == address || current == nullptr)
+                break;
+        }
+        void const* const current = sites[i].address.load(std::memory_order_relaxed);
+        if (current != address && current != nullptr)
+            i = max_sites - 1;
+        else
+            sites[i].address.store(address, std::memory_order_relaxed);
+        add(sites[i].contended, 1ul);
+        add(sites[i].wait_ns, ns);
+    }
+
+    void acquired(bool was_contended, bool timed, clock::time_point start, void const* site)
+    {
+        add(acquisitions, 1ul);
+        timing_hold = timed;
+        if (!timed)
+            return;
+        hold_start = clock::now();
+        add(wait_histogram[bucket_of(hold_start - start)], 1ul);
+        if (was_contended)
+        {
+            add(contended, 1ul);
+            record_site(site, hold_start - start);
+        }
+    }
+
+public:
+    // 其余参数转发给被包装的锁，例如 profiled_mutex<hierarchical_mutex>("name", 1000)
+    template<typename... Args>
+    explicit profiled_mutex(std::string name, Args&&... args) :
+        internal_mutex(std::forward<Args>(args)...), mutex_name(std::move(name)),
+        sample_period(64), acquisitions(0), contended(0), timing_hold(false)
+    {
+        for (unsigned i = 0; i < lock_stats::num_buckets; ++i)
+        {
+            wait_histogram[i].store(0, std::memory_order_relaxed);
+            hold_histogram[i].store(0, std::memory_order_relaxed);
+        }
+        for (auto& site : sites)
+        {
+            site.address.store(nullptr, std::memory_order_relaxed);
+            site.contended.store(0, std::memory_order_relaxed);
+            site.wait_ns.store(0, std::memory_order_relaxed);
+        }
+        lock_profiler::instance().add(this);
+    }
+
+    ~profiled_mutex() override
+    {
+        lock_profiler::instance().remove(this);
+    }
+
+    profiled_mutex(profiled_mutex const&)=delete;
+    profiled_mutex& operator=(profiled_mutex const&)=delete;
+
+    // 无竞争的加锁每 period 次计时一次，1 表示每次都计时；应在开始使用之前设置
+    void set_sample_period(unsigned period)
+    {
+        sample_period = period == 0 ? 1 : period;
+    }
+
+    // 不内联，这样返回地址就是调用 lock 的位置
+    PROFILED_MUTEX_NOINLINE void lock()
+    {
+        void const* const site = PROFILED_MUTEX_RETURN_ADDRESS();
+        bool const timed = should_sample();
+        clock::time_point const start = timed ? clock::now() : clock::time_point();
+        if (internal_mutex.try_lock())
+        {
+            acquired(false, timed, start, site);
+            return;
+        }
+        // 竞争时总是计时：此时读时钟的开销相对等待时间可以忽略
+        clock::time_point const contended_start = timed ? start : clock::now();
+        internal_mutex.lock();
+        acquired(true, true, contended_start, site);
+    }
+
+    bool try_lock()
+    {
+        if (!internal_mutex.try_lock())
+            return false;
+        bool const timed = should_sample();
+        acquired(false, timed, timed ? clock::now() : clock::time_point(), nullptr);
+        return true;
+    }
+
+    void unlock()
+    {
+        if (timing_hold)
+            add(hold_histogram[bucket_of(clock::now() - hold_start)], 1ul);
+        internal_mutex.unlock();
+    }
+
+    std::string const& name() const override
+    {
+        return mutex_name;
+    }
+
+    // 不获取内部锁，可以在任何线程中调用，包括持有这把锁的线程
+    lock_stats stats() const override
+    {
+        lock_stats res;
+        res.acquisitions = acquisitions.load(std::memory_order_relaxed);
+        res.contended = contended.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < lock_stats::num_buckets; ++i)
+        {
+            res.wait_histogram[i] = wait_histogram[i].load(std::memory_order_relaxed);
+            res.hold_histogram[i] = hold_histogram[i].load(std::memory_order_relaxed);
+        }
+        for (auto const& site : sites)
+        {
+            lock_stats::call_site const copy = {site.address.load(std::memory_order_relaxed),
+                                                site.contended.load(std::memory_order_relaxed),
+                                                site.wait_ns.load(std::memory_order_relaxed)};
+            if (copy.contended)
+                res.top_sites.push_back(copy);
+        }
+        std::sort(res.top_sites.begin(), res.top_sites.end(), [](lock_stats::call_site const& a,
+                                                                 lock_stats::call_site const& b) {
+            return a.contended > b.contended;
+        });
+        return res;
+    }
+};
+
+#endif //CPP_CONCURRENCY_PROFILED_MUTEX_H
@@ -1,6 +1,9 @@
 //
 // Created by 13345 on 2023/7/10.
 // 读写锁（共享锁和排他锁）的简单应用，基于C++ 14（shared_mutex是C++14的特性）
+// rcu_dns_cache 是读多写少时的 RCU（read-copy-update）版本：读者只读取原子发布的不可变快照，
+// 不写任何共享内存；写者复制一份新的 map 修改后原子地替换，旧版本等宽限期过后由 EBR 释放。
+// dns_cache 的读写锁类型可以通过 basic_dns_cache 的模板参数替换。dns_entry 需要在包含本文件之前定义。
 //
 
 #ifndef CPP_CONCURRENCY_READ_WRITE_LOCK_H
@@ -10,25 +13,82 @@
 #include <string>
 #include <mutex>
 #include <shared_mutex>
+#include <atomic>
+#include <memory>
+
+#include "../Chapter_VII_DataStructure_with_LockFree/epoch_reclamation.h"
 
 class dns_entry;
-class dns_cache
+// SharedMutex 可以换成 distributed_shared_mutex 等任何提供 lock_shared/lock 接口的读写锁
+template<typename SharedMutex>
+class basic_dns_cache
 {
     std::map<std::string, dns_entry> entries;
-    mutable std::shared_mutex entry_mutex;
+    mutable SharedMutex entry_mutex;
 public:
     dns_entry find_entry(std::string const& domain) const
     {
-        std::shared_lock<std::shared_mutex> lk(entry_mutex);
-        std::map<std::string, dns_entry>::const_iterator const it = entries.find(domain);
+        std::shared_lock<SharedMutex> lk(entry_mutex);
+        typename std::map<std::string, dns_entry>::const_iterator const it = entries.find(domain);
         return (it == entries.end() ? dns_entry() : it->second);
     }
     void update_or_add_entry(std::string const& domain, dns_entry const& dns_detail)
     {
-        std::lock_guard<std::shared_mutex> lk(entry_mutex);
+        std::lock_guard<SharedMutex> lk(entry_mutex);
         entries[domain] = dns_detail;
     }
 };
 
+typedef basic_dns_cache<std::shared_mutex> dns_cache;
+
+class rcu_dns_cache
+{
+    typedef std::map<std::string, dns_entry> entry_map;
+    std::atomic<entry_map const*> entries;
+    // 写者之间互斥，避免两个写者基于同一个旧版本各自修改、互相覆盖
+    std::mutex writer_mutex;
+    epoch_domain& reclaimer;
+
+    void publish(entry_map const* new_entries)
+    {
+        entry_map const* const old_entries = entries.exchange(new_entries, std::memory_order_acq_rel);
+        reclaimer.retire(const_cast<entry_map*>(old_entries));
+    }
+public:
+    explicit rcu_dns_cache(epoch_domain& reclaimer_=epoch_domain::global()) :
+        entries(new entry_map), reclaimer(reclaimer_) {}
+    rcu_dns_cache(rcu_dns_cache const&)=delete;
+    rcu_dns_cache& operator=(rcu_dns_cache const&)=delete;
+    ~rcu_dns_cache()
+    {
+        delete entries.load(std::memory_order_relaxed);
+    }
+
+    dns_entry find_entry(std::string const& domain) const
+    {
+        epoch_guard guard(reclaimer);
+        entry_map const& current = *entries.load(std::memory_order_acquire);
+        entry_map::const_iterator const it = current.find(domain);
+        return (it == current.end() ? dns_entry() : it->second);
+    }
+
+    void update_or_add_entry(std::string const& domain, dns_entry const& dns_detail)
+    {
+        std::lock_guard<std::mutex> lk(writer_mutex);
+        std::unique_ptr<entry_map> new_entries(new entry_map(*entries.load(std::memory_order_relaxed)));
+        (*new_entries)[domain] = dns_detail;
+        publish(new_entries.release());
+    }
+
+    // 一次复制完成多处修改：f(map&) 修改新版本，之后整体发布
+    template<typename Function>
+    void update(Function f)
+    {
+        std::lock_guard<std::mutex> lk(writer_mutex);
+        std::unique_ptr<entry_map> new_entries(new entry_map(*entries.load(std::memory_order_relaxed)));
+        f(*new_entries);
+        publish(new_entries.release());
+    }
+};
 
 #endif //CPP_CONCURRENCY_READ_WRITE_LOCK_H
@@ -0,0 +1,284 @@
+//
+// Created by 13345 on 2024/4/30.
+// 几种自旋锁，接口与 std::mutex 相同（lock/try_lock/unlock），可以作为容器的 Lock 模板参数
+// 容器的临界区通常只有几十纳秒，std::mutex 竞争时进入内核睡眠再被唤醒的代价远大于临界区本身。
+// 1) ttas_lock：先读后写（test-and-test-and-set），失败后指数退避，减少对同一缓存行的写
+// 2) ticket_lock：按取号顺序进入，公平；等待时按前面排队的人数成比例地退避
+// 3) mcs_lock：每个等待者在自己的队列节点上自旋，解锁只写后继的节点，竞争激烈时缓存行流量最小
+// 4) adaptive_mutex：先自旋，自旋的上限按最近的成功情况调整，仍拿不到锁就在 parking_lot 上睡眠
+// 线程数多于核数时，持锁线程可能被切换出去，纯自旋会浪费整个时间片，所以自旋一段时间后都会 yield。
+//
+
+#ifndef CPP_CONCURRENCY_SPIN_LOCKS_H
+#define CPP_CONCURRENCY_SPIN_LOCKS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "cpu_relax.h"
+#include "parking_mutex.h"
+
+class ttas_lock
+{
+private:
+    static unsigned const min_backoff = 4;
+    static unsigned const max_backoff = 1024;
+
+    std::atomic<bool> locked;
+
+public:
+    ttas_lock() : locked(false) {}
+    ttas_lock(ttas_lock const&)=delete;
+    ttas_lock& operator=(ttas_lock const&)=delete;
+
+    void lock()
+    {
+        unsigned backoff = min_backoff;
+        while (true)
+        {
+            while (locked.load(std::memory_order_relaxed))
+                cpu_relax();
+            if (!locked.exchange(true, std::memory_order_acquire))
+                return;
+            // 读到空闲但没抢到，说明有竞争：退避的时间加倍，到上限后让出时间片
+            if (backoff < max_backoff)
+            {
+                for (unsigned i = 0; i < backoff; ++i)
+                    cpu_relax();
+                backoff *= 2;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool try_lock()
+    {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        locked.store(false, std::memory_order_release);
+    }
+};
+
+class ticket_lock
+{
+private:
+    static unsigned const spin_count = 64;
+
+    std::atomic<std::uint16_t> next_ticket;
+    std::atomic<std::uint16_t> now_serving;
+
+public:
+    ticket_lock() : next_ticket(0), now_serving(0) {}
+    ticket_lock(ticket_lock const&)=delete;
+    ticket_lock& operator=(ticket_lock const&)=delete;
+
+    void lock()
+    {
+        std::uint16_t const my_ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+        unsigned spins = 0;
+        while (true)
+        {
+            std::uint16_t const serving = now_serving.load(std::memory_order_acquire);
+            if (serving == my_ticket)
+                return;
+            // 前面每个人大约要用一个临界区的时间
+            std::uint16_t const ahead = static_cast<std::uint16_t>(my_ticket - serving);
+            if (++spins < spin_count)
+            {
+                for (unsigned i = 0; i < ahead * 8u; ++i)
+                    cpu_relax();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool try_lock()
+    {
+        std::uint16_t const serving = now_serving.load(std::memory_order_acquire);
+        std::uint16_t expected = serving;
+        // 只有没人排队（下一个号就是正在服务的号）时才取号
+        return next_ticket.compare_exchange_strong(expected, static_cast<std::uint16_t>(serving + 1),
+                                                   std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        now_serving.store(static_cast<std::uint16_t>(now_serving.load(std::memory_order_relaxed) + 1),
+                          std::memory_order_release);
+    }
+};
+
+class mcs_lock
+{
+private:
+    static unsigned const spin_count = 64;
+
+    struct alignas(64) queue_node
+    {
+        std::atomic<queue_node*> next;
+        std::atomic<bool> waiting;
+    };
+
+    // 一个线程可能同时持有多把锁（比如链表的逐节点加锁），所以每个线程有一个队列节点的空闲链表
+    struct node_cache
+    {
+        std::vector<std::unique_ptr<queue_node>> storage;
+        std::vector<queue_node*> free_nodes;
+
+        queue_node* get()
+        {
+            if (free_nodes.empty())
+            {
+                storage.emplace_back(new queue_node);
+                return storage.back().get();
+            }
+            queue_node* const n = free_nodes.back();
+            free_nodes.pop_back();
+            return n;
+        }
+
+        void put(queue_node* n)
+        {
+            free_nodes.push_back(n);
+        }
+    };
+
+    static node_cache& local_nodes()
+    {
+        static thread_local node_cache cache;
+        return cache;
+    }
+
+    std::atomic<queue_node*> tail;
+    // 只有持锁线程读写
+    queue_node* holder;
+
+public:
+    mcs_lock() : tail(nullptr), holder(nullptr) {}
+    mcs_lock(mcs_lock const&)=delete;
+    mcs_lock& operator=(mcs_lock const&)=delete;
+
+    void lock()
+    {
+        queue_node* const me = local_nodes().get();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        me->waiting.store(true, std::memory_order_relaxed);
+        queue_node* const pred = tail.exchange(me, std::memory_order_acq_rel);
+        if (pred)
+        {
+            pred->next.store(me, std::memory_order_release);
+            unsigned spins = 0;
+            while (me->waiting.load(std::memory_order_acquire))
+            {
+                if (++spins < spin_count)
+                    cpu_relax();
+                else
+                    std::this_thread::yield();
+            }
+        }
+        holder = me;
+    }
+
+    bool try_lock()
+    {
+        queue_node* const me = local_nodes().get();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        queue_node* expected = nullptr;
+        if (!tail.compare_exchange_strong(expected, me, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            local_nodes().put(me);
+            return false;
+        }
+        holder = me;
+        return true;
+    }
+
+    void unlock()
+    {
+        queue_node* const me = holder;
+        queue_node* next = me->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            queue_node* expected = me;
+            if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+            {
+                local_nodes().put(me);
+                return;
+            }
+            // 后继已经换了 tail 但还没来得及链接到 me 上
+            unsigned spins = 0;
+            while (!(next = me->next.load(std::memory_order_acquire)))
+            {
+                if (++spins < spin_count)
+                    cpu_relax();
+                else
+                    std::this_thread::yield();
+            }
+        }
+        // 交出锁之后就没有人再访问 me，可以放回空闲链表
+        next->waiting.store(false, std::memory_order_release);
+        local_nodes().put(me);
+    }
+};
+
+class adaptive_mutex
+{
+private:
+    static unsigned const max_spins = 256;
+
+    parking_mutex inner;
+    // 最近几次加锁需要的自旋次数的滑动平均
+    std::atomic<std::uint16_t> spin_estimate;
+
+public:
+    adaptive_mutex() : spin_estimate(16) {}
+    adaptive_mutex(adaptive_mutex const&)=delete;
+    adaptive_mutex& operator=(adaptive_mutex const&)=delete;
+
+    void lock()
+    {
+        if (inner.try_lock())
+            return;
+        unsigned const estimate = spin_estimate.load(std::memory_order_relaxed);
+        unsigned const limit = estimate * 2 + 16 < max_spins ? estimate * 2 + 16 : max_spins;
+        unsigned spins = 0;
+        while (spins < limit)
+        {
+            ++spins;
+            cpu_relax();
+            if (inner.try_lock())
+            {
+                spin_estimate.store(static_cast<std::uint16_t>(estimate + (static_cast<int>(spins) - static_cast<int>(estimate)) / 8),
+                                    std::memory_order_relaxed);
+                return;
+            }
+        }
+        // 自旋到上限还没拿到，以后少转一些，直接去睡眠
+        spin_estimate.store(static_cast<std::uint16_t>(estimate - estimate / 8), std::memory_order_relaxed);
+        inner.lock();
+    }
+
+    bool try_lock()
+    {
+        return inner.try_lock();
+    }
+
+    void unlock()
+    {
+        inner.unlock();
+    }
+};
+
+#endif //CPP_CONCURRENCY_SPIN_LOCKS_H
@@ -16,32 +16,36 @@
 
 struct empty_stack: std::exception
 {
-    const char* what() const throw();
+    const char* what() const throw()
+    {
+        return "empty stack";
+    }
 };
 
-template<typename T>
+// Lock 可以换成 spin_locks.h 中的自旋锁
+template<typename T, typename Lock=std::mutex>
 class threadsafe_stack
 {
 private:
     std::stack<T> data;
     // mutable可以用来修饰一个类的成员变量。被 mutable 修饰的变量，将永远处于可变的状态，即使是 const 函数中也可以改变这个变量的值
-    mutable std::mutex m;
+    mutable Lock m;
 public:
     threadsafe_stack() {}
     threadsafe_stack(const threadsafe_stack& other)
     {
-        std::lock_guard<std::mutex> lock(m);
+        std::lock_guard<Lock> lock(other.m);
         data = other.data;
     }
     threadsafe_stack& operator=(const threadsafe_stack&) = delete;
     void push(T new_value)
     {
-        std::lock_guard<std::mutex> lock(m);
+        std::lock_guard<Lock> lock(m);
         data.push(std::move(new_value));
     }
     std::shared_ptr<T> pop()
     {
-        std::lock_guard<std::mutex> lock(m);
+        std::lock_guard<Lock> lock(m);
         if (data.empty()) throw empty_stack();
         std::shared_ptr<T> const res(std::make_shared<T>(data.top()));
         data.pop();
@@ -49,14 +53,14 @@ public:
     }
     void pop(T& value)
     {
-        std::lock_guard<std::mutex> lock(m);
+        std::lock_guard<Lock> lock(m);
         if (data.empty()) throw empty_stack();
         value = data.top();
         data.pop();
     }
     bool empty() const
     {
-        std::lock_guard<std::mutex> lock(m);
+        std::lock_guard<Lock> lock(m);
         return data.empty();
     }
 };
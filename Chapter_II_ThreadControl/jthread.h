@@ -2,6 +2,7 @@
 // Created by 13345 on 2023/7/6.
 // 代码清单2.7 joining_thread类
 // 执行析构函数时，线程即能自动汇合
+// 函数在 thread_cache 的线程上运行（见 thread_cache.h），汇合之后线程回到缓存中等待复用，而不是退出
 //
 
 #ifndef CPP_CONCURRENCY_JTHREAD_H
@@ -9,9 +10,11 @@
 
 #include <thread>
 
+#include "thread_cache.h"
+
 class joining_thread
 {
-    std::thread t;
+    cached_thread t;
 public:
     joining_thread() noexcept=default;
     template<typename Callable, typename ... Args>
@@ -19,6 +22,7 @@ public:
         t(std::forward<Callable>(func), std::forward<Args>(args)...) {}
     //thread对象不可复制，只能转移控制权，所以这里的参数类型为std::thread t_，无论传入的参数类型是什么，资源控制权都将被转移
     explicit joining_thread(std::thread t_) noexcept : t(std::move(t_)) {}
+    explicit joining_thread(cached_thread t_) noexcept : t(std::move(t_)) {}
     joining_thread(joining_thread&& other) noexcept : t(std::move(other.t)) {}
     joining_thread& operator=(joining_thread&& other) noexcept
     {
@@ -31,7 +35,7 @@ public:
     {
         if (joinable())
             join();
-        t = std::move(other);
+        t = cached_thread(std::move(other));
         return *this;
     }
     ~joining_thread() noexcept
@@ -60,11 +64,11 @@ public:
     {
         t.detach();
     }
-    std::thread& as_thread() noexcept
+    cached_thread& as_thread() noexcept
     {
         return t;
     }
-    const std::thread& as_thread() const noexcept
+    const cached_thread& as_thread() const noexcept
     {
         return t;
     }
@@ -1,22 +1,26 @@
 //
 // Created by 13345 on 2023/7/6.
 // 代码清单2，9 并行版的std::accumulate()的简单实现
+// 工作线程取自 thread_cache，反复调用时不再每次创建和销毁线程
 //
 
 #ifndef CPP_CONCURRENCY_PARALLEL_ACCUMULATE_H
 #define CPP_CONCURRENCY_PARALLEL_ACCUMULATE_H
 
+#include <algorithm>
 #include <thread>
 #include <numeric>
 #include <iterator>
 #include <vector>
 
+#include "thread_cache.h"
+
 template<typename Iterator, typename T>
 struct accumulate_block
 {
     void operator()(Iterator first, Iterator last, T& result)
     {
-        result = std::accmulate(first, last, result);
+        result = std::accumulate(first, last, result);
     }
 };
 
@@ -33,14 +37,14 @@ T parallel_accumulate(Iterator first, Iterator last, T init)
     unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
     unsigned long const block_size = length / num_threads;
     std::vector<T> results(num_threads);
-    std::vector<std::thread> threads(num_threads -1);
+    std::vector<cached_thread> threads(num_threads -1);
     Iterator block_start = first;
     for (unsigned long i = 0; i <  (num_threads - 1); ++i)
     {
         Iterator block_end = block_start;
         //Increments given iterator it by n elements.
         std::advance(block_end, block_size);
-        threads[i] = std::thread(
+        threads[i] = cached_thread(
                 //显式的向线程传递引用，以获取计算结果
                 accumulate_block<Iterator, T>(), block_start, block_end, std::ref(results[i])
                 );
@@ -0,0 +1,312 @@
+//
+// Created by 13345 on 2024/5/10.
+// 线程缓存：进程内共享一组可以复用的线程
+// 创建 std::thread 需要 clone 和为栈 mmap，每个线程要几十微秒，对中等规模的输入，这部分开销比计算本身还大。
+// cached_thread 的用法和 std::thread 一样，但函数在 thread_cache 中的线程上运行：
+// 函数返回后线程不退出，而是挂到空闲栈上等下一个任务，空闲超过 idle_timeout 才退出。
+// 空闲栈是后进先出的，最近用过的线程（栈和缓存更可能还是热的）最先被复用，很久不用的线程在栈底超时退出。
+// 注意：
+// 1) 同一个线程会先后运行多个任务，任务留下的 thread_local 状态会被后来的任务看到
+// 2) 与 std::thread 一样，函数抛出的异常会导致 std::terminate，可以 join 的 cached_thread 被析构也会 std::terminate
+//
+
+#ifndef CPP_CONCURRENCY_THREAD_CACHE_H
+#define CPP_CONCURRENCY_THREAD_CACHE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+class thread_cache
+{
+public:
+    // 一次运行的完成状态，由 cached_thread 和运行它的线程共享
+    struct run_state
+    {
+        std::mutex m;
+        std::condition_variable cv;
+        bool done = false;
+    };
+
+    // 只能移动的任务，可以保存 packaged_task 这样不能复制的可调用对象
+    class task
+    {
+        struct impl_base
+        {
+            virtual void call() = 0;
+            virtual ~impl_base() {}
+        };
+
+        template<typename F>
+        struct impl_type : impl_base
+        {
+            F f;
+            impl_type(F&& f_) : f(std::move(f_)) {}
+            void call() override
+            {
+                f();
+            }
+        };
+
+        std::unique_ptr<impl_base> impl;
+    public:
+        task()=default;
+        template<typename F>
+        task(F&& f) : impl(new impl_type<std::decay_t<F>>(std::forward<F>(f))) {}
+        void operator()()
+        {
+            impl->call();
+        }
+        explicit operator bool() const
+        {
+            return impl != nullptr;
+        }
+    };
+
+private:
+    struct worker
+    {
+        std::condition_variable cv;
+        std::thread::id id;
+        task job;
+        std::shared_ptr<run_state> state;
+        // 空闲双向链表，超时的线程可以直接把自己摘下来
+        worker* prev = nullptr;
+        worker* next = nullptr;
+    };
+
+    std::mutex m;
+    // 空闲栈的栈顶
+    worker* idle;
+    std::size_t idle_count;
+    std::size_t thread_count;
+    std::chrono::milliseconds idle_timeout;
+
+    thread_cache() : idle(nullptr), idle_count(0), thread_count(0), idle_timeout(std::chrono::seconds(10)) {}
+
+    void push_idle(worker* w)
+    {
+        w->prev = nullptr;
+        w->next = idle;
+        if (idle)
+            idle->prev = w;
+        idle = w;
+        ++idle_count;
+    }
+
+    void unlink_idle(worker* w)
+    {
+        if (w->prev)
+            w->prev->next = w->next;
+        else
+            idle = w->next;
+        if (w->next)
+            w->next->prev = w->prev;
+        --idle_count;
+    }
+
+    static void finish(std::shared_ptr<run_state> const& state)
+    {
+        std::lock_guard<std::mutex> lk(state->m);
+        state->done = true;
+        state->cv.notify_all();
+    }
+
+    void worker_loop(task first, std::shared_ptr<run_state> state)
+    {
+        worker self;
+        self.id = std::this_thread::get_id();
+        self.job = std::move(first);
+        self.state = std::move(state);
+        std::unique_lock<std::mutex> lk(m, std::defer_lock);
+        while (true)
+        {
+            self.job();
+            // 先销毁任务再通知完成，join 返回时任务持有的资源都已释放
+            self.job = task();
+            {
+                std::shared_ptr<run_state> const finished = std::move(self.state);
+                // 先回到空闲栈再通知完成：join 之后马上启动的下一个任务可以复用这个线程，而不是再创建一个
+                lk.lock();
+                push_idle(&self);
+                lk.unlock();
+                finish(finished);
+            }
+            lk.lock();
+            if (!self.cv.wait_for(lk, idle_timeout, [&] {return static_cast<bool>(self.job);}))
+            {
+                unlink_idle(&self);
+                --thread_count;
+                return;
+            }
+            lk.unlock();
+        }
+    }
+
+public:
+    thread_cache(thread_cache const&)=delete;
+    thread_cache& operator=(thread_cache const&)=delete;
+
+    // 进程内唯一的实例。有意不析构：进程退出时空闲线程还阻塞在它的成员上
+    static thread_cache& instance()
+    {
+        static thread_cache* const cache = new thread_cache;
+        return *cache;
+    }
+
+    // 在空闲线程上运行 t，没有空闲线程时创建一个；返回运行它的线程的 id
+    std::thread::id launch(task t, std::shared_ptr<run_state> state)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        if (worker* const w = idle)
+        {
+            unlink_idle(w);
+            w->job = std::move(t);
+            w->state = std::move(state);
+            // 持有锁通知：w 在空闲等待超时后会销毁，解锁之后就不能再访问它
+            w->cv.notify_one();
+            return w->id;
+        }
+        ++thread_count;
+        lk.unlock();
+        try
+        {
+            std::thread th(&thread_cache::worker_loop, this, std::move(t), std::move(state));
+            std::thread::id const id = th.get_id();
+            th.detach();
+            return id;
+        }
+        catch (...)
+        {
+            lk.lock();
+            --thread_count;
+            throw;
+        }
+    }
+
+    // 只影响之后开始空闲等待的线程
+    void set_idle_timeout(std::chrono::milliseconds timeout)
+    {
+        std::lock_guard<std::mutex> lk(m);
+        idle_timeout = timeout;
+    }
+
+    std::size_t idle_threads()
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return idle_count;
+    }
+
+    std::size_t total_threads()
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return thread_count;
+    }
+};
+
+// 接口与 std::thread 相同，也可以接管一个已有的 std::thread
+class cached_thread
+{
+    std::shared_ptr<thread_cache::run_state> state;
+    std::thread::id id;
+    std::thread adopted;
+
+public:
+    cached_thread() noexcept=default;
+
+    // 与 std::thread 一样，参数按值复制到新线程中，需要传引用时用 std::ref
+    template<typename Callable, typename ... Args,
+             typename = std::enable_if_t<!std::is_same<std::decay_t<Callable>, cached_thread>::value &&
+                                         !std::is_same<std::decay_t<Callable>, std::thread>::value>>
+    explicit cached_thread(Callable&& func, Args&& ... args) :
+        state(std::make_shared<thread_cache::run_state>())
+    {
+        id = thread_cache::instance().launch(
+                [f = std::decay_t<Callable>(std::forward<Callable>(func)),
+                 bound = std::tuple<std::decay_t<Args>...>(std::forward<Args>(args)...)]() mutable {
+                    std::apply(std::move(f), std::move(bound));
+                }, state);
+    }
+
+    explicit cached_thread(std::thread t) noexcept : id(t.get_id()), adopted(std::move(t)) {}
+
+    cached_thread(cached_thread&& other) noexcept :
+        state(std::move(other.state)), id(other.id), adopted(std::move(other.adopted))
+    {
+        other.id = std::thread::id();
+    }
+
+    cached_thread& operator=(cached_thread&& other) noexcept
+    {
+        if (joinable())
+            std::terminate();
+        state = std::move(other.state);
+        id = other.id;
+        adopted = std::move(other.adopted);
+        other.id = std::thread::id();
+        return *this;
+    }
+
+    ~cached_thread()
+    {
+        if (joinable())
+            std::terminate();
+    }
+
+    void swap(cached_thread& other) noexcept
+    {
+        state.swap(other.state);
+        std::swap(id, other.id);
+        adopted.swap(other.adopted);
+    }
+
+    std::thread::id get_id() const noexcept
+    {
+        return id;
+    }
+
+    bool joinable() const noexcept
+    {
+        return id != std::thread::id();
+    }
+
+    // 等待函数返回，线程本身回到缓存中
+    void join()
+    {
+        if (!joinable())
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument));
+        if (id == std::this_thread::get_id())
+            throw std::system_error(std::make_error_code(std::errc::resource_deadlock_would_occur));
+        if (adopted.joinable())
+            adopted.join();
+        else
+        {
+            std::unique_lock<std::mutex> lk(state->m);
+            state->cv.wait(lk, [this] {return state->done;});
+            lk.unlock();
+            state.reset();
+        }
+        id = std::thread::id();
+    }
+
+    void detach()
+    {
+        if (!joinable())
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument));
+        if (adopted.joinable())
+            adopted.detach();
+        state.reset();
+        id = std::thread::id();
+    }
+};
+
+#endif //CPP_CONCURRENCY_THREAD_CACHE_H
@@ -0,0 +1,213 @@
+//
+// Created by 13345 on 2024/5/8.
+// 可中断等待的性能测试
+// 1) 中断延迟：从调用 interrupt() 到等待线程捕获 thread_interrupted 的时间
+// 2) 空闲开销：N 个线程阻塞在可中断等待上时整个进程消耗的 CPU 时间
+// 作为对照，polling_wait 是原来的实现方式：每 1ms 醒来检查一次中断标志
+//
+
+#include "interruptible_thread.h"
+#include "threadsafe_queue_complex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+typedef std::chrono::steady_clock bench_clock;
+
+// 原来的轮询实现
+void polling_wait(std::condition_variable& cv, std::unique_lock<std::mutex>& lk)
+{
+    interruption_point();
+    cv.wait_for(lk, std::chrono::milliseconds(1));
+    interruption_point();
+}
+
+double process_cpu_seconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// 每种等待方式的被测对象：wait() 在被中断线程中阻塞，永远等不到数据
+struct cv_wait
+{
+    std::mutex m;
+    std::condition_variable cv;
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        while (true)
+            interruptible_wait(cv, lk);
+    }
+};
+
+struct polling_cv_wait
+{
+    std::mutex m;
+    std::condition_variable cv;
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        while (true)
+            polling_wait(cv, lk);
+    }
+};
+
+struct cv_any_wait
+{
+    std::mutex m;
+    std::condition_variable_any cv;
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        while (true)
+            interruptible_wait(cv, lk);
+    }
+};
+
+struct queue_wait
+{
+    threadsafe_queue<int> queue;
+    void wait()
+    {
+        int value;
+        interruptible_wait_and_pop(queue, value);
+    }
+};
+
+struct future_wait
+{
+    std::promise<int> p;
+    std::future<int> f;
+    future_wait() : f(p.get_future()) {}
+    ~future_wait()
+    {
+        // 辅助线程还在等这个 future，给它一个结果让它退出
+        p.set_value(0);
+    }
+    void wait()
+    {
+        interruptible_wait(f);
+    }
+};
+
+struct latency_result
+{
+    double mean_us;
+    double max_us;
+};
+
+// rounds 次中断延迟的平均值和最大值（微秒）
+template<typename Wait>
+latency_result interrupt_latency(unsigned rounds)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> jitter(0, 1000);
+    double total = 0;
+    double worst = 0;
+    for (unsigned r = 0; r < rounds; ++r)
+    {
+        Wait w;
+        std::atomic<bool> started(false);
+        bench_clock::time_point sent;
+        bench_clock::time_point received;
+        interruptible_thread t([&] {
+            started.store(true);
+            try
+            {
+                w.wait();
+            }
+            catch (thread_interrupted&)
+            {
+                received = bench_clock::now();
+                throw;
+            }
+        });
+        while (!started.load())
+            std::this_thread::yield();
+        // 让等待线程真正进入阻塞；随机延迟使中断时刻与轮询周期无关
+        std::this_thread::sleep_for(std::chrono::microseconds(2000 + jitter(rng)));
+        sent = bench_clock::now();
+        t.interrupt();
+        t.join();
+        double const latency = std::chrono::duration<double, std::micro>(received - sent).count();
+        total += latency;
+        worst = std::max(worst, latency);
+    }
+    return latency_result{total / rounds, worst};
+}
+
+template<typename Wait>
+void print_latency(char const* name, unsigned rounds)
+{
+    latency_result const res = interrupt_latency<Wait>(rounds);
+    std::printf("%16s %12.1f %12.1f\n", name, res.mean_us, res.max_us);
+}
+
+void bench_interrupt_latency()
+{
+    unsigned const rounds = 200;
+    std::printf("== interrupt latency over %u rounds, us\n", rounds);
+    std::printf("%16s %12s %12s\n", "wait", "mean", "max");
+    print_latency<polling_cv_wait>("cv (polling)", rounds);
+    print_latency<cv_wait>("cv", rounds);
+    print_latency<cv_any_wait>("cv_any", rounds);
+    print_latency<queue_wait>("queue", rounds);
+    print_latency<future_wait>("future", rounds);
+}
+
+// num_threads 个线程空闲等待 idle 时间内进程消耗的 CPU 时间（毫秒）
+template<typename Wait>
+double idle_cpu_ms(unsigned num_threads, std::chrono::milliseconds idle)
+{
+    std::vector<std::unique_ptr<Wait>> waits;
+    std::vector<std::unique_ptr<interruptible_thread>> threads;
+    for (unsigned i = 0; i < num_threads; ++i)
+    {
+        waits.emplace_back(new Wait);
+        Wait* const w = waits.back().get();
+        threads.emplace_back(new interruptible_thread([w] {w->wait();}));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    double const start = process_cpu_seconds();
+    std::this_thread::sleep_for(idle);
+    double const used = process_cpu_seconds() - start;
+    for (auto& t : threads)
+        t->interrupt();
+    threads.clear();
+    return used * 1000;
+}
+
+void bench_idle_cpu()
+{
+    std::chrono::milliseconds const idle(500);
+    std::printf("== CPU time of idle interruptible waiters over %lld ms, ms\n", static_cast<long long>(idle.count()));
+    std::printf("%8s %16s %16s %16s %16s\n", "threads", "cv (polling)", "cv", "cv_any", "queue");
+    for (unsigned n : {1u, 8u, 64u})
+    {
+        double const polling = idle_cpu_ms<polling_cv_wait>(n, idle);
+        double const cv = idle_cpu_ms<cv_wait>(n, idle);
+        double const cv_any = idle_cpu_ms<cv_any_wait>(n, idle);
+        double const queue = idle_cpu_ms<queue_wait>(n, idle);
+        std::printf("%8u %16.1f %16.1f %16.1f %16.1f\n", n, polling, cv, cv_any, queue);
+    }
+}
+
+int main()
+{
+    bench_interrupt_latency();
+    bench_idle_cpu();
+    return 0;
+}
@@ -0,0 +1,51 @@
+//
+// Created by 13345 on 2024/5/12.
+// 代码清单9.2 只能移动的可调用对象包装，线程池用它保存 packaged_task
+// thread_pool.h 和 thread_pool_stealing.h 共用这一个定义
+//
+
+#ifndef CPP_CONCURRENCY_FUNCTION_WRAPPER_H
+#define CPP_CONCURRENCY_FUNCTION_WRAPPER_H
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+class function_wrapper
+{
+    struct impl_base {
+        virtual void call() = 0;
+        virtual ~impl_base() = default;
+    };
+
+    std::unique_ptr<impl_base> impl;
+    template<typename F>
+    struct impl_type : impl_base
+    {
+        F f;
+        impl_type(F f_) : f(std::move(f_)) {}
+        void call() override {
+            f();
+        }
+    };
+
+public:
+    template<typename F>
+    function_wrapper(F&& f) : impl(new impl_type<std::decay_t<F>>(std::forward<F>(f))) {}
+    function_wrapper() = default;
+    function_wrapper(function_wrapper&& other) noexcept : impl(std::move(other.impl)) {}
+    function_wrapper& operator=(function_wrapper&& other) noexcept
+    {
+        impl = std::move(other.impl);
+        return *this;
+    }
+    function_wrapper(const function_wrapper&)=delete;
+    function_wrapper(function_wrapper&)=delete;
+    function_wrapper& operator=(const function_wrapper&)=delete;
+
+    void operator()() {
+        impl->call();
+    }
+};
+
+#endif //CPP_CONCURRENCY_FUNCTION_WRAPPER_H
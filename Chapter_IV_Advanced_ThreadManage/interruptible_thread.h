@@ -1,5 +1,13 @@
 //
 // Created by 13345 on 2023/9/3.
+// 可中断的线程（代码清单9.9 ~ 9.13）
+// 中断是事件驱动的：等待的线程不再每 1ms 醒来检查一次标志，而是在等待之前向自己的 interrupt_flag 注册一个回调，
+// interrupt() 置位标志后调用这些回调，由回调直接唤醒等待者。空闲的可中断线程不占用 CPU，中断延迟就是一次唤醒的时间。
+// 1) condition_variable_any：按书中清单9.12 的方式，等待时把 set_clear_mutex 和用户的锁一起作为自定义锁交给 wait，
+//    set() 在 set_clear_mutex 下通知 thread_cond_any，不会丢失通知
+// 2) condition_variable、future、threadsafe_queue：通过回调唤醒
+// 回调在 set() 中逐个执行，执行时不持有 set_clear_mutex；注销回调时如果它正在另一个线程中执行，就等它执行完。
+// 因此等待者注销回调之前必须先释放回调里要加的锁。
 //
 
 #ifndef CPP_CONCURRENCY_INTERRUPTIBLE_THREAD_H
@@ -8,32 +16,78 @@
 #include <thread>
 #include <future>
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <exception>
+#include <functional>
+
+#include "threadsafe_queue_complex.h"
+
+class thread_interrupted : public std::exception
+{
+public:
+    const char* what() const noexcept override
+    {
+        return "thread interrupted";
+    }
+};
 
 class interrupt_flag
 {
+public:
+    // 回调的基类，由 interrupt_callback 持有，链接在 interrupt_flag 的双向链表中
+    class callback_base
+    {
+        friend class interrupt_flag;
+        callback_base* prev = nullptr;
+        callback_base* next = nullptr;
+        bool done = false;
+        std::thread::id runner;
+    protected:
+        virtual void invoke() = 0;
+        ~callback_base() = default;
+    };
+
 private:
     std::atomic<bool> flag;
     std::condition_variable* thread_cond;
     std::condition_variable_any* thread_cond_any;
     std::mutex set_clear_mutex;
+    callback_base* callbacks;
+    // 注销正在执行的回调的线程在这里等待回调结束
+    std::condition_variable callback_done;
+
 public:
-    interrupt_flag() : thread_cond(0), thread_cond_any(0) {}
+    interrupt_flag() : flag(false), thread_cond(0), thread_cond_any(0), callbacks(nullptr) {}
 
     void set()
     {
-        flag.store(true, std::memory_order_relaxed);
-        std::lock_guard<std::mutex> lk(set_clear_mutex);
+        flag.store(true, std::memory_order_release);
+        std::unique_lock<std::mutex> lk(set_clear_mutex);
         if (thread_cond)
             thread_cond->notify_all();
         else if (thread_cond_any)
             thread_cond_any->notify_all();
+        // 逐个取出回调，在锁外执行
+        while (callback_base* const cb = callbacks)
+        {
+            callbacks = cb->next;
+            if (callbacks)
+                callbacks->prev = nullptr;
+            cb->prev = cb->next = nullptr;
+            cb->runner = std::this_thread::get_id();
+            lk.unlock();
+            cb->invoke();
+            lk.lock();
+            cb->done = true;
+            callback_done.notify_all();
+        }
     }
 
     bool is_set() const
     {
-        return flag.load(std::memory_order_relaxed);
+        return flag.load(std::memory_order_acquire);
     }
 
     void set_condition_variable(std::condition_variable& cv)
@@ -48,59 +102,265 @@ public:
         thread_cond = 0;
     }
 
+    // 标志已经置位时不注册并返回 false，调用者应直接按被中断处理
+    bool add_callback(callback_base* cb)
+    {
+        std::lock_guard<std::mutex> lk(set_clear_mutex);
+        if (is_set())
+            return false;
+        cb->next = callbacks;
+        if (callbacks)
+            callbacks->prev = cb;
+        callbacks = cb;
+        return true;
+    }
+
+    void remove_callback(callback_base* cb)
+    {
+        std::unique_lock<std::mutex> lk(set_clear_mutex);
+        if (cb->prev || callbacks == cb)
+        {
+            // 还在链表中，没有被执行
+            if (cb->prev)
+                cb->prev->next = cb->next;
+            else
+                callbacks = cb->next;
+            if (cb->next)
+                cb->next->prev = cb->prev;
+            return;
+        }
+        // 已经取出：正在其他线程执行时等它完成；在回调自己里面注销时不能等
+        if (cb->runner != std::this_thread::get_id())
+            callback_done.wait(lk, [cb] {return cb->done;});
+    }
 
+    template<typename Lockable>
+    void wait(std::condition_variable_any& cv, Lockable& lk);
 };
 
-thread_local interrupt_flag this_thread_interrupt_flag;
+inline thread_local interrupt_flag this_thread_interrupt_flag;
 
-struct clear_cv_on_destruct
+// RAII 形式的回调注册，类似 std::stop_callback
+template<typename Callback>
+class interrupt_callback : private interrupt_flag::callback_base
 {
-    ~clear_cv_on_destruct()
+    interrupt_flag& flag;
+    Callback callback;
+    bool registered;
+
+    void invoke() override
+    {
+        callback();
+    }
+
+public:
+    interrupt_callback(interrupt_flag& flag_, Callback callback_) :
+        flag(flag_), callback(std::move(callback_)), registered(false)
+    {
+        registered = flag.add_callback(this);
+    }
+
+    ~interrupt_callback()
+    {
+        reset();
+    }
+
+    interrupt_callback(interrupt_callback const&)=delete;
+    interrupt_callback& operator=(interrupt_callback const&)=delete;
+
+    // 提前注销
+    void reset()
     {
-        this_thread_interrupt_flag.clear_condition_variable();
+        if (registered)
+        {
+            flag.remove_callback(this);
+            registered = false;
+        }
     }
 };
 
-void interruption_point()
+inline void interruption_point()
 {
     if (this_thread_interrupt_flag.is_set())
         throw thread_interrupted();
 }
 
-void interruptible_wait(std::condition_variable& cv,
-                        std::unique_lock<std::mutex>& lk)
+template<typename Lockable>
+void interrupt_flag::wait(std::condition_variable_any& cv, Lockable& lk)
 {
+    // 自定义锁：除了在 wait 内部阻塞的时候，等待者总是同时持有 set_clear_mutex 和 lk，
+    // 所以 set() 的通知要么发生在等待者检查标志之前，要么发生在它进入 wait 之后
+    struct custom_lock
+    {
+        interrupt_flag* self;
+        Lockable& lk;
+        custom_lock(interrupt_flag* self_, std::condition_variable_any& cond, Lockable& lk_) : self(self_), lk(lk_)
+        {
+            self->set_clear_mutex.lock();
+            self->thread_cond_any = &cond;
+        }
+        void unlock()
+        {
+            lk.unlock();
+            self->set_clear_mutex.unlock();
+        }
+        void lock()
+        {
+            std::lock(self->set_clear_mutex, lk);
+        }
+        ~custom_lock()
+        {
+            self->thread_cond_any = 0;
+            self->set_clear_mutex.unlock();
+        }
+    };
+    custom_lock cl(this, cv, lk);
     interruption_point();
-    this_thread_interrupt_flag.set_condition_variable(cv);
-    clear_cv_on_destruct guard;
+    cv.wait(cl);
     interruption_point();
-    cv.wait_for(lk, std::chrono::milliseconds(1));
+}
+
+template<typename Lockable>
+void interruptible_wait(std::condition_variable_any& cv, Lockable& lk)
+{
+    this_thread_interrupt_flag.wait(cv, lk);
+}
+
+template<typename Lockable, typename Predicate>
+void interruptible_wait(std::condition_variable_any& cv, Lockable& lk, Predicate pred)
+{
+    while (!pred())
+        this_thread_interrupt_flag.wait(cv, lk);
+}
+
+// 回调加锁 lk 所属的互斥量后再通知，所以注册时持有 lk 不会丢失通知；
+// 注销前先释放 lk，否则正在执行的回调拿不到锁。返回时已重新加锁，和普通的 wait 一样可能是假唤醒
+inline void interruptible_wait(std::condition_variable& cv, std::unique_lock<std::mutex>& lk)
+{
+    interruption_point();
+    std::mutex* const m = lk.mutex();
+    interrupt_callback<std::function<void()>> cb(this_thread_interrupt_flag, [&cv, m] {
+        std::lock_guard<std::mutex> guard(*m);
+        cv.notify_all();
+    });
+    if (!this_thread_interrupt_flag.is_set())
+        cv.wait(lk);
+    lk.unlock();
+    cb.reset();
+    lk.lock();
+    interruption_point();
+}
+
+template<typename Predicate>
+void interruptible_wait(std::condition_variable& cv, std::unique_lock<std::mutex>& lk, Predicate pred)
+{
+    while (!pred())
+        interruptible_wait(cv, lk);
+}
+
+// std::future 不能被外部唤醒，只能让一个辅助线程替我们阻塞在 future 上，结果就绪后再通知。
+// 结果已经就绪时不创建辅助线程。被中断时辅助线程继续持有 future 直到它就绪，uf 变为无效；
+// 如果 future 永远不会就绪，辅助线程也永远不会退出，一直占用到进程结束（放进线程缓存也一样回收不了）。
+template<typename T>
+void interruptible_wait(std::future<T>& uf)
+{
+    interruption_point();
+    if (uf.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        return;
+    struct wait_state
+    {
+        std::mutex m;
+        std::condition_variable cv;
+        bool ready = false;
+        std::future<T> future;
+    };
+    auto const state = std::make_shared<wait_state>();
+    state->future = std::move(uf);
+    std::thread([state] {
+        state->future.wait();
+        std::lock_guard<std::mutex> lk(state->m);
+        state->ready = true;
+        state->cv.notify_all();
+    }).detach();
+    {
+        interrupt_callback<std::function<void()>> cb(this_thread_interrupt_flag, [&state] {
+            std::lock_guard<std::mutex> lk(state->m);
+            state->cv.notify_all();
+        });
+        std::unique_lock<std::mutex> lk(state->m);
+        state->cv.wait(lk, [&state] {return state->ready || this_thread_interrupt_flag.is_set();});
+        if (state->ready)
+            uf = std::move(state->future);
+        lk.unlock();
+    }
     interruption_point();
 }
 
+// 从队列中取数据，被中断时抛出 thread_interrupted
+template<typename T, typename Lock>
+void interruptible_wait_and_pop(threadsafe_queue<T, Lock>& queue, T& value)
+{
+    interruption_point();
+    interrupt_callback<std::function<void()>> cb(this_thread_interrupt_flag, [&queue] {queue.notify_waiters();});
+    if (!queue.wait_and_pop(value, [] {return this_thread_interrupt_flag.is_set();}))
+        throw thread_interrupted();
+}
+
 class interruptible_thread
 {
+    // 线程退出后它的 thread_local 标志就被销毁了，interrupt() 通过这个共享的句柄判断标志是否还有效
+    struct flag_handle
+    {
+        std::mutex m;
+        interrupt_flag* flag = nullptr;
+    };
+
     std::thread internal_thread;
-    interrupt_flag* flag;
+    std::shared_ptr<flag_handle> handle;
 public:
     template<typename FunctionType>
-    interruptible_thread(FunctionType f)
+    interruptible_thread(FunctionType f) : handle(std::make_shared<flag_handle>())
     {
-        std::promise<interrupt_flag*> p;
-        internal_thread = std::thread([f, &p] {
-            p.set_value(&this_thread_interrupt_flag);
+        std::promise<void> p;
+        std::shared_ptr<flag_handle> h = handle;
+        internal_thread = std::thread([f, &p, h] {
+            {
+                std::lock_guard<std::mutex> lk(h->m);
+                h->flag = &this_thread_interrupt_flag;
+            }
+            p.set_value();
             try {
                 f();
             }
             catch (thread_interrupted&)
             {}
+            std::lock_guard<std::mutex> lk(h->m);
+            h->flag = nullptr;
         });
-        flag = p.get_future().get();
+        p.get_future().wait();
     }
+
+    ~interruptible_thread()
+    {
+        if (internal_thread.joinable())
+            internal_thread.join();
+    }
+
     void interrupt()
     {
-        if (flag)
-            flag->set();
+        std::lock_guard<std::mutex> lk(handle->m);
+        if (handle->flag)
+            handle->flag->set();
+    }
+
+    void join()
+    {
+        internal_thread.join();
+    }
+
+    bool joinable() const
+    {
+        return internal_thread.joinable();
     }
 };
 
@@ -12,74 +12,41 @@
 
 #include "threadsafe_queue_complex.h"
 #include "utils.h"
+#include "function_wrapper.h"
 #include <atomic>
 #include <memory>
 #include <vector>
 #include <thread>
 #include <deque>
 #include <future>
-#include <cstdio>
+#include <condition_variable>
+#include <mutex>
 
-class function_wrapper
-{
-    struct impl_base {
-        virtual void call() = 0;
-        virtual ~impl_base() = default;
-    };
-
-    std::unique_ptr<impl_base> impl;
-    template<typename F>
-    struct impl_type : impl_base
-    {
-        F f;
-        impl_type(F&& f_) : f(std::move(f_)) {}
-        void call() override {
-            f();
-        }
-    };
-
-public:
-    template<typename F>
-    function_wrapper(F&& f) : impl(new impl_type<F>(std::move(f))) {}
-    function_wrapper() = default;
-    function_wrapper(function_wrapper&& other)  noexcept : impl(std::move(other.impl)) {}
-    function_wrapper& operator=(function_wrapper&& other)
- noexcept     {
-        impl = std::move(other.impl);
-        return *this;
-    }
-    function_wrapper(const function_wrapper&)=delete;
-    function_wrapper(function_wrapper&)=delete;
-    function_wrapper& operator=(const function_wrapper&)=delete;
-
-    void operator()() {
-        impl->call();
-    }
-};
-
-class work_stealing_queue
+// Lock 可以换成 spin_locks.h 中的自旋锁：push/pop/steal 的临界区只是 deque 两端的一次操作
+template<typename Lock=std::mutex>
+class basic_work_stealing_queue
 {
 private:
     typedef function_wrapper data_type;
     std::deque<data_type> the_queue;
-    mutable std::mutex the_mutex;
+    mutable Lock the_mutex;
 public:
-    work_stealing_queue() = default;
-    work_stealing_queue(const work_stealing_queue&)=delete;
-    work_stealing_queue& operator=(const work_stealing_queue&)=delete;
+    basic_work_stealing_queue() = default;
+    basic_work_stealing_queue(const basic_work_stealing_queue&)=delete;
+    basic_work_stealing_queue& operator=(const basic_work_stealing_queue&)=delete;
     void push(data_type data)
     {
-        std::lock_guard<std::mutex> lock(the_mutex);
+        std::lock_guard<Lock> lock(the_mutex);
         the_queue.push_front(std::move(data));
     }
     bool empty() const
     {
-        std::lock_guard<std::mutex> lock(the_mutex);
+        std::lock_guard<Lock> lock(the_mutex);
         return the_queue.empty();
     }
     bool try_pop(data_type& res)
     {
-        std::lock_guard<std::mutex> lock(the_mutex);
+        std::lock_guard<Lock> lock(the_mutex);
         if (the_queue.empty())
             return false;
         res = std::move(the_queue.front());
@@ -88,7 +55,7 @@ public:
     }
     bool try_steal(data_type& res)
     {
-        std::lock_guard<std::mutex> lock(the_mutex);
+        std::lock_guard<Lock> lock(the_mutex);
         if (the_queue.empty())
             return false;
         res = std::move(the_queue.back());
@@ -97,46 +64,75 @@ public:
     }
 };
 
+typedef basic_work_stealing_queue<std::mutex> work_stealing_queue;
+
 class thread_pool
 {
     typedef function_wrapper task_type;
+    // 连续这么多次找不到任务后睡眠，等 submit 唤醒
+    static unsigned const idle_spins = 64;
     std::atomic_bool done;
     threadsafe_queue<task_type> pool_work_queue;
     std::vector<std::unique_ptr<work_stealing_queue>> queues;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cond;
+    std::atomic<unsigned> sleepers;
+    // 没有找到任务的线程数（包括睡眠的），只是一个提示，用 relaxed 读写
+    std::atomic<unsigned> idle_workers;
     std::vector<std::thread> threads;
     join_threads joiner;
-    // thread_local作为类成员变量时必须是static的
-    static thread_local work_stealing_queue* local_work_queue;
-    static thread_local unsigned my_index;
+    // thread_local作为类成员变量时必须是static的，在头文件中还要声明为 inline，否则被多个源文件包含时会重复定义
+    static inline thread_local work_stealing_queue* local_work_queue = nullptr;
+    static inline thread_local unsigned my_index = -1;
+    // 上面两个变量属于哪个线程池：有多个线程池时，一个池的线程向另一个池提交任务不能放进自己的队列
+    static inline thread_local thread_pool* current_pool = nullptr;
 
     void worker_thread(unsigned index)
     {
         my_index = index;
         local_work_queue = queues[index].get();
+        current_pool = this;
+        unsigned spins = 0;
+        bool idle = false;
         while (!done)
         {
-            run_pending_task();
+            task_type task;
+            if (pop_task(task))
+            {
+                if (idle)
+                {
+                    idle_workers.fetch_sub(1, std::memory_order_relaxed);
+                    idle = false;
+                }
+                task();
+                spins = 0;
+                continue;
+            }
+            if (!idle)
+            {
+                idle_workers.fetch_add(1, std::memory_order_relaxed);
+                idle = true;
+            }
+            if (++spins < idle_spins)
+                std::this_thread::yield();
+            else
+            {
+                wait_for_work();
+                spins = 0;
+            }
         }
+        if (idle)
+            idle_workers.fetch_sub(1, std::memory_order_relaxed);
     }
 
     bool pop_task_from_local_queue(task_type& task)
     {
-        if (local_work_queue && local_work_queue->try_pop(task)){
-            printf("thread %d pop task from local queue\n", my_index);
-            return true;
-        }
-
-        return false;
+        return is_worker_thread() && local_work_queue->try_pop(task);
     }
 
     bool pop_task_from_pool_queue(task_type& task)
     {
-        if (pool_work_queue.try_pop(task)) {
-            printf("thread %d pop task from pool queue\n", my_index);
-            return true;
-        }
-
-        return false;
+        return pool_work_queue.try_pop(task);
     }
 
     bool pop_task_from_other_thread_queue(task_type& task)
@@ -144,18 +140,54 @@ class thread_pool
         for (unsigned i = 0; i < queues.size(); ++i)
         {
             unsigned const index = (my_index + i + 1) % queues.size();
-            if (queues[index]->try_steal(task)){
-                printf("thread %d pop task from %d thread_queue\n", my_index, index);
+            if (queues[index]->try_steal(task))
                 return true;
-            }
+        }
+        return false;
+    }
 
+    bool has_pending_task()
+    {
+        if (!pool_work_queue.empty())
+            return true;
+        for (auto const& q : queues)
+        {
+            if (!q->empty())
+                return true;
         }
         return false;
     }
 
+    // 先登记为睡眠者再检查队列；submit 先放入任务再检查睡眠者。两边都经过队列的锁，
+    // 所以要么这里看到了新任务，要么 submit 看到了睡眠者并加 sleep_mutex 通知，不会丢失唤醒
+    void wait_for_work()
+    {
+        std::unique_lock<std::mutex> lk(sleep_mutex);
+        sleepers.fetch_add(1);
+        sleep_cond.wait(lk, [this] {return done || has_pending_task();});
+        sleepers.fetch_sub(1);
+    }
+
+    void wake_one()
+    {
+        if (sleepers.load() != 0)
+        {
+            std::lock_guard<std::mutex> lk(sleep_mutex);
+            sleep_cond.notify_one();
+        }
+    }
+
+    bool pop_task(task_type& task)
+    {
+        return pop_task_from_local_queue(task) ||
+               pop_task_from_pool_queue(task) ||
+               pop_task_from_other_thread_queue(task);
+    }
+
 public:
-    thread_pool() : done(false), joiner(threads) {
-        unsigned const thread_count = std::thread::hardware_concurrency();
+    thread_pool() : done(false), sleepers(0), idle_workers(0), joiner(threads) {
+        unsigned const hardware_threads = std::thread::hardware_concurrency();
+        unsigned const thread_count = hardware_threads != 0 ? hardware_threads : 2;
         try
         {
             for (unsigned i = 0; i < thread_count; ++i)
@@ -177,45 +209,54 @@ public:
     ~thread_pool()
     {
         done = true;
+        std::lock_guard<std::mutex> lk(sleep_mutex);
+        sleep_cond.notify_all();
     }
 
     template<typename FunctionType>
     std::future<typename std::result_of<FunctionType()>::type> submit(FunctionType f)
     {
         typedef typename std::result_of<FunctionType()>::type result_type;
-        std::packaged_task<result_type()> task(f);
+        std::packaged_task<result_type()> task(std::move(f));
         std::future<result_type> res(task.get_future());
 
-        // 这里的实现任务始终只会提交到pool_work_queue，如果想要提交到各个线程的队列，需要进行适当的设计，提交到各线程的队列
-        if (local_work_queue)
+        // 池中的线程提交到自己的队列，其他线程提交到全局队列
+        if (is_worker_thread())
             local_work_queue->push(std::move(task));
         else
             pool_work_queue.push(std::move(task));
-//        if (my_index != -1)
-//        {
-//            printf("queue %d push task\n", my_index);
-//            queues[my_index]->push(std::move(task));
-//        }
-//        else
-//            pool_work_queue.push(std::move(task));
+        wake_one();
         return res;
     }
 
+    // 等待任务完成的线程调用它帮忙执行其他任务，而不是阻塞
     void run_pending_task()
     {
         task_type task;
-        if (pop_task_from_local_queue(task) ||
-            pop_task_from_pool_queue(task) ||
-            pop_task_from_other_thread_queue(task))
-        {
+        if (pop_task(task))
             task();
-        }
         else
             std::this_thread::yield();
     }
-};
 
-thread_local work_stealing_queue* thread_pool::local_work_queue = nullptr;
-thread_local unsigned thread_pool::my_index = -1;
+    // 以下两个查询供惰性二分（partitioner.h 中的 auto_partitioner）判断是否值得拆分任务
+    // 是否有线程正在找任务
+    bool has_idle_workers() const
+    {
+        return idle_workers.load(std::memory_order_relaxed) != 0;
+    }
+
+    // 当前线程提交的任务是否都已被取走：池中的线程看自己的队列，其他线程看全局队列
+    bool local_queue_empty()
+    {
+        return is_worker_thread() ? local_work_queue->empty() : pool_work_queue.empty();
+    }
+
+    // 当前线程是否是这个线程池的线程
+    bool is_worker_thread() const
+    {
+        return current_pool == this;
+    }
+};
 
 #endif //CPP_CONCURRENCY_THREAD_POOL_STEALING_H
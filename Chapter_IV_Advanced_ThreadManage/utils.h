@@ -1,5 +1,6 @@
 //
 // Created by 13345 on 2023/9/1.
+// 析构时汇合所有线程；Thread 可以是 std::thread，也可以是 thread_cache.h 中的 cached_thread
 //
 
 #ifndef CPP_CONCURRENCY_UTILS_H
@@ -8,12 +9,13 @@
 #include <vector>
 #include <thread>
 
-class join_threads
+template<typename Thread>
+class basic_join_threads
 {
-    std::vector<std::thread>& threads;
+    std::vector<Thread>& threads;
     public:
-    explicit join_threads(std::vector<std::thread>& threads_) : threads(threads_) {}
-    ~join_threads()
+    explicit basic_join_threads(std::vector<Thread>& threads_) : threads(threads_) {}
+    ~basic_join_threads()
     {
         for (unsigned long i = 0; i < threads.size(); ++i)
         {
@@ -23,4 +25,6 @@ class join_threads
     }
 };
 
+typedef basic_join_threads<std::thread> join_threads;
+
 #endif //CPP_CONCURRENCY_UTILS_H
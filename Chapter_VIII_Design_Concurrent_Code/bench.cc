@@ -0,0 +1,242 @@
+//
+// Created by 13345 on 2024/5/10.
+// 并行算法的性能测试
+// 1) 启动并汇合 n 个线程的延迟：std::thread 与 thread_cache 中的线程
+// 2) 各算法每次调用的平均延迟，与标准库的串行版本比较，输入规模从 1k 到 1M：
+//    叶子任务的数量有上限，并行版本多出的开销不随输入规模增长
+// 3) 嵌套调用时进程中增加的最大线程数：原来按 std::async 递归的 parallel_accumulate_async 与执行器上的版本
+// 4) 不同划分策略下每次调用的平均延迟（partitioner.h）：元素代价均匀、以及开头 1/8 的元素代价是其他元素 100 倍的情况
+//
+
+#include "parallel_accumulate.h"
+#include "for_each.h"
+#include "find.h"
+#include "partial_sum.h"
+#include "../Chapter_II_ThreadControl/jthread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+// 调用 f rounds 次，返回每次的平均微秒数
+template<typename F>
+double per_call_us(unsigned rounds, F f)
+{
+    f();
+    bench_clock::time_point const start = bench_clock::now();
+    for (unsigned i = 0; i < rounds; ++i)
+        f();
+    return std::chrono::duration<double, std::micro>(bench_clock::now() - start).count() / rounds;
+}
+
+// 进程当前的线程数
+unsigned process_threads()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 8, "Threads:") == 0)
+            return static_cast<unsigned>(std::stoul(line.substr(8)));
+    }
+    return 0;
+}
+
+// 修改之前的 parallel_accumulate_async：每次二分都用 std::async 创建一个线程
+template<typename Iterator, typename T>
+T std_async_accumulate(Iterator first, Iterator last, T init)
+{
+    unsigned long const length = std::distance(first, last);
+    unsigned long const max_chunk_size = 25;
+    if (length <= max_chunk_size)
+        return std::accumulate(first, last, init);
+    Iterator mid_point = first;
+    std::advance(mid_point, length / 2);
+    std::future<T> first_half_result = std::async(std_async_accumulate<Iterator, T>, first, mid_point, init);
+    T second_half_result = std_async_accumulate(mid_point, last, T());
+    return first_half_result.get() + second_half_result;
+}
+
+void bench_thread_launch()
+{
+    unsigned const rounds = 2000;
+    std::printf("== launch and join n threads running an empty function, us per call\n");
+    std::printf("%8s %16s %16s\n", "threads", "std::thread", "joining_thread");
+    for (unsigned n : {1u, 4u, 16u})
+    {
+        double const spawn_us = per_call_us(rounds, [n] {
+            std::vector<std::thread> threads;
+            for (unsigned i = 0; i < n; ++i)
+                threads.emplace_back([] {});
+            for (auto& t : threads)
+                t.join();
+        });
+        double const cached_us = per_call_us(rounds, [n] {
+            std::vector<joining_thread> threads;
+            for (unsigned i = 0; i < n; ++i)
+                threads.emplace_back([] {});
+        });
+        std::printf("%8u %16.1f %16.1f\n", n, spawn_us, cached_us);
+    }
+}
+
+template<typename Serial, typename Parallel>
+void compare(char const* name, unsigned size, Serial serial, Parallel parallel,
+             unsigned total_elements=20000000)
+{
+    unsigned const rounds = std::max(10u, total_elements / size);
+    double const serial_us = per_call_us(rounds, serial);
+    double const parallel_us = per_call_us(rounds, parallel);
+    std::printf("%24s %10u %12.1f %12.1f %12.1f\n", name, size, serial_us, parallel_us, parallel_us - serial_us);
+}
+
+void bench_algorithms()
+{
+    std::printf("== per-call latency on the default executor, us\n");
+    std::printf("%24s %10s %12s %12s %12s\n", "algorithm", "size", "serial", "parallel", "overhead");
+    for (unsigned size : {1000u, 10000u, 100000u, 1000000u})
+    {
+        std::vector<long> data(size);
+        std::iota(data.begin(), data.end(), 0);
+        std::vector<long> scan(size);
+        volatile long sink = 0;
+        compare("parallel_accumulate", size,
+                [&] {sink = std::accumulate(data.begin(), data.end(), 0L);},
+                [&] {sink = parallel_accumulate(data.begin(), data.end(), 0L);});
+        compare("parallel_for_each", size,
+                [&] {std::for_each(data.begin(), data.end(), [](long& x) {x ^= 1;});},
+                [&] {parallel_for_each(data.begin(), data.end(), [](long& x) {x ^= 1;});});
+        compare("parallel_find", size,
+                [&] {sink = *std::find(data.begin(), data.end(), static_cast<long>(size - 1));},
+                [&] {sink = *parallel_find(data.begin(), data.end(), static_cast<long>(size - 1));});
+        compare("parallel_partial_sum", size,
+                [&] {std::fill(scan.begin(), scan.end(), 1); std::partial_sum(scan.begin(), scan.end(), scan.begin());},
+                [&] {std::fill(scan.begin(), scan.end(), 1); parallel_partial_sum(scan.begin(), scan.end());});
+    }
+    // 代码清单8.13 每个元素一个线程，只测小规模
+    std::vector<long> scan(1000);
+    compare("partial_sum_barrier", 1000,
+            [&] {std::fill(scan.begin(), scan.end(), 1); std::partial_sum(scan.begin(), scan.end(), scan.begin());},
+            [&] {std::fill(scan.begin(), scan.end(), 1); parallel_partial_sum_barrier(scan.begin(), scan.end());},
+            0);
+}
+
+// 64 个外层元素，每个元素内部再对 inner 个元素求和，返回耗时（毫秒），extra_threads 返回运行期间比开始时多出的最大线程数
+template<typename Accumulate>
+double nested_run(unsigned inner, unsigned& extra_threads, Accumulate accumulate)
+{
+    std::vector<std::vector<long>> outer(64, std::vector<long>(inner, 1));
+    std::vector<long> sums(outer.size());
+    std::vector<unsigned> index(outer.size());
+    std::iota(index.begin(), index.end(), 0);
+    std::atomic<bool> running(true);
+    unsigned const before = process_threads();
+    std::atomic<unsigned> peak(before);
+    std::thread monitor([&] {
+        while (running)
+        {
+            unsigned const n = process_threads();
+            if (n > peak)
+                peak = n;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+    bench_clock::time_point const start = bench_clock::now();
+    parallel_for_each(index.begin(), index.end(), [&](unsigned i) {
+        sums[i] = accumulate(outer[i].begin(), outer[i].end());
+    });
+    double const ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+    running = false;
+    monitor.join();
+    // 不算监视线程自己
+    extra_threads = peak - before - 1;
+    return ms;
+}
+
+void bench_nested()
+{
+    typedef std::vector<long>::iterator iterator;
+    std::printf("== nested: parallel_for_each over 64 items, each running an inner accumulate\n");
+    std::printf("%10s %16s %12s %16s %12s\n", "inner", "std::async ms", "+threads", "executor ms", "+threads");
+    for (unsigned inner : {1000u, 10000u})
+    {
+        unsigned async_threads = 0;
+        unsigned executor_threads = 0;
+        double const async_ms = nested_run(inner, async_threads, [](iterator first, iterator last) {
+            return std_async_accumulate(first, last, 0L);
+        });
+        double const executor_ms = nested_run(inner, executor_threads, [](iterator first, iterator last) {
+            return parallel_accumulate(first, last, 0L);
+        });
+        std::printf("%10u %16.1f %12u %16.1f %12u\n", inner, async_ms, async_threads, executor_ms, executor_threads);
+    }
+}
+
+// 模拟每个元素的计算代价：迭代 cost 次
+inline unsigned long burn(unsigned long x, unsigned cost)
+{
+    for (unsigned i = 0; i < cost; ++i)
+        x = x * 6364136223846793005ul + 1442695040888963407ul;
+    return x;
+}
+
+template<typename Run>
+void compare_partitioners(char const* name, unsigned size, unsigned rounds, Run run)
+{
+    static auto_partitioner calibrated(auto_partitioner::calibrate_grain);
+    double const simple_us = per_call_us(rounds, [&] {run(simple_partitioner());});
+    double const fixed_us = per_call_us(rounds, [&] {run(simple_partitioner(25));});
+    double const auto_us = per_call_us(rounds, [&] {run(auto_partitioner());});
+    double const calibrated_us = per_call_us(rounds, [&] {run(calibrated);});
+    std::printf("%24s %10u %12.1f %12.1f %12.1f %12.1f\n", name, size, simple_us, fixed_us, auto_us, calibrated_us);
+}
+
+void bench_partitioners()
+{
+    std::printf("== per-call latency by partitioner, us\n");
+    std::printf("%24s %10s %12s %12s %12s %12s\n", "algorithm", "size", "simple", "simple(25)", "auto", "calibrated");
+    for (unsigned size : {10000u, 1000000u})
+    {
+        unsigned const rounds = std::max(10u, 20000000u / size);
+        std::vector<long> data(size);
+        std::iota(data.begin(), data.end(), 0);
+        volatile long sink = 0;
+        compare_partitioners("parallel_accumulate", size, rounds, [&](auto&& partitioner) {
+            sink = parallel_accumulate(data.begin(), data.end(), 0L, default_executor(), partitioner);
+        });
+        compare_partitioners("parallel_find", size, rounds, [&](auto&& partitioner) {
+            sink = *parallel_find(data.begin(), data.end(), static_cast<long>(size - 1), default_executor(), partitioner);
+        });
+    }
+    unsigned const size = 100000;
+    std::vector<unsigned long> data(size);
+    std::iota(data.begin(), data.end(), 0);
+    compare_partitioners("for_each uniform", size, 10, [&](auto&& partitioner) {
+        parallel_for_each(data.begin(), data.end(), [](unsigned long& x) {x = burn(x, 20);},
+                          default_executor(), partitioner);
+    });
+    compare_partitioners("for_each skewed", size, 10, [&](auto&& partitioner) {
+        parallel_for_each(data.begin(), data.end(), [&data](unsigned long& x) {
+            x = burn(x, &x - data.data() < size / 8 ? 2000 : 20);
+        }, default_executor(), partitioner);
+    });
+}
+
+int main()
+{
+    bench_thread_launch();
+    bench_algorithms();
+    bench_nested();
+    bench_partitioners();
+    return 0;
+}
@@ -0,0 +1,93 @@
+//
+// Created by 13345 on 2024/5/12.
+// 并行算法的执行器
+// 执行器需要提供三个操作：submit(f) 提交任务并返回 std::future，run_pending_task() 执行一个排队的任务（没有任务时让出 CPU），
+// is_worker_thread() 判断当前线程是不是执行器自己的线程。
+// 默认的执行器是进程内共享的工作窃取线程池（thread_pool_stealing.h），线程数等于硬件线程数。
+// 算法用 fork_join 递归地二分：一半提交给执行器，另一半在当前线程上执行，然后在等待的时候帮忙执行其他任务（与 Chapter_IV_Advanced_ThreadManage/parallel_quick_sort.h 的做法相同）。
+// 所有的任务都在线程池的固定数量的线程上运行，嵌套调用算法也不会超额订阅 CPU；
+// 等待的线程不阻塞，所以任务等待子任务也不会因为线程池的线程都在等待而死锁。
+// 外部线程（如主线程）调用时，整个 fork_join 提交给执行器，外部线程阻塞等待结果：外部线程没有自己的任务队列，
+// 帮忙时只能从共享队列的头部取最早提交的（最大的）任务，这些任务又会继续拆分、等待，递归深度随任务数量增长，可能栈溢出。
+//
+
+#ifndef CPP_CONCURRENCY_EXECUTOR_H
+#define CPP_CONCURRENCY_EXECUTOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <thread>
+
+#include "../Chapter_IV_Advanced_ThreadManage/thread_pool_stealing.h"
+
+inline thread_pool& default_executor()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+// 等待 future 就绪，等待期间帮执行器执行任务
+template<typename Executor, typename T>
+T help_while_waiting(Executor& executor, std::future<T>& f)
+{
+    while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        executor.run_pending_task();
+    return f.get();
+}
+
+// 并行执行 left 和 right，两者都完成后才返回，任一个抛出的异常会被重新抛出。
+// 两个函数都可以引用调用者栈上的数据：即使 right 抛出异常，也会等 left 结束再返回
+template<typename Executor, typename Left, typename Right>
+void fork_join(Executor& executor, Left left, Right right)
+{
+    if (!executor.is_worker_thread())
+    {
+        executor.submit([&] {fork_join(executor, std::move(left), std::move(right));}).get();
+        return;
+    }
+    std::future<void> left_done = executor.submit(std::move(left));
+    try
+    {
+        right();
+    }
+    catch (...)
+    {
+        try
+        {
+            help_while_waiting(executor, left_done);
+        }
+        catch (...)
+        {}
+        throw;
+    }
+    help_while_waiting(executor, left_done);
+}
+
+// 对 [first, last) 中的每一个下标调用 f，按 grain 递归二分
+template<typename Executor, typename Func>
+void fork_join_for(Executor& executor, unsigned long first, unsigned long last, unsigned long grain, Func& f)
+{
+    if (last - first <= grain)
+    {
+        for (; first != last; ++first)
+            f(first);
+        return;
+    }
+    unsigned long const mid_point = first + (last - first) / 2;
+    fork_join(executor,
+              [&] {fork_join_for(executor, first, mid_point, grain, f);},
+              [&] {fork_join_for(executor, mid_point, last, grain, f);});
+}
+
+// 叶子任务的大小：至少 min_grain 个元素，并且整个输入最多分成 8 倍硬件线程数个叶子，
+// 任务数量和调度开销不随输入规模增长，又有足够多的任务让空闲线程窃取
+inline unsigned long default_grain_size(unsigned long length, unsigned long min_grain=25)
+{
+    unsigned long const hardware_threads = std::thread::hardware_concurrency();
+    unsigned long const max_leaves = 8 * (hardware_threads != 0 ? hardware_threads : 2);
+    return std::max(min_grain, (length + max_leaves - 1) / max_leaves);
+}
+
+#endif //CPP_CONCURRENCY_EXECUTOR_H
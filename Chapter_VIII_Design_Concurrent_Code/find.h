@@ -1,135 +1,83 @@
 //
 // Created by 13345 on 2023/8/21.
+// 任务在执行器上拆分（见 executor.h），拆分的方式由划分策略决定（见 partitioner.h）；
+// 后两个参数可以指定执行器和划分策略，默认是共享的线程池和 default_partitioner
+// 任何一个任务找到匹配后设置 done，其他任务尽快停止
 //
 
 #ifndef CPP_CONCURRENCY_FIND_H
 #define CPP_CONCURRENCY_FIND_H
 
-class join_threads;
-{
-    std::vector<std::thread>& threads;
-    public:
-    explicit join_threads(std::vector<std::thread>& threads_) : threads(threads_) {}
-    ~join_threads()
-    {
-        for (unsigned long i = 0; i < threads.size(); ++i)
-        {
-            if(threads[i].joinable())
-                threads[i].join();
-        }
-    }
-}
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 
-template<typename Iterator, typename MatchType>
-Iterator parallel_find(Iterator first, Iterator last, MatchType match)
-{
-    struct find_element
-    {
-        void operator()(Iterator begin, Iterator end,
-                        MatchType match,
-                        std::promise<Iterator>* result,
-                        std::atomic<bool>* done_flag)
-        {
-            try
-            {
-                for(;(begin != end) && !done_flag->load(); ++begin)
-                {
-                    if (*begin == match)
-                    {
-                        result->set_value(begin);
-                        done_flag->store(true);
-                        return;
-                    }
-                }
-            }
-            catch (...)
-            {
-                try
-                {
-                    result->set_exception(std::current_exception());
-                    done_flag->store(true);
-                }
-                catch (...)
-                {}
-            }
-        }
-    };
+#include "executor.h"
+#include "partitioner.h"
 
+// 有多个匹配时返回哪一个是不确定的
+template<typename Iterator, typename MatchType, typename Executor, typename Partitioner>
+Iterator parallel_find(Iterator first, Iterator last, MatchType match, Executor& executor, Partitioner&& partitioner)
+{
     unsigned long const length = std::distance(first, last);
     if (!length)
         return last;
-
-    unsigned long const min_per_threads = 25;
-    unsigned long const max_threads = (length + min_per_threads - 1) / min_per_threads;
-    unsigned long const hardware_threads = std::thread::hard_concurrency();
-    unsigned  long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
-    unsigned long const block_size = length / num_threads;
-
-    std::promise<Iterator> result;
-    std::atomic<bool> done_flag(false);
-    std::vector<std::thread> threads(num_threads - 1);
-    {
-        join_threads joiner(threads);
-        Iterator block_start = first;
-
-        for (unsigned long i = 0; i < (num_threads - 1); ++i)
-        {
-            Iterator block_end = block_start;
-            std::advance(block_end, block_size);
-            threads[i] = std::thread(find_element(), block_start, block_end, match, &result, &done_flag);
-            block_start = block_end;
-        }
-        find_element()(block_start, last, match, &result, &done_flag);
-    }
-
-    if (!done_flag.load())
-    {
-        return last;
-    }
-
-    return result.get_future().get();
-}
-
-
-template<typename Iterator, typename MatchType>
-Iterator parallel_find_impl(Iterator first, Iterator last, MatchType match, std::atomic<bool>& done)
-{
-    try
-    {
-        unsigned long const length = std::distance(first, last);
-        unsigned long const min_per_thread = 25;
-        if (length < (2 * min_per_thread))
+    std::atomic<bool> done(false);
+    // 没找到时块返回 last，合并时取左边第一个找到的结果
+    auto find_block = [&](Iterator block_first, unsigned long n) {
+        try
         {
-            for(;(first != last) && !done.load(); ++first)
+            // 每 check_interval 个元素才检查一次 done，中间用 std::find，不妨碍编译器展开循环
+            unsigned long const check_interval = 256;
+            while (n != 0 && !done.load())
             {
-                if (*first == match)
+                unsigned long const chunk = std::min(n, check_interval);
+                Iterator chunk_end = block_first;
+                std::advance(chunk_end, chunk);
+                Iterator const found = std::find(block_first, chunk_end, match);
+                if (found != chunk_end)
                 {
                     done = true;
-                    return first;
+                    return found;
                 }
+                block_first = chunk_end;
+                n -= chunk;
             }
             return last;
         }
-        else
+        catch (...)
         {
-            Iterator const mid_point = first + (length / 2);
-            std::future<Iterator> async_result = std::async(&parallel_find_impl<Iterator, MatchType>, mid_point, last, match, std::ref(done));
-            Iterator const direct_result = parallel_find_impl(first, mid_point, match, done);
-            return (direct_result == mid_point) ? async_result.get() : direct_result;
+            done = true;
+            throw ;
         }
-    }
-    catch (...)
-    {
-        done = true;
-        throw ;
-    }
+    };
+    return partitioned_reduce(first, length, last, find_block,
+                              [last](Iterator a, Iterator b) {return a != last ? a : b;}, partitioner, executor);
+}
+
+template<typename Iterator, typename MatchType, typename Executor>
+Iterator parallel_find(Iterator first, Iterator last, MatchType match, Executor& executor)
+{
+    return parallel_find(first, last, match, executor, default_partitioner());
+}
+
+template<typename Iterator, typename MatchType>
+Iterator parallel_find(Iterator first, Iterator last, MatchType match)
+{
+    return parallel_find(first, last, match, default_executor());
+}
+
+// 原来用 std::async 递归，输入很大时可能创建大量线程；现在与 parallel_find 相同
+template<typename Iterator, typename MatchType, typename Executor>
+Iterator parallel_find_async(Iterator first, Iterator last, MatchType match, Executor& executor)
+{
+    return parallel_find(first, last, match, executor);
 }
 
 template<typename Iterator, typename MatchType>
 Iterator parallel_find_async(Iterator first, Iterator last, MatchType match)
 {
-    std::atomic<bool> done(false);
-    return parallel_find_impl(first, last, match, done);
+    return parallel_find(first, last, match, default_executor());
 }
 
 
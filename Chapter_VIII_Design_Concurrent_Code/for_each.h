@@ -1,84 +1,61 @@
 //
 // Created by 13345 on 2023/8/21.
+// 任务在执行器上拆分（见 executor.h），拆分的方式由划分策略决定（见 partitioner.h）；
+// 后两个参数可以指定执行器和划分策略，默认是共享的线程池和 default_partitioner
 //
 
 #ifndef CPP_CONCURRENCY_FOR_EACH_H
 #define CPP_CONCURRENCY_FOR_EACH_H
 
-class join_threads;
-{
-std::vector<std::thread>& threads;
-public:
-explicit join_threads(std::vector<std::thread>& threads_) : threads(threads_) {}
-~join_threads()
-{
-    for (unsigned long i = 0; i < threads.size(); ++i)
-    {
-        if(threads[i].joinable())
-            threads[i].join();
-    }
-}
-}
+#include <algorithm>
+#include <iterator>
 
-template<typename Iterator, typename Func>
-void parallel_for_each(Iterator first, Iterator last, Func f)
+#include "executor.h"
+#include "partitioner.h"
+
+// f 被所有任务共享，需要能在多个线程中同时调用
+template<typename Iterator, typename Func, typename Executor, typename Partitioner>
+void parallel_for_each(Iterator first, Iterator last, Func f, Executor& executor, Partitioner&& partitioner)
 {
     unsigned long const length = std::distance(first, last);
 
     if (!length)
         return;
 
-    unsigned long const min_per_thread = 25;
-    unsigned long const max_threads = (length + min_per_thread - 1) / min_per_thread;
-    unsigned long const hardware_threads = std::thread::hardware_concurrency();
-    unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
-    unsigned long const block_size = length / num_threads;
+    // 没有结果需要合并，用 bool 占位
+    partitioned_reduce(first, length, true,
+                       [&f](Iterator block_first, unsigned long n) {
+                           Iterator block_last = block_first;
+                           std::advance(block_last, n);
+                           std::for_each(block_first, block_last, f);
+                           return true;
+                       },
+                       [](bool, bool) {return true;}, partitioner, executor);
+}
 
-    std::vector<std::future<void>> futures(num_threads - 1);
-    std::vector<std::thread> threads(num_threads - 1);
-    join_threads joiner(threads);
+template<typename Iterator, typename Func, typename Executor>
+void parallel_for_each(Iterator first, Iterator last, Func f, Executor& executor)
+{
+    parallel_for_each(first, last, f, executor, default_partitioner());
+}
 
-    Iterator block_start = first;
-    for (unsigned long i = 0; i < (num_threads - 1); ++i)
-    {
-        Iterator block_end = block_start;
-        std::advance(block_end, block_size);
-        std::packaged_task<void(void)> task([=](){
-            std::for_each(block_start, block_end, f);
-        });
-        futures[i] = task.get_future();
-        threads[i] = std::thread(std::move(task));
-        block_start = block_end;
-    }
+template<typename Iterator, typename Func>
+void parallel_for_each(Iterator first, Iterator last, Func f)
+{
+    parallel_for_each(first, last, f, default_executor());
+}
 
-    std::for_each(block_start, last, f);
-    for (unsigned long i = 0; i < (num_threads - 1); ++i)
-    {
-        futures[i].get();
-    }
+// 原来用 std::async 递归，输入很大时可能创建大量线程；现在与 parallel_for_each 相同
+template<typename Iterator, typename Func, typename Executor>
+void parallel_for_each_async(Iterator first, Iterator last, Func f, Executor& executor)
+{
+    parallel_for_each(first, last, f, executor);
 }
 
 template<typename Iterator, typename Func>
 void parallel_for_each_async(Iterator first, Iterator last, Func f)
 {
-    unsigned long const length = std::distance(first, last);
-
-    if (!length)
-        return;
-
-    unsigned long const min_per_thread = 25;
-
-    if (length < (2 * min_per_thread))
-    {
-        std::for_each(first, last, f);
-    }
-    else
-    {
-        Iterator const mid_point = first + length / 2;
-        std::future<void> first_half = std::async(&parallel_for_each_async<Iterator, Func>, first, mid_point, f);
-        parallel_for_each_async(mid_point, last, f);
-        first_half.get();
-    }
+    parallel_for_each(first, last, f, default_executor());
 }
 
 #endif //CPP_CONCURRENCY_FOR_EACH_H
@@ -0,0 +1,16 @@
+//
+// Created by 13345 on 2024/5/10.
+// 代码清单8.4 析构时汇合所有线程，函数因异常提前退出时也不会留下可汇合的线程
+// 线程取自 thread_cache（见 Chapter_II_ThreadControl/thread_cache.h），算法每次调用不再创建新线程
+// basic_join_threads 与线程池共用 Chapter_IV_Advanced_ThreadManage/utils.h 中的定义
+//
+
+#ifndef CPP_CONCURRENCY_JOIN_THREADS_H
+#define CPP_CONCURRENCY_JOIN_THREADS_H
+
+#include "../Chapter_II_ThreadControl/thread_cache.h"
+#include "../Chapter_IV_Advanced_ThreadManage/utils.h"
+
+typedef basic_join_threads<cached_thread> join_cached_threads;
+
+#endif //CPP_CONCURRENCY_JOIN_THREADS_H
@@ -1,80 +1,64 @@
 //
 // Created by 13345 on 2023/8/16.
+// 任务在执行器上拆分（见 executor.h），拆分的方式由划分策略决定（见 partitioner.h）；
+// 后两个参数可以指定执行器和划分策略，默认是共享的线程池和 default_partitioner
 //
 
 #ifndef CPP_CONCURRENCY_PARALLEL_ACCUMULATE_H
 #define CPP_CONCURRENCY_PARALLEL_ACCUMULATE_H
 
+#include <iterator>
+#include <numeric>
+
+#include "executor.h"
+#include "partitioner.h"
+
 template<typename Iterator, typename T>
 struct accumulate_block
 {
-    T operator()(Iterator first, Iterator last)
+    T operator()(Iterator first, unsigned long length)
     {
+        Iterator last = first;
+        std::advance(last, length);
         return std::accumulate(first, last, T());
     }
 };
 
-class join_threads;
-{
-    std::vector<std::thread>& threads;
-public:
-    explicit join_threads(std::vector<std::thread>& threads_) : threads(threads_) {}
-    ~join_threads()
-    {
-        for (unsigned long i = 0; i < threads.size(); ++i)
-        {
-            if(threads[i].joinable())
-                threads[i].join();
-        }
-    }
-}
-
-template<typename Iterator, typename T>
-T parallel_accumulate(Iterator first, Iterator last, T init)
+template<typename Iterator, typename T, typename Executor, typename Partitioner>
+T parallel_accumulate(Iterator first, Iterator last, T init, Executor& executor, Partitioner&& partitioner)
 {
     unsigned long const length = std::distance(first, last);
     if(!length)
         return init;
-    unsigned long const min_per_thread = 25;
-    unsigned long const max_threads = (length + min_per_thread - 1) / min_per_thread;
-    unsigned long const hardware_threads = std::thread::hardware_concurrency();
-    unsigned long const num_threads = std::min(hardware_threads != 0 ?  hardware_threads : 2, max_threads);
-    unsigned long const block_size = length / num_threads;
-    std::vector<std::future<T>> futures(num_threads - 1);
-    std::vector<std::thread> threads(num_threads - 1);
-    join_threads joiner(threads);
-    Iterator block_start = first;
-    for (unsigned long i = 0; i < num_threads - 1; ++i)
-    {
-        Iterator block_end = block_start;
-        std::advance(block_end, block_size);
-        std::packaged_task<T(Iterator, Iterator)> task(&accumulate_block<Iterator, T>());
-        futures[i] = task.get_future();
-        threads[i] = std::thread(std::move(task), block_start, block_end);
-        block_start = block_end;
-    }
-    T last_result = accumulate_block<Iterator, T>(block_start, last);
     T result = init;
-    for (unsigned long i = 0; i < num_threads - 1; ++i)
-    {
-        result += futures[i].get();
-    }
-    result += last_result;
+    result += partitioned_reduce(first, length, T(), accumulate_block<Iterator, T>(),
+                                 [](T const& a, T const& b) {return a + b;}, partitioner, executor);
     return result;
 }
 
+template<typename Iterator, typename T, typename Executor>
+T parallel_accumulate(Iterator first, Iterator last, T init, Executor& executor)
+{
+    return parallel_accumulate(first, last, init, executor, default_partitioner());
+}
+
+template<typename Iterator, typename T>
+T parallel_accumulate(Iterator first, Iterator last, T init)
+{
+    return parallel_accumulate(first, last, init, default_executor());
+}
+
+// 原来用 std::async 递归，输入很大时可能创建大量线程；现在与 parallel_accumulate 相同
+template<typename Iterator, typename T, typename Executor>
+T parallel_accumulate_async(Iterator first, Iterator last, T init, Executor& executor)
+{
+    return parallel_accumulate(first, last, init, executor);
+}
+
 template<typename Iterator, typename T>
 T parallel_accumulate_async(Iterator first, Iterator last, T init)
 {
-    unsigned long const length = std::distance(first, last);
-    unsigned long const max_chunk_size = 25;
-    if (length <= max_chunk_size)
-        return std::accumulate(first, last, init);
-    Iterator mid_point = first;
-    std::advance(mid_point, length / 2);
-    std::future<T> first_half_result = std::async(parallel_accumulate_async<Iterator, T>, first, mid_point);
-    T second_half_result = parallel_accumulate_async(mid_point, last, T());
-    return first_half_result.get() + second_half_result;
+    return parallel_accumulate(first, last, init, default_executor());
 }
 
 
@@ -1,31 +1,31 @@
 //
 // Created by 13345 on 2023/8/21.
+// parallel_partial_sum 在执行器上分块计算（见 executor.h）：
+// 1) 各块并行地求块内前缀和
+// 2) 串行地把每块的最后一个元素加上前一块的最后一个元素，块数不超过 8 倍硬件线程数
+// 3) 各块并行地把其余元素加上前一块的最后一个元素
+// parallel_partial_sum_barrier 是代码清单8.13：每个元素一个线程，线程之间用栅栏同步，只适合元素很少而核很多的情况
 //
 
 #ifndef CPP_CONCURRENCY_PARTIAL_SUM_H
 #define CPP_CONCURRENCY_PARTIAL_SUM_H
 
-class join_threads;
-{
-std::vector<std::thread>& threads;
-public:
-explicit join_threads(std::vector<std::thread>& threads_) : threads(threads_) {}
-~join_threads()
-{
-    for (unsigned long i = 0; i < threads.size(); ++i)
-    {
-        if(threads[i].joinable())
-            threads[i].join();
-    }
-}
-}
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+#include "join_threads.h"
 
 struct barrier
 {
     std::atomic<unsigned> count;
     std::atomic<unsigned> spaces;
     std::atomic<unsigned> generation;
-    barrier(unsigned count_) : count(count_), spaces(count), generation(0) {}
+    barrier(unsigned count_) : count(count_), spaces(count_), generation(0) {}
 
     void wait()
     {
@@ -53,13 +53,13 @@ struct barrier
 };
 
 template<typename Iterator>
-void parallel_partial_sum(Iterator first, Iterator last)
+void parallel_partial_sum_barrier(Iterator first, Iterator last)
 {
     typedef typename Iterator::value_type value_type;
 
     struct process_element
     {
-        void operator()(Iterator first, Iterator last,
+        void operator()(Iterator first,
                         std::vector<value_type>& buffer,
                         unsigned i, barrier& b)
         {
@@ -71,15 +71,18 @@ void parallel_partial_sum(Iterator first, Iterator last)
                 bool read_flag = step &  1;
                 value_type const& source = read_flag ? buffer[i] : ith_element;
                 value_type& dest = read_flag ? ith_element : buffer[i];
-                value_type const& addend = read_flag == 0 ? buffer[i - stride] : *(first + i - stride);
+                value_type const& addend = read_flag ? buffer[i - stride] : *(first + i - stride);
 
                 dest = source + addend;
                 update_source = !read_flag;
                 b.wait();
             }
 
+            // 之后的步骤里其他线程还会按步骤的奇偶从 buffer 或原序列读这个元素，两处都要是最终值
             if (update_source)
                 ith_element = buffer[i];
+            else
+                buffer[i] = ith_element;
             b.done_waiting();
         }
     };
@@ -91,15 +94,67 @@ void parallel_partial_sum(Iterator first, Iterator last)
     std::vector<value_type> buffer(length);
     barrier b(length);
 
-    std::vector<std::thread> threads(length - 1);
-    join_threads joiner(threads);
+    std::vector<cached_thread> threads(length - 1);
+    join_cached_threads joiner(threads);
 
-    Iterator block_start = first;
     for (unsigned long i = 0; i < (length - 1); ++i)
     {
-        threads[i] = std::thread(process_element(), first, last, std::ref(buffer), i, std::ref(b));
+        threads[i] = cached_thread(process_element(), first, std::ref(buffer), i, std::ref(b));
+    }
+    process_element()(first, buffer, length - 1, b);
+}
+
+template<typename Iterator, typename Executor>
+void parallel_partial_sum(Iterator first, Iterator last, Executor& executor)
+{
+    typedef typename std::iterator_traits<Iterator>::value_type value_type;
+
+    unsigned long const length = std::distance(first, last);
+    if (length <= 1)
+        return;
+
+    unsigned long const block_size = default_grain_size(length);
+    unsigned long const num_blocks = (length + block_size - 1) / block_size;
+    if (num_blocks == 1)
+    {
+        std::partial_sum(first, last, first);
+        return;
+    }
+
+    // block_starts[num_blocks] == last
+    std::vector<Iterator> block_starts(num_blocks + 1);
+    block_starts[0] = first;
+    for (unsigned long i = 1; i < num_blocks; ++i)
+    {
+        block_starts[i] = block_starts[i - 1];
+        std::advance(block_starts[i], block_size);
     }
-    process_element()(first, last, buffer, length - 1, b);
+    block_starts[num_blocks] = last;
+
+    auto scan_block = [&](unsigned long i) {
+        std::partial_sum(block_starts[i], block_starts[i + 1], block_starts[i]);
+    };
+    fork_join_for(executor, 0, num_blocks, 1, scan_block);
+
+    for (unsigned long i = 1; i < num_blocks; ++i)
+    {
+        value_type& block_last = *std::prev(block_starts[i + 1]);
+        block_last = *std::prev(block_starts[i]) + block_last;
+    }
+
+    auto add_offset = [&](unsigned long i) {
+        value_type const offset = *std::prev(block_starts[i]);
+        Iterator const block_last = std::prev(block_starts[i + 1]);
+        for (Iterator it = block_starts[i]; it != block_last; ++it)
+            *it = offset + *it;
+    };
+    fork_join_for(executor, 1, num_blocks, 1, add_offset);
+}
+
+template<typename Iterator>
+void parallel_partial_sum(Iterator first, Iterator last)
+{
+    parallel_partial_sum(first, last, default_executor());
 }
 
 
@@ -0,0 +1,163 @@
+//
+// Created by 13345 on 2024/5/14.
+// 划分策略：决定并行算法把输入拆成多大的任务
+// 1) simple_partitioner：一开始就递归二分到 grain 个元素为止（grain 为 0 时由 default_grain_size 决定）。
+//    任务数量是固定的，元素代价不均匀时，分到代价高的那几块的线程最后完成，其他线程空等。
+// 2) auto_partitioner：惰性二分（lazy binary splitting）。每处理完一小块就检查一次：
+//    只有当执行器中有空闲的线程、并且当前线程之前拆出去的任务都已被取走时，才把剩下的部分对半拆开提交一半。
+//    所有线程都忙时根本不拆分，不产生任务开销；有线程空闲时立刻拆出任务给它，元素代价不均匀也不会让线程空等。
+//    执行器需要提供 has_idle_workers() 和 local_queue_empty()，见 thread_pool_stealing.h。
+//    两次检查之间处理的元素个数默认是输入的 1/(64 * 硬件线程数)；构造时传入 calibrate_grain 则改为按时间校准：
+//    第一次调用时用开头的元素测出每个元素的平均耗时，让每一小块大约耗时 target_chunk_ns，结果保存在 partitioner 中。
+//    把 partitioner 声明为调用处的 static 变量，校准结果就按调用位置缓存：
+//        static auto_partitioner partitioner(auto_partitioner::calibrate_grain);
+//        parallel_for_each(v.begin(), v.end(), f, default_executor(), partitioner);
+//
+// partitioned_reduce 是各算法共用的驱动：对 [first, first + length) 的每一块调用 body(block_first, n)，
+// 用 join 按从左到右的顺序合并结果。
+//
+
+#ifndef CPP_CONCURRENCY_PARTITIONER_H
+#define CPP_CONCURRENCY_PARTITIONER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <thread>
+
+#include "executor.h"
+
+class simple_partitioner
+{
+    unsigned long const grain;
+public:
+    explicit simple_partitioner(unsigned long grain_=0) : grain(grain_) {}
+
+    unsigned long grain_size(unsigned long length) const
+    {
+        return grain != 0 ? grain : default_grain_size(length);
+    }
+
+    void calibrated(unsigned long, unsigned long long) {}
+
+    template<typename Executor>
+    bool should_split(Executor&) const
+    {
+        return true;
+    }
+};
+
+class auto_partitioner
+{
+public:
+    enum calibration
+    {
+        no_calibration,
+        calibrate_grain
+    };
+
+    // 校准后每一小块的目标耗时，远大于提交一个任务的开销（几微秒）
+    static unsigned long long const target_chunk_ns = 50000;
+    // 校准时至少测这么长时间，避免时钟精度的影响
+    static unsigned long long const min_sample_ns = 20000;
+
+private:
+    calibration const mode;
+    // 校准得到的块大小，0 表示还没有校准
+    std::atomic<unsigned long> calibrated_grain;
+
+public:
+    explicit auto_partitioner(calibration mode_=no_calibration) : mode(mode_), calibrated_grain(0) {}
+
+    // 返回 0 表示需要先校准
+    unsigned long grain_size(unsigned long length) const
+    {
+        if (mode == calibrate_grain)
+            return calibrated_grain.load(std::memory_order_relaxed);
+        unsigned long const hardware_threads = std::thread::hardware_concurrency();
+        return std::max(1ul, length / (64 * (hardware_threads != 0 ? hardware_threads : 2)));
+    }
+
+    void calibrated(unsigned long elements, unsigned long long ns)
+    {
+        unsigned long long const ns_per_element = std::max(1ull, ns / std::max(1ul, elements));
+        unsigned long const grain = static_cast<unsigned long>(std::max(1ull, target_chunk_ns / ns_per_element));
+        calibrated_grain.store(grain, std::memory_order_relaxed);
+    }
+
+    template<typename Executor>
+    bool should_split(Executor& executor) const
+    {
+        return executor.has_idle_workers() && executor.local_queue_empty();
+    }
+};
+
+// 算法不指定划分策略时使用
+typedef auto_partitioner default_partitioner;
+
+template<typename Iterator, typename T, typename Body, typename Join, typename Partitioner, typename Executor>
+T partitioned_reduce_impl(Iterator first, unsigned long length, unsigned long grain, T const& identity,
+                          Body& body, Join& join, Partitioner& partitioner, Executor& executor)
+{
+    T result = identity;
+    while (length != 0)
+    {
+        if (length > grain && partitioner.should_split(executor))
+        {
+            unsigned long const half = length / 2;
+            Iterator mid_point = first;
+            std::advance(mid_point, half);
+            T first_half_result = identity;
+            T second_half_result = identity;
+            fork_join(executor,
+                      [&] {second_half_result = partitioned_reduce_impl(mid_point, length - half, grain, identity,
+                                                                        body, join, partitioner, executor);},
+                      [&] {first_half_result = partitioned_reduce_impl(first, half, grain, identity,
+                                                                       body, join, partitioner, executor);});
+            return join(result, join(first_half_result, second_half_result));
+        }
+        unsigned long const n = std::min(length, grain);
+        result = join(result, body(first, n));
+        std::advance(first, n);
+        length -= n;
+    }
+    return result;
+}
+
+template<typename Iterator, typename T, typename Body, typename Join, typename Partitioner, typename Executor>
+T partitioned_reduce(Iterator first, unsigned long length, T identity, Body body, Join join,
+                     Partitioner& partitioner, Executor& executor)
+{
+    T result = identity;
+    unsigned long grain = partitioner.grain_size(length);
+    if (grain == 0)
+    {
+        // 校准：在当前线程上串行处理开头的元素，每次加倍，直到累计耗时超过 min_sample_ns
+        typedef std::chrono::steady_clock clock;
+        unsigned long sample = 1;
+        unsigned long elements = 0;
+        unsigned long long ns = 0;
+        while (length != 0 && ns < auto_partitioner::min_sample_ns)
+        {
+            unsigned long const n = std::min(length, sample);
+            clock::time_point const start = clock::now();
+            result = join(result, body(first, n));
+            ns += static_cast<unsigned long long>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+            elements += n;
+            std::advance(first, n);
+            length -= n;
+            sample *= 2;
+        }
+        // 输入太短、测量时间不够时不保存结果，下次调用重新校准
+        if (ns >= auto_partitioner::min_sample_ns)
+            partitioner.calibrated(elements, ns);
+        grain = std::max(1ul, partitioner.grain_size(length));
+    }
+    if (length == 0)
+        return result;
+    return join(result, partitioned_reduce_impl(first, length, grain, identity, body, join, partitioner, executor));
+}
+
+#endif //CPP_CONCURRENCY_PARTITIONER_H
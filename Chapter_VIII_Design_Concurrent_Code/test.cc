@@ -2,8 +2,17 @@
 // Created by 13345 on 2023/8/21.
 //
 
+#include "parallel_accumulate.h"
+#include "for_each.h"
+#include "find.h"
+#include "partial_sum.h"
+
+#include <algorithm>
 #include <cstdio>
+#include <numeric>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 struct callable
 {
@@ -18,11 +27,156 @@ void func(int a, int b)
     printf("thread: a + b = %d\n", a + b);
 }
 
+// 空序列、一两个元素、默认叶子大小（至少 25 个元素）附近、不是 2 的幂的规模
+unsigned long const test_sizes[] = {0, 1, 2, 24, 25, 26, 1000, 10007, 100003};
+
+// 与标准库的串行算法比较，options 是算法末尾的可选参数（执行器等）；返回第一个结果不一致的规模，都一致时返回 -1
+template<typename ... Options>
+long first_mismatch(Options&& ... options)
+{
+    for (unsigned long size : test_sizes)
+    {
+        std::vector<long> data(size);
+        std::iota(data.begin(), data.end(), 1);
+        if (parallel_accumulate(data.begin(), data.end(), 5L, options...) != std::accumulate(data.begin(), data.end(), 5L))
+            return size;
+
+        std::vector<long> doubled(data);
+        parallel_for_each(doubled.begin(), doubled.end(), [](long& x) {x *= 2;}, options...);
+        for (unsigned long i = 0; i < size; ++i)
+        {
+            if (doubled[i] != 2 * data[i])
+                return size;
+        }
+
+        // 元素各不相同，找到的位置必须与 std::find 相同；-1 找不到
+        for (long target : {1L, static_cast<long>(size / 2), static_cast<long>(size), -1L})
+        {
+            if (parallel_find(data.begin(), data.end(), target, options...) != std::find(data.begin(), data.end(), target))
+                return size;
+        }
+    }
+    return -1;
+}
+
+template<typename ... Options>
+long first_partial_sum_mismatch(Options&& ... options)
+{
+    for (unsigned long size : test_sizes)
+    {
+        std::vector<long> expected(size);
+        std::iota(expected.begin(), expected.end(), 1);
+        std::vector<long> scan(expected);
+        std::partial_sum(expected.begin(), expected.end(), expected.begin());
+        parallel_partial_sum(scan.begin(), scan.end(), options...);
+        if (scan != expected)
+            return size;
+    }
+    return -1;
+}
+
+void report(char const* name, long mismatch)
+{
+    if (mismatch < 0)
+        printf("%s: ok\n", name);
+    else
+        printf("%s: MISMATCH at size %ld\n", name, mismatch);
+}
+
+void test_parallel_algorithms()
+{
+    thread_pool pool;
+    report("algorithms on the default executor", first_mismatch());
+    report("algorithms on another thread_pool", first_mismatch(pool));
+    report("parallel_partial_sum", first_partial_sum_mismatch());
+    report("parallel_partial_sum on another thread_pool", first_partial_sum_mismatch(pool));
+
+    // 代码清单8.13 每个元素一个线程，只测小规模；奇数和偶数步数都要覆盖
+    long barrier_mismatch = -1;
+    for (unsigned long size : {0ul, 1ul, 2ul, 3ul, 5ul, 8ul, 13ul, 100ul})
+    {
+        std::vector<long> expected(size);
+        std::iota(expected.begin(), expected.end(), 1);
+        std::vector<long> scan(expected);
+        std::partial_sum(expected.begin(), expected.end(), expected.begin());
+        parallel_partial_sum_barrier(scan.begin(), scan.end());
+        if (scan != expected && barrier_mismatch < 0)
+            barrier_mismatch = size;
+    }
+    report("parallel_partial_sum_barrier", barrier_mismatch);
+}
+
+// 每种划分策略都要得到与串行算法相同的结果；simple_partitioner(25) 覆盖叶子大小附近的规模，
+// 校准的 auto_partitioner 调用两次：第一次校准，第二次使用缓存的块大小
+void test_partitioners()
+{
+    report("simple_partitioner()", first_mismatch(default_executor(), simple_partitioner()));
+    report("simple_partitioner(25)", first_mismatch(default_executor(), simple_partitioner(25)));
+    report("auto_partitioner()", first_mismatch(default_executor(), auto_partitioner()));
+    static auto_partitioner calibrated(auto_partitioner::calibrate_grain);
+    report("calibrated auto_partitioner", first_mismatch(default_executor(), calibrated));
+    // 每个元素都有一定代价，测量时间一定够长，校准结果会被保存
+    std::vector<unsigned long> costly(10007, 1);
+    parallel_for_each(costly.begin(), costly.end(), [](unsigned long& x) {
+        for (unsigned i = 0; i < 1000; ++i)
+            x = x * 6364136223846793005ul + 1442695040888963407ul;
+    }, default_executor(), calibrated);
+    printf("calibrated grain cached: %s\n", calibrated.grain_size(100003) != 0 ? "yes" : "NO");
+    report("calibrated auto_partitioner, cached grain", first_mismatch(default_executor(), calibrated));
+}
+
+// 任务中再调用并行算法：64 个外层元素，每个对 1000 个元素求和
+void test_nested_algorithms()
+{
+    std::vector<std::vector<long>> outer(64);
+    for (unsigned i = 0; i < outer.size(); ++i)
+        outer[i].assign(1000, i);
+    std::vector<long> sums(outer.size());
+    std::vector<unsigned> index(outer.size());
+    std::iota(index.begin(), index.end(), 0);
+    parallel_for_each(index.begin(), index.end(), [&](unsigned i) {
+        sums[i] = parallel_accumulate(outer[i].begin(), outer[i].end(), 0L);
+    });
+    long mismatch = -1;
+    for (unsigned i = 0; i < sums.size(); ++i)
+    {
+        if (sums[i] != 1000L * i && mismatch < 0)
+            mismatch = i;
+    }
+    report("nested parallel_accumulate", mismatch);
+}
+
+// 函数抛出的异常传给调用者，执行器之后仍然可用
+void test_throwing_functor()
+{
+    std::vector<int> data(10007, 0);
+    data[7777] = 1;
+    bool caught = false;
+    try
+    {
+        parallel_for_each(data.begin(), data.end(), [](int x) {
+            if (x)
+                throw std::runtime_error("bad element");
+        });
+    }
+    catch (std::runtime_error const&)
+    {
+        caught = true;
+    }
+    int const sum = parallel_accumulate(data.begin(), data.end(), 0);
+    printf("throwing functor: exception %s, sum after %d\n", caught ? "caught" : "LOST", sum);
+}
+
 int main()
 {
     int a = 1, b = 1;
     callable()(a, b);
     std::thread t(func, a, b);
     t.join();
+
+    test_parallel_algorithms();
+    test_partitioners();
+    test_nested_algorithms();
+    test_throwing_functor();
     return 0;
 }
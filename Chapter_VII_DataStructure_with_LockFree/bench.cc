@@ -0,0 +1,587 @@
+//
+// Created by 13345 on 2024/4/6.
+// 无锁数据结构的性能测试
+//
+
+#include "lock_free_stack.h"
+#include "lock_free_stack_ebr.h"
+#include "lock_free_hash_map.h"
+#include "lock_free_list.h"
+#include "lazy_skiplist_map.h"
+#include "epoch_reclamation.h"
+#include "../Chapter_VI_DataStructure_with_Mutex/threadsafe_lookup_table.h"
+#include "../Chapter_VI_DataStructure_with_Mutex/threadsafe_list.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+// 统计堆内存：在每次分配前面放一个记录大小的头部
+static std::atomic<long> live_bytes(0);
+static std::atomic<long> peak_bytes(0);
+static std::atomic<long> allocation_count(0);
+
+void* operator new(std::size_t size)
+{
+    void* const p = std::malloc(size + 16);
+    if (!p)
+        throw std::bad_alloc();
+    *static_cast<std::size_t*>(p) = size;
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    long const now = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    long peak = peak_bytes.load(std::memory_order_relaxed);
+    while (now > peak && !peak_bytes.compare_exchange_weak(peak, now, std::memory_order_relaxed));
+    return static_cast<char*>(p) + 16;
+}
+
+// 不内联：否则 GCC 在 new 紧跟 delete 的地方会把头部偏移误报为越界访问
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    if (!p)
+        return;
+    void* const base = static_cast<char*>(p) - 16;
+    live_bytes.fetch_sub(*static_cast<std::size_t*>(base), std::memory_order_relaxed);
+    std::free(base);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+void reset_peak()
+{
+    peak_bytes.store(live_bytes.load());
+}
+
+std::vector<unsigned> thread_counts()
+{
+    unsigned const hardware_threads = std::thread::hardware_concurrency();
+    unsigned const max_threads = 2 * (hardware_threads != 0 ? hardware_threads : 2);
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n <= max_threads; n *= 2)
+        counts.push_back(n);
+    return counts;
+}
+
+// 每个线程交替 push/pop，返回每秒操作数
+template<typename Stack>
+double push_pop_throughput(Stack& st, unsigned num_threads, unsigned ops_per_thread)
+{
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&st, &go, ops_per_thread, t] {
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+            {
+                if (i % 2 == 0)
+                    st.push(static_cast<int>(t * ops_per_thread + i));
+                else
+                    st.pop();
+            }
+        });
+    }
+    auto const start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return num_threads * static_cast<double>(ops_per_thread) / seconds;
+}
+
+void bench_reclamation_throughput()
+{
+    unsigned const ops = 200000;
+    printf("== push/pop 50/50, ops/s\n");
+    printf("%8s %16s %16s\n", "threads", "split_count", "ebr");
+    for (unsigned n : thread_counts())
+    {
+        lock_free_stack<int, false> split_stack;
+        lock_free_stack_ebr<int> ebr_stack;
+        double const split_ops = push_pop_throughput(split_stack, n, ops);
+        double const ebr_ops = push_pop_throughput(ebr_stack, n, ops);
+        printf("%8u %16.0f %16.0f\n", n, split_ops, ebr_ops);
+    }
+}
+
+void bench_elimination()
+{
+    unsigned const ops = 200000;
+    printf("== elimination backoff, push/pop 50/50, ops/s\n");
+    printf("%8s %16s %16s\n", "threads", "cas_only", "elimination");
+    for (unsigned n : thread_counts())
+    {
+        lock_free_stack<int, false> plain_stack;
+        lock_free_stack<int, true> elimination_stack;
+        double const plain_ops = push_pop_throughput(plain_stack, n, ops);
+        double const elimination_ops = push_pop_throughput(elimination_stack, n, ops);
+        printf("%8u %16.0f %16.0f\n", n, plain_ops, elimination_ops);
+    }
+}
+
+// 单线程 push/pop 一百万次，统计每次操作的堆分配次数和耗时
+template<typename Op>
+void measure_ops(char const* name, unsigned ops, Op op)
+{
+    long const allocations_before = allocation_count.load();
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < ops; ++i)
+        op(i);
+    double const ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    long const allocations = allocation_count.load() - allocations_before;
+    printf("%-32s %10.2f ns/op %10.3f allocs/op\n", name, ns / ops, static_cast<double>(allocations) / ops);
+}
+
+void bench_value_storage()
+{
+    unsigned const ops = 1000000;
+    printf("== value storage, single thread push+pop pairs\n");
+    {
+        lock_free_stack<int> st;
+        measure_ops("push(T const&) + pop()", ops, [&st](unsigned i) {
+            st.push(static_cast<int>(i));
+            st.pop();
+        });
+    }
+    {
+        lock_free_stack<int> st;
+        measure_ops("push(T&&) + try_pop(T&)", ops, [&st](unsigned i) {
+            int value = static_cast<int>(i);
+            st.push(std::move(value));
+            st.try_pop(value);
+        });
+    }
+    {
+        lock_free_stack<std::unique_ptr<int>> st;
+        std::unique_ptr<int> out;
+        measure_ops("emplace(unique_ptr) + try_pop", ops, [&st, &out](unsigned i) {
+            st.emplace(new int(static_cast<int>(i)));
+            st.try_pop(out);
+        });
+    }
+    {
+        lock_free_stack_ebr<int> st;
+        measure_ops("ebr push(T const&) + pop()", ops, [&st](unsigned i) {
+            st.push(static_cast<int>(i));
+            st.pop();
+        });
+    }
+}
+
+// 生产者成批压入，消费者一次取走所有元素（收集后统一处理），与逐个 push/pop 对比
+double batch_throughput(unsigned batch_size, unsigned rounds, bool use_batch)
+{
+    lock_free_stack<int> st;
+    std::vector<int> items(batch_size);
+    for (unsigned i = 0; i < batch_size; ++i)
+        items[i] = static_cast<int>(i);
+    std::atomic<bool> producing(true);
+    std::atomic<long> consumed(0);
+    auto const start = std::chrono::steady_clock::now();
+    std::thread consumer([&] {
+        int value = 0;
+        for (;;)
+        {
+            bool const last_round = !producing.load();
+            long n = 0;
+            if (use_batch)
+            {
+                lock_free_stack<int>::batch b = st.pop_all();
+                for (int& v : b)
+                {
+                    value += v;
+                    ++n;
+                }
+            }
+            else
+            {
+                while (st.try_pop(value))
+                    ++n;
+            }
+            consumed += n;
+            if (last_round)
+                break;
+            if (!n)
+                std::this_thread::yield();
+        }
+    });
+    for (unsigned r = 0; r < rounds; ++r)
+    {
+        if (use_batch)
+            st.push_range(items.begin(), items.end());
+        else
+        {
+            for (unsigned i = 0; i < batch_size; ++i)
+                st.push(items[i]);
+        }
+    }
+    producing = false;
+    consumer.join();
+    double const ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / consumed.load();
+}
+
+void bench_batch()
+{
+    printf("== push_range/pop_all vs per-element push/try_pop, ns per element\n");
+    printf("%10s %16s %16s\n", "batch", "per_element", "batched");
+    unsigned const total = 1000000;
+    for (unsigned batch_size = 16; batch_size <= 4096; batch_size *= 4)
+    {
+        unsigned const rounds = total / batch_size;
+        double const per_element = batch_throughput(batch_size, rounds, false);
+        double const batched = batch_throughput(batch_size, rounds, true);
+        printf("%10u %16.2f %16.2f\n", batch_size, per_element, batched);
+    }
+}
+
+// 一个读者进入临界区后停滞，观察写者运行期间堆内存的峰值。
+// 读者在整个测量窗口内都不离开：写者全部完成或者超过 window 就结束，峰值和完成的操作数都在放开读者之前读取。
+// 有上限的 domain 会让写者阻塞等待读者，窗口内完成的操作更少，这正是它用写者进度换取内存上限的代价
+template<typename Stack>
+long peak_under_stalled_reader(Stack& st, epoch_domain* domain, unsigned num_threads, unsigned ops_per_thread,
+                               unsigned long& completed_ops)
+{
+    std::chrono::milliseconds const window(2000);
+    unsigned const report_every = 256;
+    std::atomic<bool> stalled(false);
+    std::atomic<bool> release(false);
+    std::thread reader([&] {
+        if (domain)
+        {
+            epoch_guard guard(*domain);
+            stalled = true;
+            while (!release.load())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        else
+        {
+            stalled = true;
+            while (!release.load())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    while (!stalled.load())
+        std::this_thread::yield();
+
+    long const base = live_bytes.load();
+    reset_peak();
+    std::vector<std::thread> writers;
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned> finished(0);
+    std::atomic<unsigned long> completed(0);
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        writers.emplace_back([&st, &stop, &finished, &completed, ops_per_thread, report_every] {
+            unsigned i = 0;
+            for (; i < ops_per_thread && !stop.load(std::memory_order_relaxed); ++i)
+            {
+                st.push(static_cast<int>(i));
+                st.pop();
+                if ((i + 1) % report_every == 0)
+                    completed.fetch_add(report_every, std::memory_order_relaxed);
+            }
+            completed.fetch_add(i % report_every, std::memory_order_relaxed);
+            ++finished;
+        });
+    }
+    auto const deadline = std::chrono::steady_clock::now() + window;
+    while (finished.load() < num_threads && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    long const peak = peak_bytes.load() - base;
+    completed_ops = completed.load();
+    stop = true;
+    release = true;
+    reader.join();
+    for (auto& th : writers)
+        th.join();
+    return peak;
+}
+
+void bench_stalled_reader()
+{
+    unsigned const ops = 100000;
+    unsigned const writers = 2;
+    printf("== heap high-water with a reader stalled for the whole run (%u writers x %u push+pop, 2 s limit)\n",
+           writers, ops);
+    unsigned long completed = 0;
+    {
+        lock_free_stack<int> st;
+        long const peak = peak_under_stalled_reader(st, nullptr, writers, ops, completed);
+        printf("%-24s %12ld bytes %10lu ops\n", "split_count", peak, completed);
+    }
+    {
+        epoch_domain domain;
+        lock_free_stack_ebr<int> st(domain);
+        long const peak = peak_under_stalled_reader(st, &domain, writers, ops, completed);
+        printf("%-24s %12ld bytes %10lu ops (pending high-water %zu)\n", "ebr unbounded",
+               peak, completed, domain.pending_high_water_mark());
+    }
+    {
+        epoch_domain domain(4096);
+        lock_free_stack_ebr<int> st(domain);
+        long const peak = peak_under_stalled_reader(st, &domain, writers, ops, completed);
+        printf("%-24s %12ld bytes %10lu ops (pending high-water %zu)\n", "ebr max_pending=4096",
+               peak, completed, domain.pending_high_water_mark());
+    }
+}
+
+// 每个线程执行 ops_per_thread 次操作：read_percent% 查找，其余一半插入一半删除，键在 [0, keys) 内随机
+template<typename Map>
+double map_throughput(Map& map, unsigned num_threads, unsigned ops_per_thread, unsigned keys, unsigned read_percent)
+{
+    for (unsigned i = 0; i < keys; i += 2)
+        map.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&map, &go, ops_per_thread, keys, read_percent, t] {
+            std::mt19937 rng(t + 1);
+            long sum = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+            {
+                unsigned const r = rng();
+                int const key = static_cast<int>(r % keys);
+                unsigned const op = (r >> 20) % 100;
+                if (op < read_percent)
+                    sum += map.value_for(key, 0);
+                else if (op % 2)
+                    map.add_or_update_mapping(key, key);
+                else
+                    map.remove_mapping(key);
+            }
+            if (sum < 0)
+                std::printf("unexpected checksum\n");
+        });
+    }
+    auto const start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return num_threads * static_cast<double>(ops_per_thread) / seconds;
+}
+
+void bench_hash_map()
+{
+    unsigned const keys = 100000;
+    unsigned const ops = 1000000;
+    for (unsigned read_percent : {90u, 50u, 0u})
+    {
+        std::printf("== hash map, %u%% reads, rest insert/erase, %u keys, ops/s\n", read_percent, keys);
+        std::printf("%8s %16s %16s\n", "threads", "lookup_table", "lock_free");
+        for (unsigned n : thread_counts())
+        {
+            threadsafe_lookup_table<int, int> locked;
+            lock_free_hash_map<int, int> lock_free;
+            double const locked_ops = map_throughput(locked, n, ops, keys, read_percent);
+            double const lock_free_ops = map_throughput(lock_free, n, ops, keys, read_percent);
+            std::printf("%8u %16.0f %16.0f\n", n, locked_ops, lock_free_ops);
+        }
+    }
+}
+
+// 链表中预先放 size 个元素；每个线程 write_percent% 的操作 push_front 一个新值再 remove_if 删掉它，其余按值查找
+template<typename List>
+double list_throughput(unsigned num_threads, unsigned ops_per_thread, int size, unsigned write_percent)
+{
+    List list;
+    for (int i = 0; i < size; ++i)
+        list.push_front(i);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&list, &go, ops_per_thread, size, write_percent, t] {
+            std::mt19937 rng(t + 1);
+            long found = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+            {
+                unsigned const r = rng();
+                if (r % 100 < write_percent)
+                {
+                    int const value = -1 - static_cast<int>(t * ops_per_thread + i);
+                    list.push_front(value);
+                    list.remove_if([value](int const& item) {return item == value;});
+                }
+                else
+                {
+                    int const value = static_cast<int>((r >> 8) % size);
+                    if (list.find_first_if([value](int const& item) {return item == value;}))
+                        ++found;
+                }
+            }
+            if (found < 0)
+                std::printf("unexpected checksum\n");
+        });
+    }
+    auto const start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return num_threads * static_cast<double>(ops_per_thread) / seconds;
+}
+
+void bench_list()
+{
+    int const size = 1000;
+    for (unsigned write_percent : {0u, 10u, 50u})
+    {
+        std::printf("== list of %d elements, %u%% push_front+remove_if, rest find_first_if, ops/s\n",
+                    size, write_percent);
+        std::printf("%8s %16s %16s\n", "threads", "hand_over_hand", "lock_free");
+        for (unsigned n : thread_counts())
+        {
+            double const locked = list_throughput<threadsafe_list<int>>(n, 20000, size, write_percent);
+            double const lock_free = list_throughput<lock_free_list<int>>(n, 20000, size, write_percent);
+            std::printf("%8u %16.0f %16.0f\n", n, locked, lock_free);
+        }
+    }
+}
+
+// 对照组：一把互斥锁保护的 std::map
+class locked_ordered_map
+{
+private:
+    std::map<int, int> data;
+    mutable std::mutex mutex;
+
+public:
+    int value_for(int key, int default_value) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it = data.find(key);
+        return it == data.end() ? default_value : it->second;
+    }
+
+    void add_or_update_mapping(int key, int value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        data[key] = value;
+    }
+
+    void remove_mapping(int key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        data.erase(key);
+    }
+
+    template<typename Function>
+    void range_scan(int lo, int hi, Function f) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = data.lower_bound(lo); it != data.end() && it->first < hi; ++it)
+            f(it->first, it->second);
+    }
+};
+
+// 一个线程不停地插入删除，其余线程做宽度为 width 的区间遍历，返回遍历线程每秒访问的元素数
+template<typename Map>
+double range_scan_throughput(Map& map, unsigned num_scanners, unsigned scans_per_thread, unsigned keys, unsigned width)
+{
+    for (unsigned i = 0; i < keys; i += 2)
+        map.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+    std::atomic<bool> go(false);
+    std::atomic<bool> done(false);
+    std::atomic<long> visited(0);
+    std::thread writer([&map, &go, &done, keys] {
+        std::mt19937 rng(12345);
+        while (!go.load())
+            std::this_thread::yield();
+        while (!done.load(std::memory_order_relaxed))
+        {
+            int const key = static_cast<int>(rng() % keys);
+            if (key % 2)
+                map.add_or_update_mapping(key, key);
+            else
+                map.remove_mapping(key);
+        }
+    });
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_scanners; ++t)
+    {
+        threads.emplace_back([&map, &go, &visited, scans_per_thread, keys, width, t] {
+            std::mt19937 rng(t + 1);
+            long count = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < scans_per_thread; ++i)
+            {
+                int const lo = static_cast<int>(rng() % keys);
+                map.range_scan(lo, lo + static_cast<int>(width), [&count](int const&, int const&) {++count;});
+            }
+            visited.fetch_add(count);
+        });
+    }
+    auto const start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    done = true;
+    writer.join();
+    return static_cast<double>(visited.load()) / seconds;
+}
+
+void bench_skiplist()
+{
+    unsigned const keys = 100000;
+    unsigned const ops = 500000;
+    for (unsigned read_percent : {90u, 50u})
+    {
+        std::printf("== ordered map point ops, %u%% reads, rest insert/erase, %u keys, ops/s\n", read_percent, keys);
+        std::printf("%8s %16s %16s\n", "threads", "mutex_std_map", "lazy_skiplist");
+        for (unsigned n : thread_counts())
+        {
+            locked_ordered_map locked;
+            lazy_skiplist_map<int, int> skiplist;
+            double const locked_ops = map_throughput(locked, n, ops, keys, read_percent);
+            double const skiplist_ops = map_throughput(skiplist, n, ops, keys, read_percent);
+            std::printf("%8u %16.0f %16.0f\n", n, locked_ops, skiplist_ops);
+        }
+    }
+    for (unsigned width : {100u, 10000u})
+    {
+        std::printf("== range_scan of width %u with one concurrent writer, elements visited/s\n", width);
+        std::printf("%8s %16s %16s\n", "scanners", "mutex_std_map", "lazy_skiplist");
+        unsigned const scans = 2000000 / width;
+        for (unsigned n : thread_counts())
+        {
+            locked_ordered_map locked;
+            lazy_skiplist_map<int, int> skiplist;
+            double const locked_rate = range_scan_throughput(locked, n, scans, keys, width);
+            double const skiplist_rate = range_scan_throughput(skiplist, n, scans, keys, width);
+            std::printf("%8u %16.0f %16.0f\n", n, locked_rate, skiplist_rate);
+        }
+    }
+}
+
+int main()
+{
+    bench_reclamation_throughput();
+    bench_elimination();
+    bench_value_storage();
+    bench_batch();
+    bench_stalled_reader();
+    bench_hash_map();
+    bench_list();
+    bench_skiplist();
+    return 0;
+}
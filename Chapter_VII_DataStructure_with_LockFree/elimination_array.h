@@ -0,0 +1,160 @@
+//
+// Created by 13345 on 2024/4/8.
+// 消去数组（elimination array），用于无锁栈的消去退避
+// 竞争激烈时，CAS head 失败的 push 和 pop 随机选择一个槽位相遇，push 直接把节点交给 pop，两个操作互相抵消，
+// 不需要再访问 head。槽位的状态：
+//   empty          槽位空闲
+//   pop_waiting    有 pop 在等待
+//   taken          pop 拿走了等待中的 push 的节点，由该 push 负责清空槽位
+//   p              push 带着节点 p 在等待
+//   p | 1          push 把节点 p 交给了等待中的 pop，由该 pop 负责清空槽位
+// 槽位只由放入等待状态的一方清空，因此不会出现 ABA 问题。
+//
+
+#ifndef CPP_CONCURRENCY_ELIMINATION_ARRAY_H
+#define CPP_CONCURRENCY_ELIMINATION_ARRAY_H
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <functional>
+
+#include "../Chapter_III_SharedData/cpu_relax.h"
+
+template<typename Node>
+class elimination_array
+{
+private:
+    static std::uintptr_t const empty = 0;
+    static std::uintptr_t const pop_waiting = 2;
+    static std::uintptr_t const taken = 4;
+    static unsigned const max_slots = 16;
+    static unsigned const spin_count = 128;
+
+    struct alignas(64) slot
+    {
+        std::atomic<std::uintptr_t> state;
+        slot() : state(empty) {}
+    };
+
+    slot slots[max_slots];
+    unsigned const num_slots;
+
+    static bool is_push_offer(std::uintptr_t s)
+    {
+        return s > taken && !(s & 1);
+    }
+
+    static bool is_delivered(std::uintptr_t s)
+    {
+        return s > taken && (s & 1);
+    }
+
+    slot& random_slot()
+    {
+        // 线程私有的 xorshift 随机数，避免所有线程挤在同一个槽位
+        static thread_local std::uint32_t seed =
+                static_cast<std::uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return slots[seed % num_slots];
+    }
+
+    static unsigned default_slots()
+    {
+        unsigned const hardware_threads = std::thread::hardware_concurrency();
+        unsigned const n = hardware_threads / 2;
+        return n == 0 ? 1 : (n > max_slots ? max_slots : n);
+    }
+
+public:
+    elimination_array() : num_slots(default_slots()) {}
+    elimination_array(elimination_array const&)=delete;
+    elimination_array& operator=(elimination_array const&)=delete;
+
+    // 尝试把节点交给一个 pop，成功返回 true，此后节点归 pop 所有
+    bool try_push(Node* n)
+    {
+        slot& s = random_slot();
+        std::uintptr_t const offer = reinterpret_cast<std::uintptr_t>(n);
+        std::uintptr_t state = s.state.load(std::memory_order_acquire);
+        if (state == pop_waiting)
+        {
+            return s.state.compare_exchange_strong(state, offer | 1,
+                                                   std::memory_order_acq_rel,
+                                                   std::memory_order_relaxed);
+        }
+        if (state != empty ||
+            !s.state.compare_exchange_strong(state, offer,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed))
+        {
+            return false;
+        }
+        for (unsigned i = 0; i < spin_count; ++i)
+        {
+            if (s.state.load(std::memory_order_acquire) == taken)
+            {
+                s.state.store(empty, std::memory_order_release);
+                return true;
+            }
+            cpu_relax();
+        }
+        std::uintptr_t expected = offer;
+        if (s.state.compare_exchange_strong(expected, empty,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire))
+        {
+            return false;
+        }
+        // 撤回失败说明节点已经被 pop 拿走
+        s.state.store(empty, std::memory_order_release);
+        return true;
+    }
+
+    // 尝试从一个 push 那里拿到节点，失败返回 nullptr
+    Node* try_pop()
+    {
+        slot& s = random_slot();
+        std::uintptr_t state = s.state.load(std::memory_order_acquire);
+        if (is_push_offer(state))
+        {
+            if (s.state.compare_exchange_strong(state, taken,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_relaxed))
+            {
+                return reinterpret_cast<Node*>(state);
+            }
+            return nullptr;
+        }
+        if (state != empty ||
+            !s.state.compare_exchange_strong(state, pop_waiting,
+                                             std::memory_order_relaxed,
+                                             std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        for (unsigned i = 0; i < spin_count; ++i)
+        {
+            state = s.state.load(std::memory_order_acquire);
+            if (is_delivered(state))
+            {
+                s.state.store(empty, std::memory_order_release);
+                return reinterpret_cast<Node*>(state & ~std::uintptr_t(1));
+            }
+            cpu_relax();
+        }
+        std::uintptr_t expected = pop_waiting;
+        if (s.state.compare_exchange_strong(expected, empty,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        s.state.store(empty, std::memory_order_release);
+        return reinterpret_cast<Node*>(expected & ~std::uintptr_t(1));
+    }
+};
+
+#endif //CPP_CONCURRENCY_ELIMINATION_ARRAY_H
@@ -0,0 +1,403 @@
+//
+// Created by 13345 on 2024/4/6.
+// 基于纪元的内存回收（Epoch-Based Reclamation, EBR）
+// 与风险指针相比，读者进入临界区时只写自己线程的纪元公告（独占缓存行），不需要对每次访问发布风险指针，
+// 适合读多写少的无锁数据结构。
+// 1) 全局纪元 global_epoch，每个线程在进入临界区时公告自己看到的纪元
+// 2) 被删除的节点按删除时的纪元放进线程私有的 limbo 链表（共3个，按 epoch % 3 轮转）
+// 3) 所有活跃线程都已公告当前纪元 e 时，全局纪元推进到 e + 1；在纪元 e 删除的节点在全局纪元 >= e + 2 时可以安全释放
+// 停滞的线程（在临界区内被挂起）会阻止纪元推进，因此 limbo 的总量可以设置上限 max_pending：
+// 超过上限时，执行 retire 的线程会阻塞等待纪元推进（以写者的进度换取内存有界），长时间遍历的读者应定期调用 refresh()。
+//
+
+#ifndef CPP_CONCURRENCY_EPOCH_RECLAMATION_H
+#define CPP_CONCURRENCY_EPOCH_RECLAMATION_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <set>
+#include <thread>
+#include <cstddef>
+#include <stdexcept>
+
+class epoch_domain
+{
+public:
+    static unsigned const max_threads = 128;
+
+private:
+    struct retired_node
+    {
+        void* ptr;
+        void (*deleter)(void*);
+    };
+
+    struct limbo_bag
+    {
+        unsigned long epoch;
+        std::vector<retired_node> nodes;
+        limbo_bag() : epoch(0) {}
+    };
+
+    // 每个线程一条记录，单独占一个缓存行，读者进出临界区只写自己的记录
+    struct alignas(64) thread_record
+    {
+        // 最低位表示是否在临界区内，其余位为公告的纪元
+        std::atomic<unsigned long> announcement;
+        std::atomic<bool> in_use;
+        // 以下成员只由持有该记录的线程访问
+        unsigned nesting;
+        bool over_limit;
+        limbo_bag limbo[3];
+        thread_record() : announcement(0), in_use(false), nesting(0), over_limit(false) {}
+    };
+
+    // 线程退出时，把它在各个 domain 中的记录归还（limbo 转交给 domain 的孤儿链表）
+    struct thread_registry
+    {
+        struct entry
+        {
+            epoch_domain* domain;
+            unsigned long id;
+            thread_record* record;
+        };
+        std::vector<entry> entries;
+        ~thread_registry()
+        {
+            std::lock_guard<std::mutex> lk(live_mutex());
+            for (unsigned i = 0; i < entries.size(); ++i)
+            {
+                if (live_domains().count(entries[i].id))
+                    entries[i].domain->release_record(entries[i].record);
+            }
+        }
+    };
+
+    std::atomic<unsigned long> global_epoch;
+    thread_record records[max_threads];
+    std::size_t const max_pending;
+    std::atomic<std::size_t> pending;
+    std::atomic<std::size_t> pending_high_water;
+    unsigned long const id;
+
+    std::mutex orphan_mutex;
+    std::vector<limbo_bag> orphans;
+
+    static std::mutex& live_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+    static std::set<unsigned long>& live_domains()
+    {
+        static std::set<unsigned long> domains;
+        return domains;
+    }
+    static unsigned long next_id()
+    {
+        static std::atomic<unsigned long> counter(0);
+        return ++counter;
+    }
+    static thread_registry& registry()
+    {
+        static thread_local thread_registry reg;
+        return reg;
+    }
+
+    thread_record& local_record()
+    {
+        // 绝大多数情况下线程只使用一个 domain，先查缓存
+        static thread_local epoch_domain* cached_domain = nullptr;
+        static thread_local unsigned long cached_id = 0;
+        static thread_local thread_record* cached_record = nullptr;
+        if (cached_domain == this && cached_id == id)
+            return *cached_record;
+
+        thread_registry& reg = registry();
+        thread_record* rec = nullptr;
+        for (unsigned i = 0; i < reg.entries.size(); ++i)
+        {
+            if (reg.entries[i].domain == this && reg.entries[i].id == id)
+            {
+                rec = reg.entries[i].record;
+                break;
+            }
+        }
+        if (!rec)
+        {
+            rec = acquire_record();
+            thread_registry::entry e = {this, id, rec};
+            reg.entries.push_back(e);
+        }
+        cached_domain = this;
+        cached_id = id;
+        cached_record = rec;
+        return *rec;
+    }
+
+    thread_record* acquire_record()
+    {
+        for (unsigned i = 0; i < max_threads; ++i)
+        {
+            bool expected = false;
+            if (!records[i].in_use.load(std::memory_order_relaxed) &&
+                records[i].in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+            {
+                return &records[i];
+            }
+        }
+        throw std::runtime_error("epoch_domain: too many threads");
+    }
+
+    void release_record(thread_record* rec)
+    {
+        {
+            std::lock_guard<std::mutex> lk(orphan_mutex);
+            for (unsigned i = 0; i < 3; ++i)
+            {
+                if (!rec->limbo[i].nodes.empty())
+                {
+                    orphans.push_back(limbo_bag());
+                    orphans.back().epoch = rec->limbo[i].epoch;
+                    orphans.back().nodes.swap(rec->limbo[i].nodes);
+                }
+            }
+        }
+        rec->nesting = 0;
+        rec->announcement.store(0, std::memory_order_release);
+        rec->in_use.store(false, std::memory_order_release);
+    }
+
+    void free_bag(limbo_bag& bag)
+    {
+        std::size_t const count = bag.nodes.size();
+        for (unsigned i = 0; i < count; ++i)
+            bag.nodes[i].deleter(bag.nodes[i].ptr);
+        bag.nodes.clear();
+        pending.fetch_sub(count, std::memory_order_relaxed);
+    }
+
+    // 释放本线程 limbo 以及孤儿链表中已经过了宽限期的节点
+    void collect(thread_record& rec, unsigned long const epoch)
+    {
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            if (!rec.limbo[i].nodes.empty() && rec.limbo[i].epoch + 2 <= epoch)
+                free_bag(rec.limbo[i]);
+        }
+        std::unique_lock<std::mutex> lk(orphan_mutex, std::try_to_lock);
+        if (lk.owns_lock() && !orphans.empty())
+        {
+            std::vector<limbo_bag> remaining;
+            for (unsigned i = 0; i < orphans.size(); ++i)
+            {
+                if (orphans[i].epoch + 2 <= epoch)
+                    free_bag(orphans[i]);
+                else
+                    remaining.push_back(std::move(orphans[i]));
+            }
+            orphans.swap(remaining);
+        }
+    }
+
+    // 超过上限：等待停滞的线程离开临界区，直到本线程 limbo 中的节点全部释放
+    // 只等待自己的节点，避免其他空闲线程的 limbo 让本线程永远等待
+    void throttle(thread_record& rec)
+    {
+        rec.over_limit = false;
+        for (;;)
+        {
+            try_advance();
+            collect(rec, global_epoch.load(std::memory_order_acquire));
+            if (rec.limbo[0].nodes.empty() && rec.limbo[1].nodes.empty() && rec.limbo[2].nodes.empty())
+                break;
+            std::this_thread::yield();
+        }
+    }
+
+    template<typename T>
+    static void delete_object(void* p)
+    {
+        delete static_cast<T*>(p);
+    }
+
+public:
+    class guard
+    {
+        epoch_domain* domain;
+    public:
+        explicit guard(epoch_domain& d) : domain(&d)
+        {
+            domain->enter();
+        }
+        ~guard()
+        {
+            if (domain)
+                domain->exit();
+        }
+        guard(guard const&)=delete;
+        guard& operator=(guard const&)=delete;
+        guard(guard&& other) noexcept : domain(other.domain)
+        {
+            other.domain = nullptr;
+        }
+
+        // 长时间遍历时重新公告当前纪元，之前读到的指针全部失效
+        void refresh()
+        {
+            domain->exit();
+            domain->enter();
+        }
+    };
+
+    explicit epoch_domain(std::size_t max_pending_=0) :
+        global_epoch(1), max_pending(max_pending_), pending(0), pending_high_water(0), id(next_id())
+    {
+        std::lock_guard<std::mutex> lk(live_mutex());
+        live_domains().insert(id);
+    }
+
+    // 析构时不能再有线程使用该 domain
+    ~epoch_domain()
+    {
+        {
+            std::lock_guard<std::mutex> lk(live_mutex());
+            live_domains().erase(id);
+        }
+        for (unsigned i = 0; i < max_threads; ++i)
+        {
+            for (unsigned j = 0; j < 3; ++j)
+                free_bag(records[i].limbo[j]);
+        }
+        for (unsigned i = 0; i < orphans.size(); ++i)
+            free_bag(orphans[i]);
+    }
+
+    epoch_domain(epoch_domain const&)=delete;
+    epoch_domain& operator=(epoch_domain const&)=delete;
+
+    // 默认的全局 domain，容器未指定 domain 时使用
+    static epoch_domain& global()
+    {
+        static epoch_domain domain;
+        return domain;
+    }
+
+    void enter()
+    {
+        thread_record& rec = local_record();
+        if (rec.nesting++ == 0)
+        {
+            unsigned long epoch = global_epoch.load(std::memory_order_relaxed);
+            while (true)
+            {
+                rec.announcement.store((epoch << 1) | 1, std::memory_order_relaxed);
+                // 公告之后读取受保护的指针是 acquire 读，单靠 seq_cst 的写不能阻止它们被重排到公告之前（StoreLoad），
+                // 需要一个完整的栅栏；栅栏之后再检查一次纪元，公告期间纪元已经推进时重新公告
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                unsigned long const current = global_epoch.load(std::memory_order_relaxed);
+                if (current == epoch)
+                    break;
+                epoch = current;
+            }
+        }
+    }
+
+    void exit()
+    {
+        thread_record& rec = local_record();
+        if (--rec.nesting == 0)
+        {
+            rec.announcement.store(0, std::memory_order_release);
+            if (rec.over_limit)
+                throttle(rec);
+        }
+    }
+
+    // 所有处于临界区的线程都已公告当前纪元时推进全局纪元
+    bool try_advance()
+    {
+        unsigned long const epoch = global_epoch.load(std::memory_order_seq_cst);
+        for (unsigned i = 0; i < max_threads; ++i)
+        {
+            if (!records[i].in_use.load(std::memory_order_acquire))
+                continue;
+            unsigned long const a = records[i].announcement.load(std::memory_order_seq_cst);
+            if ((a & 1) && (a >> 1) != epoch)
+                return false;
+        }
+        unsigned long expected = epoch;
+        global_epoch.compare_exchange_strong(expected, epoch + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    void retire(void* p, void (*deleter)(void*))
+    {
+        thread_record& rec = local_record();
+        unsigned long const epoch = global_epoch.load(std::memory_order_seq_cst);
+        limbo_bag& bag = rec.limbo[epoch % 3];
+        if (bag.epoch != epoch)
+        {
+            // 同一下标上的旧 bag 至少落后3个纪元，可以直接释放
+            if (!bag.nodes.empty())
+                free_bag(bag);
+            bag.epoch = epoch;
+        }
+        bag.nodes.push_back(retired_node{p, deleter});
+        std::size_t const now = pending.fetch_add(1, std::memory_order_relaxed) + 1;
+        std::size_t high = pending_high_water.load(std::memory_order_relaxed);
+        while (now > high && !pending_high_water.compare_exchange_weak(high, now, std::memory_order_relaxed));
+
+        // 每积累一批节点尝试推进一次纪元，摊薄扫描所有线程记录的开销
+        if (bag.nodes.size() % 64 == 0)
+        {
+            try_advance();
+            collect(rec, global_epoch.load(std::memory_order_acquire));
+        }
+        if (max_pending && pending.load(std::memory_order_relaxed) > max_pending)
+        {
+            // 在临界区内等待会阻塞自己，推迟到离开临界区时
+            rec.over_limit = true;
+            if (rec.nesting == 0)
+                throttle(rec);
+        }
+    }
+
+    template<typename T>
+    void retire(T* p)
+    {
+        retire(p, &delete_object<T>);
+    }
+
+    // 尽力回收：推进纪元并释放本线程可以释放的节点
+    void reclaim()
+    {
+        thread_record& rec = local_record();
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            if (!try_advance())
+                break;
+        }
+        collect(rec, global_epoch.load(std::memory_order_acquire));
+    }
+
+    std::size_t pending_count() const
+    {
+        return pending.load(std::memory_order_relaxed);
+    }
+
+    std::size_t pending_high_water_mark() const
+    {
+        return pending_high_water.load(std::memory_order_relaxed);
+    }
+
+    unsigned long current_epoch() const
+    {
+        return global_epoch.load(std::memory_order_relaxed);
+    }
+};
+
+typedef epoch_domain::guard epoch_guard;
+
+#endif //CPP_CONCURRENCY_EPOCH_RECLAMATION_H
@@ -0,0 +1,495 @@
+//
+// Created by 13345 on 2024/4/26.
+// 有序的并发跳表（Herlihy、Lev、Luchangco、Shavit 的 lazy skiplist），支持按键区间遍历
+// 查找和遍历完全不加锁，只读取原子指针；插入和删除只锁住修改位置上的前驱节点，加锁后校验前驱仍然指向后继、
+// 且两者都没有被删除，校验失败就重新查找（乐观细粒度锁）。删除先给节点打标记（逻辑删除），
+// 再一次性从所有层摘下（物理删除），摘下之后交给 EBR 回收，所以不加锁的读者和迭代器都不会访问到已释放的节点。
+// 节点一旦完整地链入所有层（fully_linked）并且没有标记，就认为它在表中。
+//
+
+#ifndef CPP_CONCURRENCY_LAZY_SKIPLIST_MAP_H
+#define CPP_CONCURRENCY_LAZY_SKIPLIST_MAP_H
+
+#include "epoch_reclamation.h"
+#include "../Chapter_III_SharedData/cpu_relax.h"
+#include "../Chapter_III_SharedData/parking_mutex.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <new>
+#include <thread>
+#include <utility>
+
+// Mutex 是节点上的锁，默认只占一个字节
+template<typename Key, typename Value, typename Compare=std::less<Key>, typename Mutex=parking_mutex>
+class lazy_skiplist_map
+{
+private:
+    static unsigned const max_level = 24;
+
+    struct node
+    {
+        alignas(Key) unsigned char key_storage[sizeof(Key)];
+        std::atomic<Value*> value;
+        std::atomic<bool> marked;
+        std::atomic<bool> fully_linked;
+        Mutex mutex;
+        unsigned const top_level;
+        // 指向紧跟在节点后面分配的 top_level + 1 个指针
+        std::atomic<node*>* const next;
+
+        node(unsigned top_level_, std::atomic<node*>* next_) :
+            value(nullptr), marked(false), fully_linked(false), top_level(top_level_), next(next_)
+        {
+            for (unsigned i = 0; i <= top_level; ++i)
+                new (&next[i]) std::atomic<node*>(nullptr);
+        }
+
+        Key const& key() const
+        {
+            return *std::launder(reinterpret_cast<Key const*>(key_storage));
+        }
+
+        void lock()
+        {
+            mutex.lock();
+        }
+
+        void unlock()
+        {
+            mutex.unlock();
+        }
+    };
+
+    node* head;
+    std::atomic<std::size_t> count;
+    Compare less;
+    epoch_domain& domain;
+
+    // 节点和它的各层指针一次分配；head 不构造键
+    static node* allocate_node(unsigned top_level)
+    {
+        std::size_t const size = sizeof(node) + (top_level + 1) * sizeof(std::atomic<node*>);
+        void* const raw = ::operator new(size);
+        std::atomic<node*>* const next = reinterpret_cast<std::atomic<node*>*>(static_cast<char*>(raw) + sizeof(node));
+        return new (raw) node(top_level, next);
+    }
+
+    static node* create_node(unsigned top_level, Key const& key, Value const& value)
+    {
+        node* const n = allocate_node(top_level);
+        try
+        {
+            new (n->key_storage) Key(key);
+        }
+        catch (...)
+        {
+            n->~node();
+            ::operator delete(n);
+            throw;
+        }
+        try
+        {
+            n->value.store(new Value(value), std::memory_order_relaxed);
+        }
+        catch (...)
+        {
+            n->key().~Key();
+            n->~node();
+            ::operator delete(n);
+            throw;
+        }
+        return n;
+    }
+
+    static void destroy_node(void* p)
+    {
+        node* const n = static_cast<node*>(p);
+        delete n->value.load(std::memory_order_relaxed);
+        n->key().~Key();
+        n->~node();
+        ::operator delete(n);
+    }
+
+    static unsigned random_level()
+    {
+        static thread_local std::uint32_t seed =
+                static_cast<std::uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        // 每升一层的概率是 1/2
+        unsigned level = 0;
+        std::uint32_t bits = seed;
+        while ((bits & 1) && level < max_level - 1)
+        {
+            ++level;
+            bits >>= 1;
+        }
+        return level;
+    }
+
+    // 自顶向下查找，preds[i] 是第 i 层最后一个小于 key 的节点，succs[i] 是它的后继；
+    // 返回 key 所在节点出现的最高层，没有时返回 -1
+    int find(Key const& key, node** preds, node** succs) const
+    {
+        int found_level = -1;
+        node* pred = head;
+        for (int level = max_level - 1; level >= 0; --level)
+        {
+            node* curr = pred->next[level].load(std::memory_order_acquire);
+            while (curr && less(curr->key(), key))
+            {
+                pred = curr;
+                curr = pred->next[level].load(std::memory_order_acquire);
+            }
+            if (found_level == -1 && curr && !less(key, curr->key()))
+                found_level = level;
+            preds[level] = pred;
+            succs[level] = curr;
+        }
+        return found_level;
+    }
+
+    // 锁住 0..top_level 层的前驱（同一个节点只锁一次），返回成功锁住的最高层，校验失败时 valid 为 false
+    int lock_preds(node** preds, node** succs, int top_level, bool& valid)
+    {
+        node* prev_pred = nullptr;
+        int highest_locked = -1;
+        valid = true;
+        for (int level = 0; valid && level <= top_level; ++level)
+        {
+            node* const pred = preds[level];
+            node* const succ = succs[level];
+            if (pred != prev_pred)
+            {
+                pred->lock();
+                highest_locked = level;
+                prev_pred = pred;
+            }
+            valid = !pred->marked.load(std::memory_order_relaxed) &&
+                    (!succ || !succ->marked.load(std::memory_order_relaxed)) &&
+                    pred->next[level].load(std::memory_order_relaxed) == succ;
+        }
+        return highest_locked;
+    }
+
+    static void unlock_preds(node** preds, int highest_locked)
+    {
+        node* prev_pred = nullptr;
+        for (int level = 0; level <= highest_locked; ++level)
+        {
+            if (preds[level] != prev_pred)
+            {
+                preds[level]->unlock();
+                prev_pred = preds[level];
+            }
+        }
+    }
+
+    bool is_present(node const* n) const
+    {
+        return n->fully_linked.load(std::memory_order_acquire) && !n->marked.load(std::memory_order_acquire);
+    }
+
+    // 第 0 层上第一个键不小于 key 的节点
+    node* lower_bound_node(Key const& key) const
+    {
+        node* preds[max_level];
+        node* succs[max_level];
+        find(key, preds, succs);
+        return succs[0];
+    }
+
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+
+    // 迭代器持有一个 epoch_guard：它指向的节点即使被并发删除也不会被释放，++ 仍然可以沿着原来的后继继续前进。
+    // 迭代器只能在创建它的线程里使用，长时间持有会推迟整个 domain 的回收
+    class const_iterator
+    {
+        friend class lazy_skiplist_map;
+        lazy_skiplist_map const* map;
+        epoch_guard guard;
+        node* current;
+
+        const_iterator(lazy_skiplist_map const* map_, node* current_) :
+            map(map_), guard(map_->domain), current(current_)
+        {
+            skip_absent();
+        }
+
+        void skip_absent()
+        {
+            while (current && !map->is_present(current))
+                current = current->next[0].load(std::memory_order_acquire);
+        }
+
+    public:
+        const_iterator(const_iterator const& other) :
+            map(other.map), guard(other.map->domain), current(other.current) {}
+        const_iterator& operator=(const_iterator const&)=delete;
+
+        Key const& key() const
+        {
+            return current->key();
+        }
+
+        // 返回值的副本，并发更新时旧值由 EBR 回收
+        Value value() const
+        {
+            return *current->value.load(std::memory_order_acquire);
+        }
+
+        std::pair<Key, Value> operator*() const
+        {
+            return std::pair<Key, Value>(key(), value());
+        }
+
+        const_iterator& operator++()
+        {
+            current = current->next[0].load(std::memory_order_acquire);
+            skip_absent();
+            return *this;
+        }
+
+        bool at_end() const
+        {
+            return current == nullptr;
+        }
+
+        bool operator==(const_iterator const& other) const
+        {
+            return current == other.current;
+        }
+
+        bool operator!=(const_iterator const& other) const
+        {
+            return current != other.current;
+        }
+    };
+
+    explicit lazy_skiplist_map(Compare const& less_=Compare(), epoch_domain& domain_=epoch_domain::global()) :
+        head(allocate_node(max_level - 1)), count(0), less(less_), domain(domain_)
+    {
+        head->fully_linked.store(true, std::memory_order_relaxed);
+    }
+
+    lazy_skiplist_map(lazy_skiplist_map const&)=delete;
+    lazy_skiplist_map& operator=(lazy_skiplist_map const&)=delete;
+
+    ~lazy_skiplist_map()
+    {
+        // 析构时已没有并发访问，沿第 0 层释放所有节点
+        node* p = head->next[0].load(std::memory_order_relaxed);
+        while (p)
+        {
+            node* const next = p->next[0].load(std::memory_order_relaxed);
+            destroy_node(p);
+            p = next;
+        }
+        head->~node();
+        ::operator delete(head);
+    }
+
+    bool find(Key const& key, Value& value) const
+    {
+        epoch_guard guard(domain);
+        node* preds[max_level];
+        node* succs[max_level];
+        int const found_level = find(key, preds, succs);
+        if (found_level == -1 || !is_present(succs[found_level]))
+            return false;
+        value = *succs[found_level]->value.load(std::memory_order_acquire);
+        return true;
+    }
+
+    Value value_for(Key const& key, Value const& default_value=Value()) const
+    {
+        Value res;
+        return find(key, res) ? res : default_value;
+    }
+
+    // 键不存在时插入并返回 true；已存在时更新值并返回 false
+    bool insert(Key const& key, Value const& value)
+    {
+        epoch_guard guard(domain);
+        unsigned const top_level = random_level();
+        node* preds[max_level];
+        node* succs[max_level];
+        while (true)
+        {
+            int const found_level = find(key, preds, succs);
+            if (found_level != -1)
+            {
+                node* const found = succs[found_level];
+                if (!found->marked.load(std::memory_order_acquire))
+                {
+                    // 等待正在插入的线程完成链接
+                    while (!found->fully_linked.load(std::memory_order_acquire))
+                        cpu_relax();
+                    Value* const old_value = found->value.exchange(new Value(value), std::memory_order_acq_rel);
+                    domain.retire(old_value);
+                    // 更新之后节点才被标记，说明更新发生在删除之前；否则重新插入
+                    if (!found->marked.load(std::memory_order_acquire))
+                        return false;
+                }
+                continue;
+            }
+            bool valid;
+            int const highest_locked = lock_preds(preds, succs, static_cast<int>(top_level), valid);
+            if (!valid)
+            {
+                unlock_preds(preds, highest_locked);
+                continue;
+            }
+            node* new_node;
+            try
+            {
+                new_node = create_node(top_level, key, value);
+            }
+            catch (...)
+            {
+                unlock_preds(preds, highest_locked);
+                throw;
+            }
+            for (unsigned level = 0; level <= top_level; ++level)
+                new_node->next[level].store(succs[level], std::memory_order_relaxed);
+            for (unsigned level = 0; level <= top_level; ++level)
+                preds[level]->next[level].store(new_node, std::memory_order_release);
+            new_node->fully_linked.store(true, std::memory_order_release);
+            unlock_preds(preds, highest_locked);
+            count.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    void add_or_update_mapping(Key const& key, Value const& value)
+    {
+        insert(key, value);
+    }
+
+    bool erase(Key const& key)
+    {
+        epoch_guard guard(domain);
+        node* victim = nullptr;
+        bool is_marked = false;
+        int top_level = -1;
+        node* preds[max_level];
+        node* succs[max_level];
+        while (true)
+        {
+            int const found_level = find(key, preds, succs);
+            if (!is_marked)
+            {
+                // 只删除完整链接、且是在它的最高层被找到的节点（否则还在插入中或者已被删除）
+                if (found_level == -1)
+                    return false;
+                victim = succs[found_level];
+                if (!victim->fully_linked.load(std::memory_order_acquire) ||
+                    static_cast<int>(victim->top_level) != found_level ||
+                    victim->marked.load(std::memory_order_acquire))
+                    return false;
+                top_level = static_cast<int>(victim->top_level);
+                victim->lock();
+                if (victim->marked.load(std::memory_order_relaxed))
+                {
+                    victim->unlock();
+                    return false;
+                }
+                victim->marked.store(true, std::memory_order_release);
+                is_marked = true;
+            }
+            // 校验时 succs 应该就是 victim 本身，它已被标记，所以这里单独检查
+            bool valid = true;
+            node* prev_pred = nullptr;
+            int highest_locked = -1;
+            for (int level = 0; valid && level <= top_level; ++level)
+            {
+                node* const pred = preds[level];
+                if (pred != prev_pred)
+                {
+                    pred->lock();
+                    highest_locked = level;
+                    prev_pred = pred;
+                }
+                valid = !pred->marked.load(std::memory_order_relaxed) &&
+                        pred->next[level].load(std::memory_order_relaxed) == victim;
+            }
+            if (!valid)
+            {
+                unlock_preds(preds, highest_locked);
+                continue;
+            }
+            for (int level = top_level; level >= 0; --level)
+                preds[level]->next[level].store(victim->next[level].load(std::memory_order_relaxed),
+                                                std::memory_order_release);
+            victim->unlock();
+            unlock_preds(preds, highest_locked);
+            count.fetch_sub(1, std::memory_order_relaxed);
+            domain.retire(victim, &destroy_node);
+            return true;
+        }
+    }
+
+    void remove_mapping(Key const& key)
+    {
+        erase(key);
+    }
+
+    // 按键的顺序对 [lo, hi) 中的每个元素调用 f(key, value)；并发修改时不是一致的快照，
+    // 但遍历期间一直存在的元素一定会被访问到，且每个键最多访问一次
+    template<typename Function>
+    void range_scan(Key const& lo, Key const& hi, Function f) const
+    {
+        epoch_guard guard(domain);
+        node* current = lower_bound_node(lo);
+        while (current && less(current->key(), hi))
+        {
+            if (is_present(current))
+                f(current->key(), static_cast<Value const&>(*current->value.load(std::memory_order_acquire)));
+            current = current->next[0].load(std::memory_order_acquire);
+        }
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(this, head->next[0].load(std::memory_order_acquire));
+    }
+
+    const_iterator lower_bound(Key const& key) const
+    {
+        // 先建立迭代器（也就是先进入临界区），再查找
+        const_iterator it(this, nullptr);
+        it.current = lower_bound_node(key);
+        it.skip_absent();
+        return it;
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(this, nullptr);
+    }
+
+    std::size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    std::map<Key, Value, Compare> get_map() const
+    {
+        std::map<Key, Value, Compare> res(less);
+        epoch_guard guard(domain);
+        for (node* p = head->next[0].load(std::memory_order_acquire); p; p = p->next[0].load(std::memory_order_acquire))
+        {
+            if (is_present(p))
+                res.emplace(p->key(), *p->value.load(std::memory_order_acquire));
+        }
+        return res;
+    }
+};
+
+#endif //CPP_CONCURRENCY_LAZY_SKIPLIST_MAP_H
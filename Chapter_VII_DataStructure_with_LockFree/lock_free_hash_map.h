@@ -0,0 +1,376 @@
+//
+// Created by 13345 on 2024/4/16.
+// 无锁哈希表：分裂有序链表（split-ordered list，Shalev & Shavit）
+// 所有元素放在一条按“位反转后的哈希值”排序的无锁链表（Harris-Michael）中，桶只是指向链表中哑节点的捷径。
+// 桶数加倍时不需要移动任何元素：新桶 b 的哑节点插在父桶（b 去掉最高位）的区间中间，第一次访问时才创建，
+// 因此扩容本身只是一次 CAS。删除时先在 next 指针上打标记（逻辑删除），再摘链（物理删除），
+// 摘下的节点和被替换的值都交给 EBR 回收，读者在 epoch_guard 内可以放心解引用。
+// 接口与 threadsafe_lookup_table 相同，可以互相替换。
+//
+
+#ifndef CPP_CONCURRENCY_LOCK_FREE_HASH_MAP_H
+#define CPP_CONCURRENCY_LOCK_FREE_HASH_MAP_H
+
+#include "epoch_reclamation.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+
+template<typename Key, typename Value, typename Hash=std::hash<Key>>
+class lock_free_hash_map
+{
+private:
+    // 哑节点的排序键最低位为0，普通节点为1；同一个桶的哑节点总排在该桶所有元素之前
+    struct node
+    {
+        std::uint64_t const so_key;
+        // 最低位是删除标记
+        std::atomic<std::uintptr_t> next;
+        explicit node(std::uint64_t so_key_) : so_key(so_key_), next(0) {}
+        bool is_dummy() const
+        {
+            return (so_key & 1) == 0;
+        }
+    };
+
+    struct regular_node : node
+    {
+        Key const key;
+        std::atomic<Value*> value;
+        regular_node(std::uint64_t so_key_, Key const& key_, Value* value_) :
+            node(so_key_), key(key_), value(value_) {}
+        ~regular_node()
+        {
+            delete value.load(std::memory_order_relaxed);
+        }
+    };
+
+    // 桶数组分段分配：第0段只有桶0，第 s 段（s >= 1）是桶 [2^(s-1), 2^s)
+    static unsigned const max_segments = 64;
+    static unsigned const max_load = 2;
+
+    // 查找时也会按需初始化桶、摘掉已标记删除的节点，所以 value_for 这类 const 函数也要修改桶数组和链表，声明为 mutable
+    mutable std::atomic<std::atomic<node*>*> segments[max_segments];
+    std::atomic<std::size_t> bucket_size;
+    std::atomic<std::size_t> count;
+    mutable node head;
+    Hash hasher;
+    epoch_domain& domain;
+
+    static bool is_marked(std::uintptr_t p)
+    {
+        return (p & 1) != 0;
+    }
+
+    static node* get_node(std::uintptr_t p)
+    {
+        return reinterpret_cast<node*>(p & ~std::uintptr_t(1));
+    }
+
+    static std::uintptr_t to_link(node* p)
+    {
+        return reinterpret_cast<std::uintptr_t>(p);
+    }
+
+    static std::uint64_t reverse_bits(std::uint64_t x)
+    {
+        x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+        x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+        x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+        x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+        x = ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+        return (x >> 32) | (x << 32);
+    }
+
+    static std::uint64_t regular_key(std::uint64_t hash)
+    {
+        return reverse_bits(hash) | 1;
+    }
+
+    static std::uint64_t dummy_key(std::size_t bucket)
+    {
+        return reverse_bits(bucket);
+    }
+
+    // 桶号的二进制位数
+    static unsigned segment_of(std::size_t bucket)
+    {
+#if defined(__GNUC__)
+        return bucket == 0 ? 0 : 64 - __builtin_clzll(bucket);
+#else
+        unsigned s = 0;
+        while (bucket)
+        {
+            ++s;
+            bucket >>= 1;
+        }
+        return s;
+#endif
+    }
+
+    static std::size_t segment_base(unsigned segment)
+    {
+        return segment == 0 ? 0 : std::size_t(1) << (segment - 1);
+    }
+
+    std::atomic<node*>& bucket_slot(std::size_t bucket) const
+    {
+        unsigned const s = segment_of(bucket);
+        std::atomic<node*>* seg = segments[s].load(std::memory_order_acquire);
+        if (!seg)
+        {
+            std::size_t const size = s == 0 ? 1 : segment_base(s);
+            std::atomic<node*>* const fresh = new std::atomic<node*>[size];
+            for (std::size_t i = 0; i < size; ++i)
+                fresh[i].store(nullptr, std::memory_order_relaxed);
+            if (segments[s].compare_exchange_strong(seg, fresh, std::memory_order_acq_rel))
+                seg = fresh;
+            else
+                delete[] fresh;
+        }
+        return seg[bucket - segment_base(s)];
+    }
+
+    // 从 start 开始查找：跳过并摘掉已经标记删除的节点，停在第一个排序键大于 so_key 的节点，
+    // 或者排序键相等且（普通节点时）键也相等的节点上。返回是否找到，prev 是 cur 的前驱
+    bool find(node* start, std::uint64_t so_key, Key const* key, node*& prev, node*& cur) const
+    {
+    retry:
+        prev = start;
+        cur = get_node(prev->next.load(std::memory_order_acquire));
+        while (cur)
+        {
+            std::uintptr_t const next = cur->next.load(std::memory_order_acquire);
+            if (is_marked(next))
+            {
+                std::uintptr_t expected = to_link(cur);
+                if (!prev->next.compare_exchange_strong(expected, next & ~std::uintptr_t(1),
+                                                        std::memory_order_acq_rel,
+                                                        std::memory_order_acquire))
+                    goto retry;
+                domain.retire(static_cast<regular_node*>(cur));
+                cur = get_node(next);
+                continue;
+            }
+            if (cur->so_key > so_key)
+                return false;
+            if (cur->so_key == so_key &&
+                (!key || static_cast<regular_node*>(cur)->key == *key))
+                return true;
+            prev = cur;
+            cur = get_node(next);
+        }
+        return false;
+    }
+
+    // 父桶是去掉最高位的桶，递归保证父桶先初始化
+    node* initialize_bucket(std::size_t bucket) const
+    {
+        std::size_t const parent = bucket & ~(std::size_t(1) << (segment_of(bucket) - 1));
+        node* const parent_head = get_bucket(parent);
+        node* const dummy = new node(dummy_key(bucket));
+        node* res;
+        node* prev;
+        node* cur;
+        while (true)
+        {
+            if (find(parent_head, dummy->so_key, nullptr, prev, cur))
+            {
+                // 别的线程已经插入了这个桶的哑节点
+                delete dummy;
+                res = cur;
+                break;
+            }
+            dummy->next.store(to_link(cur), std::memory_order_relaxed);
+            std::uintptr_t expected = to_link(cur);
+            if (prev->next.compare_exchange_strong(expected, to_link(dummy),
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed))
+            {
+                res = dummy;
+                break;
+            }
+        }
+        bucket_slot(bucket).store(res, std::memory_order_release);
+        return res;
+    }
+
+    node* get_bucket(std::size_t bucket) const
+    {
+        if (bucket == 0)
+            return &head;
+        node* const p = bucket_slot(bucket).load(std::memory_order_acquire);
+        return p ? p : initialize_bucket(bucket);
+    }
+
+    node* bucket_for(std::uint64_t hash) const
+    {
+        return get_bucket(hash & (bucket_size.load(std::memory_order_acquire) - 1));
+    }
+
+    void grow_if_needed(std::size_t new_count)
+    {
+        std::size_t size = bucket_size.load(std::memory_order_relaxed);
+        if (new_count / size > max_load && size < (std::size_t(1) << (max_segments - 2)))
+            bucket_size.compare_exchange_strong(size, size * 2, std::memory_order_release);
+    }
+
+    std::uint64_t hash_of(Key const& key) const
+    {
+        return static_cast<std::uint64_t>(hasher(key));
+    }
+
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef Hash hash_type;
+
+    // num_buckets 是初始桶数（向上取整为2的幂），元素增多时自动加倍
+    explicit lock_free_hash_map(unsigned num_buckets=16, Hash const& hasher_=Hash(),
+                                epoch_domain& domain_=epoch_domain::global()) :
+        bucket_size(1), count(0), head(0), hasher(hasher_), domain(domain_)
+    {
+        for (unsigned i = 0; i < max_segments; ++i)
+            segments[i].store(nullptr, std::memory_order_relaxed);
+        std::size_t size = 1;
+        while (size < num_buckets)
+            size *= 2;
+        bucket_size.store(size, std::memory_order_relaxed);
+    }
+
+    lock_free_hash_map(lock_free_hash_map const&)=delete;
+    lock_free_hash_map& operator=(lock_free_hash_map const&)=delete;
+
+    ~lock_free_hash_map()
+    {
+        // 析构时已没有并发访问，直接释放整条链表和桶数组
+        node* p = get_node(head.next.load(std::memory_order_relaxed));
+        while (p)
+        {
+            node* const next = get_node(p->next.load(std::memory_order_relaxed));
+            if (p->is_dummy())
+                delete p;
+            else
+                delete static_cast<regular_node*>(p);
+            p = next;
+        }
+        for (unsigned i = 0; i < max_segments; ++i)
+            delete[] segments[i].load(std::memory_order_relaxed);
+    }
+
+    Value value_for(Key const& key, Value const& default_value=Value()) const
+    {
+        epoch_guard guard(domain);
+        std::uint64_t const hash = hash_of(key);
+        node* prev;
+        node* cur;
+        if (!find(bucket_for(hash), regular_key(hash), &key, prev, cur))
+            return default_value;
+        return *static_cast<regular_node*>(cur)->value.load(std::memory_order_acquire);
+    }
+
+    void add_or_update_mapping(Key const& key, Value const& value)
+    {
+        epoch_guard guard(domain);
+        std::uint64_t const hash = hash_of(key);
+        std::uint64_t const so_key = regular_key(hash);
+        regular_node* new_node = nullptr;
+        node* prev;
+        node* cur;
+        while (true)
+        {
+            node* const start = bucket_for(hash);
+            if (find(start, so_key, &key, prev, cur))
+            {
+                regular_node* const found = static_cast<regular_node*>(cur);
+                Value* const old_value = found->value.exchange(new Value(value), std::memory_order_acq_rel);
+                domain.retire(old_value);
+                // 替换之后节点才被标记，说明更新发生在删除之前；否则节点已经被删除，重新插入
+                if (!is_marked(found->next.load(std::memory_order_acquire)))
+                    break;
+                continue;
+            }
+            if (!new_node)
+                new_node = new regular_node(so_key, key, new Value(value));
+            new_node->next.store(to_link(cur), std::memory_order_relaxed);
+            std::uintptr_t expected = to_link(cur);
+            if (prev->next.compare_exchange_strong(expected, to_link(new_node),
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed))
+            {
+                grow_if_needed(count.fetch_add(1, std::memory_order_relaxed) + 1);
+                return;
+            }
+        }
+        delete new_node;
+    }
+
+    void remove_mapping(Key const& key)
+    {
+        epoch_guard guard(domain);
+        std::uint64_t const hash = hash_of(key);
+        std::uint64_t const so_key = regular_key(hash);
+        node* const start = bucket_for(hash);
+        node* prev;
+        node* cur;
+        while (find(start, so_key, &key, prev, cur))
+        {
+            std::uintptr_t next = cur->next.load(std::memory_order_acquire);
+            if (is_marked(next))
+                continue;
+            if (!cur->next.compare_exchange_strong(next, next | 1,
+                                                   std::memory_order_acq_rel,
+                                                   std::memory_order_relaxed))
+                continue;
+            count.fetch_sub(1, std::memory_order_relaxed);
+            // 摘链失败时由 find 完成摘链和回收
+            std::uintptr_t expected = to_link(cur);
+            if (prev->next.compare_exchange_strong(expected, next,
+                                                   std::memory_order_acq_rel,
+                                                   std::memory_order_relaxed))
+                domain.retire(static_cast<regular_node*>(cur));
+            else
+                find(start, so_key, &key, prev, cur);
+            return;
+        }
+    }
+
+    std::size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    std::size_t bucket_count() const
+    {
+        return bucket_size.load(std::memory_order_relaxed);
+    }
+
+    // 沿着链表遍历所有未删除的元素；并发修改时不是一致的快照
+    template<typename Function>
+    void for_each(Function f) const
+    {
+        epoch_guard guard(domain);
+        node* p = get_node(head.next.load(std::memory_order_acquire));
+        while (p)
+        {
+            std::uintptr_t const next = p->next.load(std::memory_order_acquire);
+            if (!p->is_dummy() && !is_marked(next))
+            {
+                regular_node* const item = static_cast<regular_node*>(p);
+                f(item->key, static_cast<Value const&>(*item->value.load(std::memory_order_acquire)));
+            }
+            p = get_node(next);
+        }
+    }
+
+    std::map<Key, Value> get_map() const
+    {
+        std::map<Key, Value> res;
+        for_each([&res](Key const& key, Value const& value) {res.emplace(key, value);});
+        return res;
+    }
+};
+
+#endif //CPP_CONCURRENCY_LOCK_FREE_HASH_MAP_H
@@ -0,0 +1,151 @@
+//
+// Created by 13345 on 2024/4/24.
+// 无锁链表（Harris-Michael），接口与 threadsafe_list 相同
+// threadsafe_list 遍历时逐个节点加锁解锁，N 个节点要 2N 次原子操作，而且读者会被写者挡住。
+// 这里删除分两步：先 CAS 给节点的 next 指针打上标记（逻辑删除），再 CAS 前驱的 next 把它摘掉（物理删除）。
+// for_each 和 find_first_if 只读不写，跳过带标记的节点即可，遍历是无等待的；
+// 只有 push_front 和 remove_if 在修改的位置上做 CAS。摘下的节点交给 EBR，遍历中的读者不会访问到已释放的内存。
+//
+
+#ifndef CPP_CONCURRENCY_LOCK_FREE_LIST_H
+#define CPP_CONCURRENCY_LOCK_FREE_LIST_H
+
+#include "epoch_reclamation.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+template<typename T>
+class lock_free_list
+{
+private:
+    struct node
+    {
+        std::shared_ptr<T> const data;
+        // 最低位是删除标记
+        std::atomic<std::uintptr_t> next;
+        node() : next(0) {}
+        explicit node(T const& value) : data(std::make_shared<T>(value)), next(0) {}
+    };
+
+    node head;
+    epoch_domain& domain;
+
+    static bool is_marked(std::uintptr_t p)
+    {
+        return (p & 1) != 0;
+    }
+
+    static node* get_node(std::uintptr_t p)
+    {
+        return reinterpret_cast<node*>(p & ~std::uintptr_t(1));
+    }
+
+    static std::uintptr_t to_link(node* p)
+    {
+        return reinterpret_cast<std::uintptr_t>(p);
+    }
+
+    // 把已标记的 cur 从 prev 后面摘下，成功时由本线程回收
+    bool unlink(node* prev, node* cur, std::uintptr_t cur_next)
+    {
+        std::uintptr_t expected = to_link(cur);
+        if (!prev->next.compare_exchange_strong(expected, cur_next & ~std::uintptr_t(1),
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_relaxed))
+            return false;
+        domain.retire(cur);
+        return true;
+    }
+
+public:
+    explicit lock_free_list(epoch_domain& domain_=epoch_domain::global()) : domain(domain_) {}
+    ~lock_free_list()
+    {
+        // 析构时已没有并发访问，直接释放剩余节点
+        node* p = get_node(head.next.load(std::memory_order_relaxed));
+        while (p)
+        {
+            node* const next = get_node(p->next.load(std::memory_order_relaxed));
+            delete p;
+            p = next;
+        }
+    }
+    lock_free_list(lock_free_list const&)=delete;
+    lock_free_list& operator=(lock_free_list const&)=delete;
+
+    void push_front(T const& value)
+    {
+        node* const new_node = new node(value);
+        std::uintptr_t first = head.next.load(std::memory_order_relaxed);
+        do
+        {
+            new_node->next.store(first, std::memory_order_relaxed);
+        } while (!head.next.compare_exchange_weak(first, to_link(new_node),
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+    }
+
+    template<typename Function>
+    void for_each(Function f)
+    {
+        epoch_guard guard(domain);
+        node* current = get_node(head.next.load(std::memory_order_acquire));
+        while (current)
+        {
+            std::uintptr_t const next = current->next.load(std::memory_order_acquire);
+            if (!is_marked(next))
+                f(*current->data);
+            current = get_node(next);
+        }
+    }
+
+    template<typename Predicate>
+    std::shared_ptr<T> find_first_if(Predicate P)
+    {
+        epoch_guard guard(domain);
+        node* current = get_node(head.next.load(std::memory_order_acquire));
+        while (current)
+        {
+            std::uintptr_t const next = current->next.load(std::memory_order_acquire);
+            if (!is_marked(next) && P(*current->data))
+                return current->data;
+            current = get_node(next);
+        }
+        return std::shared_ptr<T>();
+    }
+
+    // 并发修改时摘链失败会从头重新扫描，因此 P 可能对同一个元素调用多次
+    template<typename Predicate>
+    void remove_if(Predicate P)
+    {
+        epoch_guard guard(domain);
+    retry:
+        node* prev = &head;
+        node* current = get_node(prev->next.load(std::memory_order_acquire));
+        while (current)
+        {
+            std::uintptr_t next = current->next.load(std::memory_order_acquire);
+            if (!is_marked(next))
+            {
+                if (!P(*current->data))
+                {
+                    prev = current;
+                    current = get_node(next);
+                    continue;
+                }
+                // 标记失败说明 next 变了（新的后继或者被别人标记），重新看一遍这个节点
+                if (!current->next.compare_exchange_strong(next, next | 1,
+                                                           std::memory_order_acq_rel,
+                                                           std::memory_order_acquire))
+                    continue;
+            }
+            if (!unlink(prev, current, next))
+                goto retry;
+            current = get_node(next);
+        }
+    }
+};
+
+#endif //CPP_CONCURRENCY_LOCK_FREE_LIST_H
@@ -5,11 +5,20 @@
 #ifndef CPP_CONCURRENCY_LOCK_FREE_STACK_H
 #define CPP_CONCURRENCY_LOCK_FREE_STACK_H
 
+#include "elimination_array.h"
+
 #include <atomic>
 #include <memory>
+#include <new>
+#include <utility>
+#include <iterator>
 #include <iostream>
 
-template<typename T>
+// UseElimination 为 true 时，CAS head 失败的操作先到消去数组中尝试与相反的操作配对，超时后再回到 head
+// 值直接存放在节点内部（不再使用 shared_ptr），因此可以存放 std::unique_ptr 这类只能移动的类型；
+// 引用计数归零的节点不释放，而是放进空闲链表，供后续的 push 复用。
+// push_range / pop_all 用于批量操作：先在私有链上准备好一串节点再用一次 CAS 发布，或用一次 exchange 取走整个栈。
+template<typename T, bool UseElimination=true>
 class lock_free_stack
 {
 private:
@@ -19,14 +28,27 @@ private:
         int external_count; // 外部计数器，用于管理对node的引用计数
         node* ptr; // 指向实际节点的指针
     };
+    // 空闲链表的栈顶，tag 每次修改加一，避免 ABA 问题
+    struct tagged_node_ptr
+    {
+        node* ptr;
+        unsigned long tag;
+    };
     struct node
     {
-        std::shared_ptr<T> data; // 节点数据，使用智能指针管理
+        alignas(T) unsigned char storage[sizeof(T)]; // 节点数据，直接存放在节点内
         std::atomic<int> internal_count; // 内部计数器，用于无锁操作中的安全删除
         counted_node_ptr next; // 指向下一个节点的指针，含外部计数
-        node(T const& data) : data(std::make_shared<T>(data)), internal_count(0) {}
+        std::atomic<node*> free_next; // 在空闲链表中时指向下一个空闲节点
+        node() : internal_count(0), free_next(nullptr) {}
+        T* value()
+        {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
     };
     std::atomic<counted_node_ptr> head; // 栈顶元素，使用原子操作保证线程安全
+    std::atomic<tagged_node_ptr> free_list; // 引用计数归零、等待复用的节点
+    elimination_array<node> elimination; // 消去数组，节点直接从 push 交给 pop
 
     void increase_head_count(counted_node_ptr& old_counter)
     {
@@ -40,27 +62,77 @@ private:
                                                std::memory_order_relaxed));
         old_counter.external_count = new_counter.external_count;
     }
-public:
-    ~lock_free_stack()
+
+    node* allocate_node()
     {
-        // 析构时清空栈
-        while (pop());
+        // 空闲节点不会被释放，读取 free_next 是安全的，tag 保证 CAS 不会被 ABA 欺骗
+        tagged_node_ptr old_top = free_list.load(std::memory_order_acquire);
+        while (old_top.ptr)
+        {
+            tagged_node_ptr const new_top = {old_top.ptr->free_next.load(std::memory_order_relaxed), old_top.tag + 1};
+            if (free_list.compare_exchange_weak(old_top, new_top,
+                                                std::memory_order_acquire,
+                                                std::memory_order_acquire))
+            {
+                old_top.ptr->internal_count.store(0, std::memory_order_relaxed);
+                return old_top.ptr;
+            }
+        }
+        return new node;
     }
-    void push(T const& data)
+
+    void recycle_node(node* n)
+    {
+        recycle_chain(n, n);
+    }
+
+    // 把已经通过 free_next 串好的一串节点 [first, last] 一次放回空闲链表
+    void recycle_chain(node* first, node* last)
+    {
+        tagged_node_ptr old_top = free_list.load(std::memory_order_relaxed);
+        tagged_node_ptr new_top;
+        do {
+            last->free_next.store(old_top.ptr, std::memory_order_relaxed);
+            new_top.ptr = first;
+            new_top.tag = old_top.tag + 1;
+        } while (!free_list.compare_exchange_weak(old_top, new_top,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+    }
+
+    template<typename ... Args>
+    void push_node(Args&& ... args)
     {
         // 向栈中推入一个元素
         counted_node_ptr new_node;
-        new_node.ptr = new node(data); // 创建新节点
+        new_node.ptr = allocate_node(); // 优先复用空闲节点
+        try
+        {
+            new (new_node.ptr->storage) T(std::forward<Args>(args)...); // 在节点内直接构造数据
+        }
+        catch (...)
+        {
+            recycle_node(new_node.ptr);
+            throw;
+        }
         new_node.external_count = 1; // 初始化外部计数器
         new_node.ptr->next = head.load(); // 设置新节点的下一个节点为当前头节点
         // 尝试将head指向新节点，直到成功
         while (!head.compare_exchange_weak(new_node.ptr->next, new_node,
                                            std::memory_order_release,
-                                           std::memory_order_relaxed));
+                                           std::memory_order_relaxed))
+        {
+            // 竞争失败时尝试与一个 pop 直接交换，节点没有发布到栈上，不需要计数
+            if (UseElimination && elimination.try_push(new_node.ptr))
+                return;
+        }
     }
-    std::shared_ptr<T> pop()
+
+    // 弹出栈顶元素并交给 consume 处理，数据必须在释放引用计数之前取走，
+    // 计数归零后节点可能立刻被其他线程复用
+    template<typename Consumer>
+    bool pop_node(Consumer consume)
     {
-        // 从栈中弹出一个元素
         counted_node_ptr old_head = head.load(std::memory_order_relaxed);
         for (;;)
         {
@@ -69,30 +141,290 @@ public:
             if (!ptr)
             {
                 // 如果头节点为空，返回空指针
-                return std::shared_ptr<T>();
+                return false;
             }
             if (head.compare_exchange_strong(old_head, ptr->next, std::memory_order_relaxed))
             {
                 // 尝试将头节点指向下一个节点
-                std::shared_ptr<T> res;
-                res.swap(ptr->data); // 获取数据
-                int const count_increase = old_head.external_count - 2;
-                if (ptr->internal_count.fetch_add(count_increase,
-                                                  std::memory_order_release) == -count_increase)
+                T* const value = ptr->value();
+                try
                 {
-                    // 如果内部计数器达到0，安全删除节点
-                    delete ptr;
+                    consume(*value); // 获取数据
                 }
-                return res; // 返回弹出的数据
+                catch (...)
+                {
+                    value->~T();
+                    release_popped_node(ptr, old_head.external_count);
+                    throw;
+                }
+                value->~T();
+                release_popped_node(ptr, old_head.external_count);
+                return true;
             }
             else if (ptr->internal_count.fetch_add(-1, std::memory_order_relaxed) == 1)
             {
-                // 如果减少内部计数器后达到0，安全删除节点
+                // 如果减少内部计数器后达到0，节点可以复用
                 ptr->internal_count.load(std::memory_order_acquire);
-                delete ptr;
+                recycle_node(ptr);
+            }
+            if (UseElimination)
+            {
+                // 竞争失败，先释放了对旧头节点的引用，再尝试从一个 push 那里直接拿到节点
+                if (node* const eliminated = elimination.try_pop())
+                {
+                    T* const value = eliminated->value();
+                    try
+                    {
+                        consume(*value);
+                    }
+                    catch (...)
+                    {
+                        value->~T();
+                        recycle_node(eliminated);
+                        throw;
+                    }
+                    value->~T();
+                    recycle_node(eliminated);
+                    return true;
+                }
+            }
+        }
+    }
+
+    void release_popped_node(node* ptr, int external_count)
+    {
+        int const count_increase = external_count - 2;
+        if (ptr->internal_count.fetch_add(count_increase,
+                                          std::memory_order_release) == -count_increase)
+        {
+            // 如果内部计数器达到0，节点可以复用
+            recycle_node(ptr);
+        }
+    }
+
+public:
+    // pop_all 取走的一批节点，按出栈顺序（后进先出）遍历，析构时销毁数据并回收节点
+    class batch
+    {
+        friend class lock_free_stack;
+        lock_free_stack* owner;
+        node* first;
+
+        batch(lock_free_stack* owner_, node* first_) : owner(owner_), first(first_) {}
+
+    public:
+        class iterator
+        {
+            node* current;
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef T value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef T* pointer;
+            typedef T& reference;
+
+            explicit iterator(node* current_=nullptr) : current(current_) {}
+            T& operator*() const
+            {
+                return *current->value();
+            }
+            T* operator->() const
+            {
+                return current->value();
+            }
+            iterator& operator++()
+            {
+                current = current->next.ptr;
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                iterator old(*this);
+                ++*this;
+                return old;
+            }
+            bool operator==(iterator const& other) const
+            {
+                return current == other.current;
+            }
+            bool operator!=(iterator const& other) const
+            {
+                return current != other.current;
             }
+        };
+
+        batch() : owner(nullptr), first(nullptr) {}
+        batch(batch&& other) noexcept : owner(other.owner), first(other.first)
+        {
+            other.first = nullptr;
+        }
+        batch& operator=(batch&& other) noexcept
+        {
+            if (this != &other)
+            {
+                clear();
+                owner = other.owner;
+                first = other.first;
+                other.first = nullptr;
+            }
+            return *this;
+        }
+        batch(batch const&)=delete;
+        batch& operator=(batch const&)=delete;
+        ~batch()
+        {
+            clear();
+        }
+
+        iterator begin() const
+        {
+            return iterator(first);
+        }
+        iterator end() const
+        {
+            return iterator();
+        }
+        bool empty() const
+        {
+            return first == nullptr;
+        }
+
+        void clear()
+        {
+            // batch 中的每个节点都可能曾经是栈顶，被其他线程增加过外部计数，这些线程的 CAS 会失败并减少内部计数，
+            // 所以每个节点都要像 pop 一样把外部计数转移到内部计数，内部计数归零才可以复用，否则由最后一个减少计数的线程回收。
+            // 第一个节点的外部计数在 pop_all 中已经转移，只需释放为 batch 保留的引用；
+            // 后面节点的外部计数记在前一个节点的 next 中，减去 push 时的初始计数 1（batch 自己没有增加过计数，不像 pop 那样减 2）
+            node* chain = nullptr;
+            node* chain_last = nullptr;
+            node* p = first;
+            int count_increase = -1;
+            while (p)
+            {
+                // 释放引用之后节点可能被复用，先读出 next
+                counted_node_ptr const next = p->next;
+                p->value()->~T();
+                if (p->internal_count.fetch_add(count_increase, std::memory_order_acq_rel) == -count_increase)
+                {
+                    p->free_next.store(chain, std::memory_order_relaxed);
+                    if (!chain_last)
+                        chain_last = p;
+                    chain = p;
+                }
+                count_increase = next.external_count - 1;
+                p = next.ptr;
+            }
+            if (chain)
+                owner->recycle_chain(chain, chain_last);
+            first = nullptr;
+        }
+    };
+
+    lock_free_stack()
+    {
+        counted_node_ptr const empty_head = {0, nullptr};
+        head.store(empty_head);
+        tagged_node_ptr const empty_free_list = {nullptr, 0};
+        free_list.store(empty_free_list);
+    }
+    lock_free_stack(lock_free_stack const&)=delete;
+    lock_free_stack& operator=(lock_free_stack const&)=delete;
+    ~lock_free_stack()
+    {
+        // 析构时清空栈，然后释放所有空闲节点
+        while (pop_node([](T&) {}));
+        node* p = free_list.load().ptr;
+        while (p)
+        {
+            node* const next = p->free_next.load(std::memory_order_relaxed);
+            delete p;
+            p = next;
         }
     }
+    void push(T const& data)
+    {
+        push_node(data);
+    }
+    void push(T&& data)
+    {
+        push_node(std::move(data));
+    }
+    template<typename ... Args>
+    void emplace(Args&& ... args)
+    {
+        push_node(std::forward<Args>(args)...);
+    }
+    bool try_pop(T& value)
+    {
+        return pop_node([&value](T& data) { value = std::move(data); });
+    }
+    std::shared_ptr<T> pop()
+    {
+        // 从栈中弹出一个元素
+        std::shared_ptr<T> res;
+        pop_node([&res](T& data) { res = std::make_shared<T>(std::move(data)); });
+        return res; // 返回弹出的数据
+    }
+
+    // 依次压入 [first, last)，相当于逐个 push，但只在 head 上做一次 CAS
+    template<typename Iterator>
+    void push_range(Iterator first, Iterator last)
+    {
+        if (first == last)
+            return;
+        // 先在私有链上构造所有节点，链头是最后一个元素
+        node* bottom = nullptr;
+        counted_node_ptr top = {1, nullptr};
+        try
+        {
+            for (; first != last; ++first)
+            {
+                node* const n = allocate_node();
+                try
+                {
+                    new (n->storage) T(*first);
+                }
+                catch (...)
+                {
+                    recycle_node(n);
+                    throw;
+                }
+                n->next = top;
+                top.ptr = n;
+                if (!bottom)
+                    bottom = n;
+            }
+        }
+        catch (...)
+        {
+            node* p = top.ptr;
+            while (p)
+            {
+                node* const next = p->next.ptr;
+                p->value()->~T();
+                recycle_node(p);
+                p = next;
+            }
+            throw;
+        }
+        bottom->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(bottom->next, top,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+    }
+
+    // 一次 exchange 取走整个栈
+    batch pop_all()
+    {
+        counted_node_ptr const empty_head = {0, nullptr};
+        counted_node_ptr const old_head = head.exchange(empty_head, std::memory_order_acquire);
+        if (!old_head.ptr)
+            return batch();
+        // 其他线程可能已经增加了旧头节点的外部计数，它们的 CAS 都会失败并减少内部计数；
+        // 把外部计数转移到内部计数时额外保留一个引用给 batch，由 batch 释放
+        old_head.ptr->internal_count.fetch_add(old_head.external_count, std::memory_order_acq_rel);
+        return batch(this, old_head.ptr);
+    }
 };
 
 
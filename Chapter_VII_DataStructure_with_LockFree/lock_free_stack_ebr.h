@@ -0,0 +1,76 @@
+//
+// Created by 13345 on 2024/4/6.
+// 使用纪元回收（EBR）的无锁栈，接口与 lock_free_stack 相同
+// 与分离引用计数的版本相比，pop 只需要一次 CAS，读取 head->next 时由 epoch_guard 保证节点不会被释放，
+// 节点在 EBR 的保护下不会被复用，因此也不存在 ABA 问题。
+//
+
+#ifndef CPP_CONCURRENCY_LOCK_FREE_STACK_EBR_H
+#define CPP_CONCURRENCY_LOCK_FREE_STACK_EBR_H
+
+#include "epoch_reclamation.h"
+
+#include <atomic>
+#include <memory>
+
+template<typename T>
+class lock_free_stack_ebr
+{
+private:
+    struct node
+    {
+        std::shared_ptr<T> data;
+        node* next;
+        node(T const& data_) : data(std::make_shared<T>(data_)), next(nullptr) {}
+    };
+    std::atomic<node*> head;
+    epoch_domain& domain;
+
+public:
+    explicit lock_free_stack_ebr(epoch_domain& domain_=epoch_domain::global()) : head(nullptr), domain(domain_) {}
+    lock_free_stack_ebr(lock_free_stack_ebr const&)=delete;
+    lock_free_stack_ebr& operator=(lock_free_stack_ebr const&)=delete;
+    ~lock_free_stack_ebr()
+    {
+        // 析构时已没有并发访问，直接释放剩余节点
+        node* p = head.load(std::memory_order_relaxed);
+        while (p)
+        {
+            node* const next = p->next;
+            delete p;
+            p = next;
+        }
+    }
+
+    void push(T const& data)
+    {
+        node* const new_node = new node(data);
+        new_node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(new_node->next, new_node,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+    }
+
+    std::shared_ptr<T> pop()
+    {
+        epoch_guard guard(domain);
+        node* old_head = head.load(std::memory_order_acquire);
+        // guard 期间 old_head 不会被释放，可以安全地读取 next
+        while (old_head && !head.compare_exchange_weak(old_head, old_head->next,
+                                                       std::memory_order_acquire,
+                                                       std::memory_order_acquire));
+        if (!old_head)
+            return std::shared_ptr<T>();
+        std::shared_ptr<T> res;
+        res.swap(old_head->data);
+        domain.retire(old_head);
+        return res;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_relaxed) == nullptr;
+    }
+};
+
+#endif //CPP_CONCURRENCY_LOCK_FREE_STACK_EBR_H
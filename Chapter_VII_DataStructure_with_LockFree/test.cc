@@ -3,9 +3,155 @@
 //
 
 #include "lock_free_stack.h"
+#include "lock_free_stack_ebr.h"
+#include "lock_free_hash_map.h"
+#include "lock_free_list.h"
+#include "lazy_skiplist_map.h"
 
+#include <atomic>
 #include <memory>
 #include <iostream>
+#include <thread>
+#include <vector>
+
+void test_lock_free_stack_ebr()
+{
+    lock_free_stack_ebr<int> st;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&st, t] {
+            for (int i = 0; i < 10000; ++i)
+            {
+                st.push(t * 10000 + i);
+                st.pop();
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    std::cout << "ebr stack empty: " << st.empty() << std::endl;
+}
+
+void test_lock_free_stack_move_only()
+{
+    lock_free_stack<std::unique_ptr<int>> st;
+    st.push(std::unique_ptr<int>(new int(1)));
+    st.emplace(new int(2));
+    std::unique_ptr<int> value;
+    while (st.try_pop(value))
+        std::cout << "move only value: " << *value << std::endl;
+}
+
+void test_lock_free_stack_batch()
+{
+    // push / push_range / try_pop / pop_all 并发执行，每个值都应该恰好被取出一次
+    lock_free_stack<int> st;
+    std::atomic<long long> pushed(0);
+    std::atomic<long long> popped(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&st, &pushed, &popped, t] {
+            for (int i = 0; i < 5000; ++i)
+            {
+                int const base = (t * 5000 + i) * 10;
+                std::vector<int> const items = {base + 1, base + 2, base + 3, base + 4};
+                st.push(base);
+                st.push_range(items.begin(), items.end());
+                pushed += 5 * base + 10;
+                int value = 0;
+                if (st.try_pop(value))
+                    popped += value;
+                if (i % 3 == t % 3)
+                {
+                    for (int item : st.pop_all())
+                        popped += item;
+                }
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    for (int item : st.pop_all())
+        popped += item;
+    std::cout << "stack batch pushed == popped: " << (pushed == popped) << std::endl;
+}
+
+void test_lock_free_hash_map()
+{
+    lock_free_hash_map<int, int> map;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&map, t] {
+            for (int i = 0; i < 10000; ++i)
+            {
+                int const key = t * 10000 + i;
+                map.add_or_update_mapping(key, key);
+                if (i % 2)
+                    map.remove_mapping(key);
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    std::cout << "hash map size: " << map.size() << ", buckets: " << map.bucket_count()
+              << ", value_for(2): " << map.value_for(2, -1) << ", value_for(3): " << map.value_for(3, -1) << std::endl;
+}
+
+void test_lock_free_list()
+{
+    lock_free_list<int> list;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&list, t] {
+            for (int i = 0; i < 1000; ++i)
+            {
+                int const value = t * 1000 + i;
+                list.push_front(value);
+                if (value % 2)
+                    list.remove_if([value](int const& item) {return item == value;});
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    int count = 0;
+    list.for_each([&count](int const&) {++count;});
+    std::shared_ptr<int> const found = list.find_first_if([](int const& item) {return item == 42;});
+    std::cout << "lock free list size: " << count << ", find 42: " << (found ? *found : -1) << std::endl;
+}
+
+void test_lazy_skiplist_map()
+{
+    lazy_skiplist_map<int, int> map;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&map, t] {
+            for (int i = 0; i < 1000; ++i)
+            {
+                int const key = i * 4 + t;
+                map.insert(key, key * 10);
+                if (key % 3 == 0)
+                    map.erase(key);
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    int sum = 0;
+    int scanned = 0;
+    map.range_scan(10, 20, [&sum, &scanned](int const& key, int const&) {sum += key; ++scanned;});
+    std::cout << "skiplist size: " << map.size() << ", keys in [10, 20): " << scanned << ", sum: " << sum << std::endl;
+    std::cout << "skiplist from 95:";
+    int shown = 0;
+    for (auto it = map.lower_bound(95); it != map.end() && shown < 5; ++it, ++shown)
+        std::cout << " " << it.key() << "=" << it.value();
+    std::cout << std::endl;
+}
 
 int main()
 {
@@ -23,5 +169,11 @@ int main()
     p = st.pop();
     std::cout << *p << std::endl;
 
+    test_lock_free_stack_ebr();
+    test_lock_free_stack_move_only();
+    test_lock_free_stack_batch();
+    test_lock_free_hash_map();
+    test_lock_free_list();
+    test_lazy_skiplist_map();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,913 @@
+//
+// Created by 13345 on 2024/4/12.
+// 基于锁的数据结构的性能测试
+// 用法：bench [max_keys]，默认 max_keys = 10000000
+//
+
+#include "threadsafe_lookup_table.h"
+#include "flat_lookup_table.h"
+#include "threadsafe_clock_cache.h"
+#include "threadsafe_list.h"
+#include "threadsafe_queue_complex.h"
+#include "flat_combining.h"
+#include "../Chapter_III_SharedData/stack_ts.h"
+#include "../Chapter_III_SharedData/spin_locks.h"
+#include "../Chapter_IV_Advanced_ThreadManage/thread_pool_stealing.h"
+#include "../Chapter_III_SharedData/distributed_shared_mutex.h"
+#include "../Chapter_III_SharedData/parking_mutex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <list>
+#include <queue>
+#include <mutex>
+#include <unordered_map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+typedef std::chrono::steady_clock bench_clock;
+
+std::size_t max_keys = 10000000;
+
+double percentile(std::vector<double>& samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    std::size_t const index = static_cast<std::size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// 统计本线程的硬件缓存未命中次数，内核不允许时返回 -1
+class cache_miss_counter
+{
+    int fd;
+public:
+    cache_miss_counter() : fd(-1)
+    {
+#if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~cache_miss_counter()
+    {
+#if defined(__linux__)
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+    void start()
+    {
+#if defined(__linux__)
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    long long stop()
+    {
+        long long count = -1;
+#if defined(__linux__)
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        }
+#endif
+        return count;
+    }
+};
+
+// 一个写线程把表从空插入到 limit 个键，一个读线程不断查询已插入的键；
+// 按插入进度的数量级（1k, 10k, ...）统计查询延迟，同时记录单次插入的最大延迟
+template<typename Table>
+void lookup_latency_while_growing(char const* name, Table& table, std::size_t limit)
+{
+    std::atomic<std::size_t> inserted(0);
+    std::atomic<bool> done(false);
+    std::vector<std::vector<double>> lookup_ns(16);
+    double max_insert_ns = 0;
+
+    std::thread reader([&] {
+        std::mt19937_64 rng(42);
+        while (!done.load(std::memory_order_relaxed))
+        {
+            std::size_t const n = inserted.load(std::memory_order_acquire);
+            if (n < 1000)
+                continue;
+            int const key = static_cast<int>(rng() % n);
+            auto const start = bench_clock::now();
+            int const value = table.value_for(key, -1);
+            double const ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+            if (value != key)
+                printf("lookup error: %d -> %d\n", key, value);
+            unsigned decade = 0;
+            for (std::size_t m = n; m >= 10; m /= 10)
+                ++decade;
+            lookup_ns[decade].push_back(ns);
+        }
+    });
+
+    for (std::size_t i = 0; i < limit; ++i)
+    {
+        auto const start = bench_clock::now();
+        table.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+        double const ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+        max_insert_ns = std::max(max_insert_ns, ns);
+        inserted.store(i + 1, std::memory_order_release);
+    }
+    done = true;
+    reader.join();
+
+    printf("%s: max single insert %.1f us\n", name, max_insert_ns / 1000);
+    printf("%12s %12s %12s %12s %12s\n", "keys", "lookups", "p50 ns", "p99 ns", "max ns");
+    std::size_t keys = 1;
+    for (unsigned decade = 0; decade < lookup_ns.size(); ++decade, keys *= 10)
+    {
+        std::vector<double>& samples = lookup_ns[decade];
+        if (samples.empty())
+            continue;
+        double const max_ns = *std::max_element(samples.begin(), samples.end());
+        std::size_t const count = samples.size();
+        double const p50 = percentile(samples, 0.5);
+        double const p99 = percentile(samples, 0.99);
+        printf("%12zu %12zu %12.0f %12.0f %12.0f\n", keys, count, p50, p99, max_ns);
+    }
+}
+
+void bench_lookup_table_growth()
+{
+    printf("== lookup latency while threadsafe_lookup_table grows to %zu keys\n", max_keys);
+    {
+        threadsafe_lookup_table<int, int> table;
+        lookup_latency_while_growing("online resizing", table, max_keys);
+    }
+    {
+        // 不扩容的表（原来的固定19个桶），键数多了之后每次查找都是长链表扫描，只测到10万
+        threadsafe_lookup_table<int, int> table(19, std::hash<int>(), std::numeric_limits<float>::max());
+        lookup_latency_while_growing("fixed 19 buckets", table, std::min<std::size_t>(max_keys, 100000));
+    }
+}
+
+// 随机查找已存在的键，返回每秒查找次数和每次查找的缓存未命中数
+template<typename Table>
+void lookup_throughput(char const* name, Table& table, std::size_t keys, std::size_t lookups)
+{
+    for (std::size_t i = 0; i < keys; ++i)
+        table.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+    std::vector<int> order(lookups);
+    std::mt19937_64 rng(7);
+    for (std::size_t i = 0; i < lookups; ++i)
+        order[i] = static_cast<int>(rng() % keys);
+    cache_miss_counter misses;
+    long long sum = 0;
+    misses.start();
+    auto const start = bench_clock::now();
+    for (std::size_t i = 0; i < lookups; ++i)
+        sum += table.value_for(order[i], -1);
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    long long const miss_count = misses.stop();
+    if (miss_count >= 0)
+        printf("%-10s %10zu keys %14.0f lookups/s %10.2f misses/lookup (checksum %lld)\n",
+               name, keys, lookups / seconds, static_cast<double>(miss_count) / lookups, sum);
+    else
+        printf("%-10s %10zu keys %14.0f lookups/s %10s misses/lookup (checksum %lld)\n",
+               name, keys, lookups / seconds, "n/a", sum);
+}
+
+void bench_bucket_layout()
+{
+    printf("== list buckets vs flat open addressing, single thread random lookups\n");
+    for (std::size_t keys = 1000; keys <= std::min<std::size_t>(max_keys, 1000000); keys *= 10)
+    {
+        {
+            threadsafe_lookup_table<int, int> table;
+            lookup_throughput("list", table, keys, 2000000);
+        }
+        {
+            threadsafe_flat_lookup_table<int, int> table;
+            lookup_throughput("flat", table, keys, 2000000);
+        }
+    }
+}
+
+std::vector<unsigned> thread_counts()
+{
+    unsigned const hardware_threads = std::thread::hardware_concurrency();
+    unsigned const max_threads = 2 * (hardware_threads != 0 ? hardware_threads : 2);
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n <= max_threads; n *= 2)
+        counts.push_back(n);
+    return counts;
+}
+
+// 每个线程执行 ops_per_thread 次操作，其中 write_percent% 是写操作，返回每秒操作数
+template<typename Table>
+double mixed_throughput(Table& table, std::size_t keys, unsigned num_threads,
+                        unsigned ops_per_thread, unsigned write_percent)
+{
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&table, &go, keys, ops_per_thread, write_percent, t] {
+            std::mt19937_64 rng(t + 1);
+            long long sum = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+            {
+                std::uint64_t const r = rng();
+                int const key = static_cast<int>(r % keys);
+                if ((r >> 40) % 100 < write_percent)
+                    table.add_or_update_mapping(key, key);
+                else
+                    sum += table.value_for(key, -1);
+            }
+            if (sum < 0)
+                printf("unexpected checksum\n");
+        });
+    }
+    auto const start = bench_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return num_threads * static_cast<double>(ops_per_thread) / seconds;
+}
+
+void bench_optimistic_reads()
+{
+    std::size_t const keys = 100000;
+    unsigned const ops = 1000000;
+    printf("== 99%% reads / 1%% writes on %zu keys, total ops/s\n", keys);
+    printf("%8s %16s %16s %16s\n", "threads", "list", "flat_locked", "flat_optimistic");
+    for (unsigned n : thread_counts())
+    {
+        threadsafe_lookup_table<int, int> list_table;
+        threadsafe_flat_lookup_table<int, int, std::hash<int>, false> locked_table;
+        threadsafe_flat_lookup_table<int, int, std::hash<int>, true> optimistic_table;
+        for (std::size_t i = 0; i < keys; ++i)
+        {
+            list_table.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+            locked_table.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+            optimistic_table.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+        }
+        double const list_ops = mixed_throughput(list_table, keys, n, ops, 1);
+        double const locked_ops = mixed_throughput(locked_table, keys, n, ops, 1);
+        double const optimistic_ops = mixed_throughput(optimistic_table, keys, n, ops, 1);
+        printf("%8u %16.0f %16.0f %16.0f\n", n, list_ops, locked_ops, optimistic_ops);
+    }
+}
+
+// 写线程不断更新已有的键，同时（可选地）用 for_each 把整张表导出一遍，统计写延迟
+void write_latency_during_dump(char const* name, std::size_t keys, bool dump)
+{
+    threadsafe_lookup_table<int, int> table;
+    for (std::size_t i = 0; i < keys; ++i)
+        table.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+    std::atomic<bool> done(false);
+    std::vector<double> write_ns;
+    std::thread writer([&] {
+        std::mt19937_64 rng(3);
+        while (!done.load(std::memory_order_relaxed))
+        {
+            int const key = static_cast<int>(rng() % keys);
+            auto const start = bench_clock::now();
+            table.add_or_update_mapping(key, key + 1);
+            write_ns.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - start).count());
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    double dump_ms = 0;
+    std::size_t dumped = 0;
+    if (dump)
+    {
+        auto const start = bench_clock::now();
+        table.for_each([&dumped](int const&, int const&) {++dumped;});
+        dump_ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+    }
+    else
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    done = true;
+    writer.join();
+    double const max_ns = write_ns.empty() ? 0 : *std::max_element(write_ns.begin(), write_ns.end());
+    double const p99 = percentile(write_ns, 0.99);
+    printf("%-10s %10zu keys dump %8.1f ms (%zu items) writes %10zu p99 %8.0f ns max %10.0f ns\n",
+           name, keys, dump_ms, dumped, write_ns.size(), p99, max_ns);
+}
+
+void bench_snapshot()
+{
+    printf("== writer latency while for_each dumps the table\n");
+    for (std::size_t keys = 10000; keys <= std::min<std::size_t>(max_keys, 1000000); keys *= 10)
+    {
+        write_latency_during_dump("no dump", keys, false);
+        write_latency_during_dump("for_each", keys, true);
+    }
+}
+
+// 多个线程给 hot_keys 个计数器加一：value_for + add_or_update_mapping（两次加锁，中间有竞争，会丢更新）对比 compute
+template<bool UseCompute>
+double counter_throughput(unsigned num_threads, int hot_keys, unsigned increments, long& lost)
+{
+    threadsafe_lookup_table<int, long> counters;
+    std::vector<std::thread> threads;
+    auto const start = bench_clock::now();
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&counters, hot_keys, increments, t] {
+            std::mt19937 rng(t + 1);
+            for (unsigned i = 0; i < increments; ++i)
+            {
+                int const key = static_cast<int>(rng() % hot_keys);
+                if (UseCompute)
+                    counters.compute(key, [](long& value) {++value;});
+                else
+                    counters.add_or_update_mapping(key, counters.value_for(key, 0) + 1);
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    long total = 0;
+    counters.for_each([&total](int const&, long const& value) {total += value;});
+    lost = static_cast<long>(num_threads) * increments - total;
+    return num_threads * static_cast<double>(increments) / seconds;
+}
+
+void bench_hot_counters()
+{
+    printf("== hot counters, increments/s (lost updates)\n");
+    printf("%8s %8s %24s %24s\n", "threads", "keys", "value_for+add_or_update", "compute");
+    for (int hot_keys : {16, 1024})
+    {
+        for (unsigned n : thread_counts())
+        {
+            long lost_read_write = 0, lost_compute = 0;
+            double const read_write = counter_throughput<false>(n, hot_keys, 500000, lost_read_write);
+            double const compute = counter_throughput<true>(n, hot_keys, 500000, lost_compute);
+            printf("%8u %8d %14.0f (%7ld) %14.0f (%7ld)\n",
+                   n, hot_keys, read_write, lost_read_write, compute, lost_compute);
+        }
+    }
+}
+
+// 每批查找 batch 个随机键：逐个 value_for 对比 multi_get，统计每批的延迟
+void bench_multi_get()
+{
+    std::size_t const keys = std::min<std::size_t>(max_keys, 1000000);
+    threadsafe_lookup_table<int, int> table;
+    for (std::size_t i = 0; i < keys; ++i)
+        table.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+    printf("== batch lookups on %zu keys, latency per batch\n", keys);
+    printf("%8s %14s %14s %14s %14s\n", "batch", "loop p50 ns", "loop p99 ns", "multi p50 ns", "multi p99 ns");
+    std::mt19937_64 rng(11);
+    for (std::size_t batch : {1, 10, 50, 100, 500, 1000})
+    {
+        std::size_t const rounds = 200000 / batch + 100;
+        std::vector<double> loop_ns, multi_ns;
+        std::vector<int> batch_keys(batch), out;
+        long long sum = 0;
+        for (std::size_t r = 0; r < rounds; ++r)
+        {
+            for (auto& key : batch_keys)
+                key = static_cast<int>(rng() % keys);
+            auto start = bench_clock::now();
+            for (auto key : batch_keys)
+                sum += table.value_for(key, -1);
+            loop_ns.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - start).count());
+
+            for (auto& key : batch_keys)
+                key = static_cast<int>(rng() % keys);
+            start = bench_clock::now();
+            table.multi_get(batch_keys, out, -1);
+            multi_ns.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - start).count());
+            sum += out[0];
+        }
+        double const loop_p50 = percentile(loop_ns, 0.5);
+        double const loop_p99 = percentile(loop_ns, 0.99);
+        double const multi_p50 = percentile(multi_ns, 0.5);
+        double const multi_p99 = percentile(multi_ns, 0.99);
+        printf("%8zu %14.0f %14.0f %14.0f %14.0f\n", batch, loop_p50, loop_p99, multi_p50, multi_p99);
+        if (sum < 0)
+            printf("unexpected checksum\n");
+    }
+}
+
+// 作为对照的全局锁 LRU：命中时要把元素移到链表头，所以每次访问都加排他锁
+template<typename Key, typename Value>
+class global_lock_lru
+{
+    typedef std::list<std::pair<Key, Value>> list_type;
+    list_type items;
+    std::unordered_map<Key, typename list_type::iterator> index;
+    std::size_t const capacity;
+    std::size_t evictions;
+    mutable std::mutex mutex;
+public:
+    explicit global_lock_lru(std::size_t capacity_) : capacity(capacity_), evictions(0) {}
+
+    bool try_get(Key const& key, Value& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it = index.find(key);
+        if (it == index.end())
+            return false;
+        items.splice(items.begin(), items, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void add_or_update_mapping(Key const& key, Value const& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it = index.find(key);
+        if (it != index.end())
+        {
+            it->second->second = value;
+            items.splice(items.begin(), items, it->second);
+            return;
+        }
+        items.emplace_front(key, value);
+        index.emplace(key, items.begin());
+        if (items.size() > capacity)
+        {
+            index.erase(items.back().first);
+            items.pop_back();
+            ++evictions;
+        }
+    }
+
+    std::size_t eviction_count() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return evictions;
+    }
+};
+
+// Zipf 分布的键：预先算好累积分布，按二分查找采样
+class zipf_generator
+{
+    std::vector<double> cdf;
+public:
+    zipf_generator(std::size_t n, double theta) : cdf(n)
+    {
+        double sum = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+            cdf[i] = sum;
+        }
+        for (auto& c : cdf)
+            c /= sum;
+    }
+
+    template<typename Rng>
+    int operator()(Rng& rng) const
+    {
+        double const u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return static_cast<int>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    }
+};
+
+// 每个线程按 Zipf 分布读，未命中时插入（模拟回源之后填充缓存），统计命中率、淘汰速度和读延迟
+template<typename Cache>
+void cache_workload(char const* name, Cache& cache, zipf_generator const& zipf,
+                    unsigned num_threads, unsigned ops_per_thread)
+{
+    std::atomic<bool> go(false);
+    std::atomic<long> hits(0);
+    std::vector<std::vector<double>> get_ns(num_threads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            long local_hits = 0;
+            get_ns[t].reserve(ops_per_thread / 16 + 1);
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+            {
+                int const key = zipf(rng);
+                int value;
+                // 每16次读取记录一次延迟，避免计时本身主导开销
+                bool const sample = i % 16 == 0;
+                auto const start = sample ? bench_clock::now() : bench_clock::time_point();
+                bool const hit = cache.try_get(key, value);
+                if (sample)
+                    get_ns[t].push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - start).count());
+                if (hit)
+                    ++local_hits;
+                else
+                    cache.add_or_update_mapping(key, key);
+            }
+            hits += local_hits;
+        });
+    }
+    auto const start = bench_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    std::vector<double> all_ns;
+    for (auto& v : get_ns)
+        all_ns.insert(all_ns.end(), v.begin(), v.end());
+    double const total_ops = static_cast<double>(num_threads) * ops_per_thread;
+    double const p99 = percentile(all_ns, 0.99);
+    printf("%-8s %8u %14.0f %10.2f%% %14.0f %10.0f\n", name, num_threads, total_ops / seconds,
+           100.0 * hits.load() / total_ops, cache.eviction_count() / seconds, p99);
+}
+
+void bench_cache()
+{
+    std::size_t const keys = 1000000;
+    std::size_t const capacity = 100000;
+    unsigned const ops = 1000000;
+    zipf_generator const zipf(keys, 0.99);
+    printf("== bounded cache, zipf(0.99) over %zu keys, capacity %zu\n", keys, capacity);
+    printf("%-8s %8s %14s %11s %14s %10s\n", "cache", "threads", "ops/s", "hit rate", "evictions/s", "p99 get ns");
+    for (unsigned n : thread_counts())
+    {
+        {
+            global_lock_lru<int, int> cache(capacity);
+            cache_workload("lru", cache, zipf, n, ops);
+        }
+        {
+            threadsafe_clock_cache<int, int> cache(capacity);
+            cache_workload("clock", cache, zipf, n, ops);
+        }
+    }
+}
+
+void bench_reader_lock()
+{
+    std::size_t const keys = 100000;
+    unsigned const ops = 2000000;
+    printf("== read-only lookups on %zu keys, stripe lock type, total ops/s\n", keys);
+    printf("%8s %16s %16s\n", "threads", "shared_mutex", "distributed");
+    for (unsigned n : thread_counts())
+    {
+        threadsafe_lookup_table<int, int> standard;
+        threadsafe_lookup_table<int, int, std::hash<int>, distributed_shared_mutex> distributed;
+        for (std::size_t i = 0; i < keys; ++i)
+        {
+            standard.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+            distributed.add_or_update_mapping(static_cast<int>(i), static_cast<int>(i));
+        }
+        double const standard_ops = mixed_throughput(standard, keys, n, ops, 0);
+        double const distributed_ops = mixed_throughput(distributed, keys, n, ops, 0);
+        printf("%8u %16.0f %16.0f\n", n, standard_ops, distributed_ops);
+    }
+}
+
+// 当前堆上已分配的字节数（含 malloc 的块头），不支持时返回 0
+std::size_t heap_in_use()
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// 每个线程反复 for_each 整个链表，write_percent% 的轮次改为 push_front 一个新值再 remove_if 删掉；返回每秒访问的元素数
+template<typename List>
+double list_traversal_throughput(List& list, unsigned num_threads, unsigned rounds, unsigned write_percent)
+{
+    std::atomic<bool> go(false);
+    std::atomic<long> visited(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&list, &go, &visited, rounds, write_percent, t] {
+            std::mt19937 rng(t + 1);
+            long count = 0;
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < rounds; ++i)
+            {
+                if (rng() % 100 < write_percent)
+                {
+                    int const value = -1 - static_cast<int>(t * rounds + i);
+                    list.push_front(value);
+                    list.remove_if([value](int const& item) {return item == value;});
+                }
+                else
+                {
+                    list.for_each([&count](int const&) {++count;});
+                }
+            }
+            visited.fetch_add(count);
+        });
+    }
+    auto const start = bench_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return static_cast<double>(visited.load()) / seconds;
+}
+
+template<typename List>
+void list_lock_workload(char const* name, int size, unsigned write_percent)
+{
+    std::size_t const before = heap_in_use();
+    List list;
+    for (int i = 0; i < size; ++i)
+        list.push_front(i);
+    double const bytes_per_element = static_cast<double>(heap_in_use() - before) / size;
+    printf("%-14s %10.1f", name, bytes_per_element);
+    for (unsigned n : thread_counts())
+        printf(" %14.0f", list_traversal_throughput(list, n, 200, write_percent));
+    printf("\n");
+}
+
+void bench_list_locks()
+{
+    int const size = 100000;
+    for (unsigned write_percent : {0u, 10u})
+    {
+        printf("== threadsafe_list<int> of %d elements, per-node lock type, %u%% push+remove rounds, "
+               "rest for_each; heap bytes/element and elements visited/s per thread count\n", size, write_percent);
+        printf("%-14s %10s", "lock", "bytes");
+        for (unsigned n : thread_counts())
+            printf(" %11u thr", n);
+        printf("\n");
+        list_lock_workload<threadsafe_list<int>>("std::mutex", size, write_percent);
+        list_lock_workload<threadsafe_list<int, parking_mutex>>("parking_mutex", size, write_percent);
+    }
+}
+
+// num_threads 个线程各执行 ops_per_thread 次 op(线程号, 第几次)，返回总的每秒操作数
+template<typename Op>
+double contention_throughput(unsigned num_threads, unsigned ops_per_thread, Op op)
+{
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&go, &op, ops_per_thread, t] {
+            while (!go.load())
+                std::this_thread::yield();
+            for (unsigned i = 0; i < ops_per_thread; ++i)
+                op(t, i);
+        });
+    }
+    auto const start = bench_clock::now();
+    go = true;
+    for (auto& th : threads)
+        th.join();
+    double const seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return num_threads * static_cast<double>(ops_per_thread) / seconds;
+}
+
+// 每个线程先 push 再 pop，栈里始终至少有一个元素
+template<typename Lock>
+struct stack_workload
+{
+    static double run(unsigned num_threads, unsigned ops)
+    {
+        threadsafe_stack<int, Lock> stack;
+        return contention_throughput(num_threads, ops, [&stack](unsigned, unsigned i) {
+            stack.push(static_cast<int>(i));
+            int value;
+            stack.pop(value);
+        });
+    }
+};
+
+template<typename Lock>
+struct queue_workload
+{
+    static double run(unsigned num_threads, unsigned ops)
+    {
+        threadsafe_queue<int, Lock> queue;
+        return contention_throughput(num_threads, ops, [&queue](unsigned, unsigned i) {
+            queue.push(static_cast<int>(i));
+            int value;
+            queue.try_pop(value);
+        });
+    }
+};
+
+// 16 个元素的链表，逐节点加锁：90% 按值查找，10% push_front 一个新值再删掉
+template<typename Lock>
+struct list_workload
+{
+    static double run(unsigned num_threads, unsigned ops)
+    {
+        threadsafe_list<int, Lock> list;
+        for (int i = 0; i < 16; ++i)
+            list.push_front(i);
+        return contention_throughput(num_threads, ops, [&list, ops](unsigned t, unsigned i) {
+            if (i % 10 == 0)
+            {
+                int const value = -1 - static_cast<int>(t * ops + i);
+                list.push_front(value);
+                list.remove_if([value](int const& item) {return item == value;});
+            }
+            else
+            {
+                int const value = static_cast<int>(i % 16);
+                list.find_first_if([value](int const& item) {return item == value;});
+            }
+        });
+    }
+};
+
+// 所有线程共用一个队列：放入一个任务，再交替从头部取出或从尾部窃取
+template<typename Lock>
+struct stealing_queue_workload
+{
+    static double run(unsigned num_threads, unsigned ops)
+    {
+        basic_work_stealing_queue<Lock> queue;
+        return contention_throughput(num_threads, ops, [&queue](unsigned, unsigned i) {
+            queue.push(function_wrapper([] {}));
+            function_wrapper task;
+            if (i % 2 ? queue.try_pop(task) : queue.try_steal(task))
+                task();
+        });
+    }
+};
+
+template<template<typename> class Workload>
+void lock_policy_table(char const* container, unsigned ops)
+{
+    printf("== %s, lock type x threads, total ops/s\n", container);
+    printf("%-14s", "lock");
+    for (unsigned n : thread_counts())
+        printf(" %11u thr", n);
+    printf("\n");
+    struct row
+    {
+        char const* name;
+        double (*run)(unsigned, unsigned);
+    };
+    row const rows[] = {
+        {"std::mutex", &Workload<std::mutex>::run},
+        {"parking_mutex", &Workload<parking_mutex>::run},
+        {"ttas_lock", &Workload<ttas_lock>::run},
+        {"ticket_lock", &Workload<ticket_lock>::run},
+        {"mcs_lock", &Workload<mcs_lock>::run},
+        {"adaptive_mutex", &Workload<adaptive_mutex>::run},
+    };
+    for (row const& r : rows)
+    {
+        printf("%-14s", r.name);
+        for (unsigned n : thread_counts())
+            printf(" %15.0f", r.run(n, ops));
+        printf("\n");
+    }
+}
+
+void bench_lock_policy()
+{
+    lock_policy_table<stack_workload>("threadsafe_stack push+pop", 200000);
+    lock_policy_table<queue_workload>("threadsafe_queue push+try_pop", 200000);
+    lock_policy_table<list_workload>("threadsafe_list of 16, 90% find", 50000);
+    lock_policy_table<stealing_queue_workload>("work_stealing_queue push+pop/steal", 200000);
+}
+
+// 对照组：一把互斥锁保护的 std::priority_queue
+class locked_priority_queue
+{
+private:
+    std::priority_queue<int> data;
+    std::mutex m;
+
+public:
+    void push(int value)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        data.push(value);
+    }
+
+    bool try_pop(int& value)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (data.empty())
+            return false;
+        value = data.top();
+        data.pop();
+        return true;
+    }
+};
+
+// 每个线程交替 push 和 try_pop，预先放入 1000 个元素
+template<typename Container>
+double push_pop_throughput(unsigned num_threads, unsigned ops)
+{
+    Container container;
+    for (int i = 0; i < 1000; ++i)
+        container.push(i);
+    return contention_throughput(num_threads, ops, [&container](unsigned t, unsigned i) {
+        if (i % 2)
+        {
+            int value;
+            container.try_pop(value);
+        }
+        else
+        {
+            container.push(static_cast<int>(t * 7919 + i) % 10000);
+        }
+    });
+}
+
+// 给 threadsafe_stack 加上 try_pop，使它与其他容器的测试代码一致
+class try_pop_stack : public threadsafe_stack<int>
+{
+public:
+    bool try_pop(int& value)
+    {
+        try
+        {
+            pop(value);
+            return true;
+        }
+        catch (empty_stack const&)
+        {
+            return false;
+        }
+    }
+};
+
+void bench_flat_combining()
+{
+    std::vector<unsigned> counts = thread_counts();
+    while (counts.back() < 16)
+        counts.push_back(counts.back() * 2);
+    unsigned const ops = 200000;
+    struct row
+    {
+        char const* container;
+        double (*locked)(unsigned, unsigned);
+        double (*combined)(unsigned, unsigned);
+    };
+    row const rows[] = {
+        {"stack", &push_pop_throughput<try_pop_stack>, &push_pop_throughput<flat_combining<std::stack<int>>>},
+        {"queue", &push_pop_throughput<threadsafe_queue<int>>, &push_pop_throughput<flat_combining<std::queue<int>>>},
+        {"priority_queue", &push_pop_throughput<locked_priority_queue>,
+         &push_pop_throughput<flat_combining<std::priority_queue<int>>>},
+    };
+    for (row const& r : rows)
+    {
+        printf("== %s, alternating push/try_pop, total ops/s\n", r.container);
+        printf("%8s %16s %16s\n", "threads", "mutex", "flat_combining");
+        for (unsigned n : counts)
+            printf("%8u %16.0f %16.0f\n", n, r.locked(n, ops), r.combined(n, ops));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        max_keys = std::strtoull(argv[1], nullptr, 10);
+    bench_lookup_table_growth();
+    bench_bucket_layout();
+    bench_optimistic_reads();
+    bench_snapshot();
+    bench_hot_counters();
+    bench_multi_get();
+    bench_cache();
+    bench_reader_lock();
+    bench_list_locks();
+    bench_lock_policy();
+    bench_flat_combining();
+    return 0;
+}
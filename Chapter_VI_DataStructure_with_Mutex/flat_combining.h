@@ -0,0 +1,318 @@
+//
+// Created by 13345 on 2024/5/2.
+// 平面合并（flat combining）：把 std::stack / std::queue / std::priority_queue 包装成线程安全的容器
+// 加一把互斥锁时，每个操作都要把锁和容器所在的缓存行从上一个持有者那里搬过来，竞争激烈时时间主要花在锁的交接上。
+// 这里每个线程把自己的操作写到一个发布记录（publication record）里，然后尝试成为合并者：
+// 合并者一次扫描所有记录，在顺序容器上依次执行所有待处理的操作并写回结果，容器一直留在合并者的缓存里；
+// 没有抢到合并者的线程只需等待自己的记录被标记为完成。
+// 记录按线程编号散列到固定数量的槽位上，槽位被占用时向后探测。
+//
+
+#ifndef CPP_CONCURRENCY_FLAT_COMBINING_H
+#define CPP_CONCURRENCY_FLAT_COMBINING_H
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <stack>
+#include <thread>
+#include <utility>
+
+#include "../Chapter_III_SharedData/cpu_relax.h"
+#include "../Chapter_III_SharedData/stack_ts.h"
+
+// 取出顺序容器的下一个元素：栈和优先队列取 top，队列取 front
+template<typename T, typename Sequence>
+T take_next(std::stack<T, Sequence>& c)
+{
+    T res(std::move(c.top()));
+    c.pop();
+    return res;
+}
+
+template<typename T, typename Sequence>
+T take_next(std::queue<T, Sequence>& c)
+{
+    T res(std::move(c.front()));
+    c.pop();
+    return res;
+}
+
+template<typename T, typename Sequence, typename Compare>
+T take_next(std::priority_queue<T, Sequence, Compare>& c)
+{
+    // priority_queue 的 top 是 const 的，只能复制
+    T res(c.top());
+    c.pop();
+    return res;
+}
+
+template<typename Container>
+class flat_combining
+{
+public:
+    typedef typename Container::value_type value_type;
+
+private:
+    typedef value_type T;
+
+    static unsigned const num_records = 64;
+    static unsigned const spin_count = 64;
+    // 合并者最多连续扫描几遍，扫描期间到达的新操作也能被顺便处理
+    static unsigned const max_passes = 4;
+
+    enum record_state
+    {
+        free_record,
+        claimed,
+        pending,
+        done
+    };
+
+    enum operation
+    {
+        push_operation,
+        pop_operation
+    };
+
+    struct alignas(64) record
+    {
+        std::atomic<int> state;
+        operation op;
+        // push 的参数，或者 pop 的结果
+        std::optional<T> value;
+        std::exception_ptr error;
+        record() : state(free_record), op(push_operation) {}
+    };
+
+    record records[num_records];
+    // 用到过的最大槽位编号 + 1，合并者只扫描这一段
+    std::atomic<unsigned> records_in_use;
+    std::atomic<bool> combining;
+    Container data;
+    // 只在合并者里读写，给 empty() 一个不加锁的近似值
+    std::atomic<bool> is_empty;
+
+    static unsigned thread_index()
+    {
+        static std::atomic<unsigned> next_index(0);
+        static thread_local unsigned const index = next_index.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    record& claim_record()
+    {
+        unsigned i = thread_index() % num_records;
+        unsigned spins = 0;
+        while (true)
+        {
+            int expected = free_record;
+            if (records[i].state.load(std::memory_order_relaxed) == free_record &&
+                records[i].state.compare_exchange_strong(expected, claimed, std::memory_order_acquire,
+                                                         std::memory_order_relaxed))
+            {
+                unsigned in_use = records_in_use.load(std::memory_order_relaxed);
+                while (in_use < i + 1 &&
+                       !records_in_use.compare_exchange_weak(in_use, i + 1, std::memory_order_relaxed));
+                return records[i];
+            }
+            i = (i + 1) % num_records;
+            if (++spins % num_records == 0)
+                std::this_thread::yield();
+        }
+    }
+
+    void apply(record& r)
+    {
+        try
+        {
+            if (r.op == push_operation)
+            {
+                data.push(std::move(*r.value));
+                r.value.reset();
+            }
+            else if (!data.empty())
+            {
+                r.value.emplace(take_next(data));
+            }
+        }
+        catch (...)
+        {
+            r.value.reset();
+            r.error = std::current_exception();
+        }
+    }
+
+    void combine()
+    {
+        for (unsigned pass = 0; pass < max_passes; ++pass)
+        {
+            bool found = false;
+            unsigned const in_use = records_in_use.load(std::memory_order_acquire);
+            for (unsigned i = 0; i < in_use; ++i)
+            {
+                record& r = records[i];
+                if (r.state.load(std::memory_order_acquire) != pending)
+                    continue;
+                apply(r);
+                r.state.store(done, std::memory_order_release);
+                found = true;
+            }
+            if (!found)
+                break;
+        }
+        is_empty.store(data.empty(), std::memory_order_relaxed);
+    }
+
+    bool try_begin_combining()
+    {
+        return !combining.load(std::memory_order_relaxed) && !combining.exchange(true, std::memory_order_acquire);
+    }
+
+    void end_combining()
+    {
+        combine();
+        combining.store(false, std::memory_order_release);
+    }
+
+    // 发布操作并等待完成，返回时记录已经完成，调用者负责读取结果并释放记录
+    void execute(record& r)
+    {
+        r.state.store(pending, std::memory_order_release);
+        unsigned spins = 0;
+        while (r.state.load(std::memory_order_acquire) != done)
+        {
+            if (try_begin_combining())
+            {
+                end_combining();
+                continue;
+            }
+            if (++spins < spin_count)
+                cpu_relax();
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    static void release(record& r)
+    {
+        r.value.reset();
+        std::exception_ptr const error = std::move(r.error);
+        r.error = nullptr;
+        r.state.store(free_record, std::memory_order_release);
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+public:
+    flat_combining() : records_in_use(0), combining(false), is_empty(true) {}
+    flat_combining(flat_combining const&)=delete;
+    flat_combining& operator=(flat_combining const&)=delete;
+
+    // 没有竞争时直接成为合并者，不必发布记录
+    void push(T new_value)
+    {
+        if (try_begin_combining())
+        {
+            try
+            {
+                data.push(std::move(new_value));
+            }
+            catch (...)
+            {
+                end_combining();
+                throw;
+            }
+            end_combining();
+            return;
+        }
+        record& r = claim_record();
+        r.op = push_operation;
+        r.value.emplace(std::move(new_value));
+        execute(r);
+        release(r);
+    }
+
+    bool try_pop(T& value)
+    {
+        if (try_begin_combining())
+        {
+            bool const found = !data.empty();
+            if (found)
+            {
+                try
+                {
+                    value = take_next(data);
+                }
+                catch (...)
+                {
+                    end_combining();
+                    throw;
+                }
+            }
+            end_combining();
+            return found;
+        }
+        record& r = claim_record();
+        r.op = pop_operation;
+        execute(r);
+        bool const found = r.value.has_value();
+        if (found)
+            value = std::move(*r.value);
+        release(r);
+        return found;
+    }
+
+    std::shared_ptr<T> try_pop()
+    {
+        if (try_begin_combining())
+        {
+            std::shared_ptr<T> res;
+            try
+            {
+                if (!data.empty())
+                    res = std::make_shared<T>(take_next(data));
+            }
+            catch (...)
+            {
+                end_combining();
+                throw;
+            }
+            end_combining();
+            return res;
+        }
+        record& r = claim_record();
+        r.op = pop_operation;
+        execute(r);
+        std::shared_ptr<T> res;
+        if (r.value)
+            res = std::make_shared<T>(std::move(*r.value));
+        release(r);
+        return res;
+    }
+
+    // 与 threadsafe_stack 相同：为空时抛出 empty_stack
+    void pop(T& value)
+    {
+        if (!try_pop(value))
+            throw empty_stack();
+    }
+
+    std::shared_ptr<T> pop()
+    {
+        std::shared_ptr<T> res = try_pop();
+        if (!res)
+            throw empty_stack();
+        return res;
+    }
+
+    // 最近一次合并之后的状态，并发时只是近似值
+    bool empty() const
+    {
+        return is_empty.load(std::memory_order_relaxed);
+    }
+};
+
+#endif //CPP_CONCURRENCY_FLAT_COMBINING_H
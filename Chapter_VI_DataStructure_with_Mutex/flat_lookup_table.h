@@ -0,0 +1,419 @@
+//
+// Created by 13345 on 2024/4/14.
+// 开放寻址的线程安全查找表，接口与 threadsafe_lookup_table 相同
+// threadsafe_lookup_table 的每个桶是一个 std::list，查找时要沿着堆上的节点逐个跳转。这里每个条带（一把锁）
+// 拥有一块连续的槽位数组，布局参考 SwissTable：
+// 1) 每个槽位对应一个控制字节：空 / 已删除 / 哈希值的低7位（h2）
+// 2) 控制字节按16个一组，用 SSE2 一次比较一组，只有 h2 相同的槽位才去比较保存的完整哈希值和键
+// 3) 组之间按二次探测跳转，组内出现空槽位说明键不存在
+// 槽位数组在 (元素数 + 墓碑数) 超过容量的 7/8 时重建（只影响一个条带）。
+// 读多写少时可以开启乐观读（OptimisticReads，键和值都可以按位复制时生效）：每个条带有一个顺序锁版本号，
+// 读者不加锁探测，前后版本号一致就直接返回，不向共享内存写任何东西；冲突多次后退回到共享锁。
+// 被替换的槽位数组通过 EBR 延迟释放，读者进出临界区只写自己线程的纪元公告。
+//
+
+#ifndef CPP_CONCURRENCY_FLAT_LOOKUP_TABLE_H
+#define CPP_CONCURRENCY_FLAT_LOOKUP_TABLE_H
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+#include <map>
+#include <new>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <atomic>
+
+#include "../Chapter_VII_DataStructure_with_LockFree/epoch_reclamation.h"
+#include "../Chapter_III_SharedData/cpu_relax.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace flat_table_detail
+{
+    typedef std::int8_t ctrl_t;
+    ctrl_t const ctrl_empty = -128;  // 0b10000000
+    ctrl_t const ctrl_deleted = -2;  // 0b11111110
+    unsigned const group_width = 16;
+
+    // 一组16个控制字节的匹配结果，每个槽位一位
+    inline unsigned match_byte(ctrl_t const* group, ctrl_t value)
+    {
+#if defined(__SSE2__)
+        __m128i const ctrl = _mm_load_si128(reinterpret_cast<__m128i const*>(group));
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value))));
+#else
+        unsigned mask = 0;
+        for (unsigned i = 0; i < group_width; ++i)
+            mask |= unsigned(group[i] == value) << i;
+        return mask;
+#endif
+    }
+
+    // 空槽位或墓碑（最高位为1）
+    inline unsigned match_empty_or_deleted(ctrl_t const* group)
+    {
+#if defined(__SSE2__)
+        __m128i const ctrl = _mm_load_si128(reinterpret_cast<__m128i const*>(group));
+        return static_cast<unsigned>(_mm_movemask_epi8(ctrl));
+#else
+        unsigned mask = 0;
+        for (unsigned i = 0; i < group_width; ++i)
+            mask |= unsigned(group[i] < 0) << i;
+        return mask;
+#endif
+    }
+
+    inline unsigned lowest_bit(unsigned mask)
+    {
+        return static_cast<unsigned>(__builtin_ctz(mask));
+    }
+}
+
+template<typename Key, typename Value, typename Hash=std::hash<Key>, bool OptimisticReads=true>
+class threadsafe_flat_lookup_table
+{
+private:
+    typedef flat_table_detail::ctrl_t ctrl_t;
+    typedef std::pair<Key, Value> bucket_value;
+
+    // 乐观读会在没有锁的情况下读取槽位，只对可以按位复制的键和值启用
+    static bool const optimistic = OptimisticReads &&
+            std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value;
+
+    // 一个条带的槽位数组。重建时整体替换，旧数组交给 EBR，等可能正在读它的乐观读者离开后再释放
+    struct slot_array
+    {
+        typedef typename std::aligned_storage<sizeof(bucket_value), alignof(bucket_value)>::type slot_storage;
+
+        struct ctrl_deleter
+        {
+            void operator()(ctrl_t* p) const
+            {
+                ::operator delete(p, std::align_val_t(flat_table_detail::group_width));
+            }
+        };
+
+        std::size_t const capacity;  // 槽位数，总是 group_width 的2的幂倍
+        std::unique_ptr<ctrl_t, ctrl_deleter> ctrl;
+        std::unique_ptr<std::size_t[]> hashes;  // 保存完整的哈希值，比较和重建时不用重新计算
+        std::unique_ptr<slot_storage[]> slots;
+
+        explicit slot_array(std::size_t capacity_) :
+            capacity(capacity_),
+            ctrl(static_cast<ctrl_t*>(::operator new(capacity_, std::align_val_t(flat_table_detail::group_width)))),
+            hashes(new std::size_t[capacity_]),
+            slots(new slot_storage[capacity_])
+        {
+            std::memset(ctrl.get(), static_cast<unsigned char>(flat_table_detail::ctrl_empty), capacity);
+        }
+
+        bucket_value* slot(std::size_t i) const
+        {
+            return std::launder(reinterpret_cast<bucket_value*>(&slots[i]));
+        }
+
+        static ctrl_t h2(std::size_t hash)
+        {
+            return static_cast<ctrl_t>(hash & 0x7f);
+        }
+
+        static std::size_t h1(std::size_t hash)
+        {
+            return hash >> 7;
+        }
+
+        // 按组做二次探测，找到键所在的槽位，不存在返回 capacity
+        // 探测最多经过所有组一次，乐观读读到不一致的数据时也一定会结束
+        std::size_t find_index(Key const& key, std::size_t hash) const
+        {
+            std::size_t const num_groups = capacity / flat_table_detail::group_width;
+            std::size_t group = h1(hash) & (num_groups - 1);
+            ctrl_t const tag = h2(hash);
+            for (std::size_t step = 1; step <= num_groups; ++step)
+            {
+                ctrl_t const* const group_ctrl = ctrl.get() + group * flat_table_detail::group_width;
+                for (unsigned mask = flat_table_detail::match_byte(group_ctrl, tag); mask; mask &= mask - 1)
+                {
+                    std::size_t const i = group * flat_table_detail::group_width + flat_table_detail::lowest_bit(mask);
+                    if (hashes[i] == hash && slot(i)->first == key)
+                        return i;
+                }
+                if (flat_table_detail::match_byte(group_ctrl, flat_table_detail::ctrl_empty))
+                    return capacity;
+                group = (group + step) & (num_groups - 1);
+            }
+            return capacity;
+        }
+
+        // 新键的插入位置：探测序列上第一个空槽位或墓碑
+        std::size_t find_insert_index(std::size_t hash) const
+        {
+            std::size_t const num_groups = capacity / flat_table_detail::group_width;
+            std::size_t group = h1(hash) & (num_groups - 1);
+            for (std::size_t step = 1; ; ++step)
+            {
+                ctrl_t const* const group_ctrl = ctrl.get() + group * flat_table_detail::group_width;
+                unsigned const mask = flat_table_detail::match_empty_or_deleted(group_ctrl);
+                if (mask)
+                    return group * flat_table_detail::group_width + flat_table_detail::lowest_bit(mask);
+                group = (group + step) & (num_groups - 1);
+            }
+        }
+
+        void destroy_all()
+        {
+            for (std::size_t i = 0; i < capacity; ++i)
+            {
+                if (ctrl.get()[i] >= 0)
+                    slot(i)->~bucket_value();
+            }
+        }
+    };
+
+    class alignas(64) stripe_type
+    {
+    private:
+        // 乐观读失败这么多次后退回到共享锁
+        static unsigned const max_optimistic_attempts = 4;
+
+        std::atomic<slot_array*> current;
+        // 顺序锁的版本号：写者修改期间为奇数，读者前后两次读到相同的偶数说明读到的数据是一致的
+        std::atomic<std::uint64_t> version;
+        std::size_t count;
+        std::size_t tombstones;
+        mutable std::shared_mutex mutex;
+
+        // 写者持有排他锁时调用
+        void begin_write()
+        {
+            if (optimistic)
+            {
+                version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+        }
+
+        void end_write()
+        {
+            if (optimistic)
+                version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        void rehash(std::size_t new_capacity)
+        {
+            slot_array* const old_array = current.load(std::memory_order_relaxed);
+            std::unique_ptr<slot_array> new_array(new slot_array(new_capacity));
+            for (std::size_t i = 0; i < old_array->capacity; ++i)
+            {
+                if (old_array->ctrl.get()[i] < 0)
+                    continue;
+                bucket_value* const old_value = old_array->slot(i);
+                std::size_t const hash = old_array->hashes[i];
+                std::size_t const j = new_array->find_insert_index(hash);
+                new (&new_array->slots[j]) bucket_value(std::move(*old_value));
+                old_value->~bucket_value();
+                new_array->ctrl.get()[j] = slot_array::h2(hash);
+                new_array->hashes[j] = hash;
+            }
+            // 旧数组中的元素已经全部移走并析构，释放旧数组时只释放内存
+            current.store(new_array.release(), std::memory_order_release);
+            tombstones = 0;
+            if (optimistic)
+                epoch_domain::global().retire(old_array);
+            else
+                delete old_array;
+        }
+
+        slot_array& reserve_one()
+        {
+            slot_array& array = *current.load(std::memory_order_relaxed);
+            if ((count + tombstones + 1) * 8 <= array.capacity * 7)
+                return array;
+            // 墓碑多时原地重建即可，否则容量加倍
+            rehash(count * 2 + 2 > array.capacity ? array.capacity * 2 : array.capacity);
+            return *current.load(std::memory_order_relaxed);
+        }
+
+        // 不加锁读取，成功时返回 true，found 表示键是否存在
+        bool try_optimistic_read(Key const& key, std::size_t hash, Value& value, bool& found) const
+        {
+            epoch_guard guard(epoch_domain::global());
+            for (unsigned attempt = 0; attempt < max_optimistic_attempts; ++attempt)
+            {
+                std::uint64_t const before = version.load(std::memory_order_acquire);
+                if (before & 1)
+                {
+                    cpu_relax();
+                    continue;
+                }
+                slot_array const* const array = current.load(std::memory_order_acquire);
+                std::size_t const i = array->find_index(key, hash);
+                found = i != array->capacity;
+                if (found)
+                    value = array->slot(i)->second;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (version.load(std::memory_order_relaxed) == before)
+                    return true;
+            }
+            return false;
+        }
+
+    public:
+        stripe_type() : current(new slot_array(flat_table_detail::group_width)), version(0), count(0), tombstones(0) {}
+        ~stripe_type()
+        {
+            slot_array* const array = current.load();
+            array->destroy_all();
+            delete array;
+        }
+
+        Value value_for(Key const& key, std::size_t hash, Value const& default_value) const
+        {
+            if constexpr (optimistic)
+            {
+                Value value{};
+                bool found;
+                if (try_optimistic_read(key, hash, value, found))
+                    return found ? value : default_value;
+            }
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            slot_array const& array = *current.load(std::memory_order_relaxed);
+            std::size_t const i = array.find_index(key, hash);
+            return i == array.capacity ? default_value : array.slot(i)->second;
+        }
+
+        void add_or_update_mapping(Key const& key, std::size_t hash, Value const& value)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            slot_array* array = current.load(std::memory_order_relaxed);
+            std::size_t const i = array->find_index(key, hash);
+            begin_write();
+            if (i != array->capacity)
+            {
+                array->slot(i)->second = value;
+                end_write();
+                return;
+            }
+            array = &reserve_one();
+            std::size_t const j = array->find_insert_index(hash);
+            new (&array->slots[j]) bucket_value(key, value);
+            if (array->ctrl.get()[j] == flat_table_detail::ctrl_deleted)
+                --tombstones;
+            array->hashes[j] = hash;
+            array->ctrl.get()[j] = slot_array::h2(hash);
+            ++count;
+            end_write();
+        }
+
+        void remove_mapping(Key const& key, std::size_t hash)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            slot_array& array = *current.load(std::memory_order_relaxed);
+            std::size_t const i = array.find_index(key, hash);
+            if (i == array.capacity)
+                return;
+            begin_write();
+            array.slot(i)->~bucket_value();
+            array.ctrl.get()[i] = flat_table_detail::ctrl_deleted;
+            ++tombstones;
+            --count;
+            end_write();
+        }
+
+        std::size_t size() const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return count;
+        }
+
+        void copy_to(std::map<Key, Value>& res) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            slot_array const& array = *current.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < array.capacity; ++i)
+            {
+                if (array.ctrl.get()[i] >= 0)
+                    res.insert(*array.slot(i));
+            }
+        }
+    };
+
+    std::vector<std::unique_ptr<stripe_type>> stripes;
+    Hash hasher;
+
+    // 条带选择用哈希值的高位，低位留给控制字节和组的选择
+    stripe_type& get_stripe(std::size_t hash) const
+    {
+        return *stripes[(hash >> 32 ^ hash >> 48) % stripes.size()];
+    }
+
+    std::size_t hash_of(Key const& key) const
+    {
+        // std::hash<int> 是恒等映射，混合一次让低7位和组下标都足够随机
+        std::size_t h = hasher(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef Hash hash_type;
+
+    threadsafe_flat_lookup_table(unsigned num_stripes=19, Hash const& hasher_=Hash()) :
+        stripes(num_stripes), hasher(hasher_)
+    {
+        for (unsigned i = 0; i < num_stripes; ++i)
+        {
+            stripes[i].reset(new stripe_type);
+        }
+    }
+
+    threadsafe_flat_lookup_table(threadsafe_flat_lookup_table const&)=delete;
+    threadsafe_flat_lookup_table& operator=(threadsafe_flat_lookup_table const&)=delete;
+
+    Value value_for(Key const& key, Value const& default_value=Value()) const
+    {
+        std::size_t const hash = hash_of(key);
+        return get_stripe(hash).value_for(key, hash, default_value);
+    }
+
+    void add_or_update_mapping(Key const& key, Value const& value)
+    {
+        std::size_t const hash = hash_of(key);
+        get_stripe(hash).add_or_update_mapping(key, hash, value);
+    }
+
+    void remove_mapping(Key const& key)
+    {
+        std::size_t const hash = hash_of(key);
+        get_stripe(hash).remove_mapping(key, hash);
+    }
+
+    std::size_t size() const
+    {
+        std::size_t res = 0;
+        for (unsigned i = 0; i < stripes.size(); ++i)
+            res += stripes[i]->size();
+        return res;
+    }
+
+    // 逐个条带复制，不同条带之间不保证是同一时刻的状态
+    std::map<Key, Value> get_map() const
+    {
+        std::map<Key, Value> res;
+        for (unsigned i = 0; i < stripes.size(); ++i)
+            stripes[i]->copy_to(res);
+        return res;
+    }
+};
+
+#endif //CPP_CONCURRENCY_FLAT_LOOKUP_TABLE_H
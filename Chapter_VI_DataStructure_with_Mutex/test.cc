@@ -4,11 +4,19 @@
 
 #include "threadsafe_queue_complex.h"
 #include "threadsafe_lookup_table.h"
+#include "flat_lookup_table.h"
 #include "threadsafe_list.h"
+#include "threadsafe_clock_cache.h"
+#include "flat_combining.h"
+#include "../Chapter_III_SharedData/parking_mutex.h"
 
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <utility>
@@ -37,6 +45,17 @@ void remove_data_for_list(std::shared_ptr<threadsafe_list<std::string>> list_ptr
                           std::vector<std::string> const& data);
 void foreach_data_for_list(std::shared_ptr<threadsafe_list<std::string>> list_ptr);
 
+void test_lookup_table_snapshot();
+void test_lookup_table_compute();
+void test_lookup_table_multi();
+void test_flat_lookup_table();
+void test_flat_lookup_table_optimistic();
+void test_clock_cache();
+void test_clock_cache_capacity();
+void test_clock_cache_exception();
+void test_list_parking_mutex();
+void test_flat_combining();
+
 
 
 
@@ -44,6 +63,16 @@ int main()
 {
     //test_threadsafe_lookup_table();
     test_threadsafe_list();
+    test_lookup_table_snapshot();
+    test_lookup_table_compute();
+    test_lookup_table_multi();
+    test_flat_lookup_table();
+    test_flat_lookup_table_optimistic();
+    test_clock_cache();
+    test_clock_cache_capacity();
+    test_clock_cache_exception();
+    test_list_parking_mutex();
+    test_flat_combining();
     return 0;
 }
 
@@ -185,4 +214,385 @@ void foreach_data_for_list(std::shared_ptr<threadsafe_list<std::string>> list_pt
         });
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
-}
\ No newline at end of file
+}
+
+// 一个线程按顺序插入 0, 1, 2, ...，一致的快照里出现的键必须正好是 0 到 n-1
+void test_lookup_table_snapshot()
+{
+    threadsafe_lookup_table<int, int> table;
+    int const total = 200000;
+    std::thread writer([&table] {
+        for (int i = 0; i < total; ++i)
+            table.add_or_update_mapping(i, i);
+    });
+    // 等写线程开始之后再遍历，遍历中途让出 CPU，让写操作落在遍历期间
+    while (table.value_for(0, -1) == -1)
+        std::this_thread::yield();
+    for (unsigned round = 0; round < 5; ++round)
+    {
+        std::vector<char> seen(total, 0);
+        std::size_t n = 0;
+        table.for_each([&](int const& key, int const&) {
+            seen[key] = 1;
+            if (++n % 1024 == 0)
+                std::this_thread::yield();
+        });
+        bool consistent = true;
+        for (std::size_t i = 0; i < seen.size(); ++i)
+        {
+            if (seen[i] != (i < n))
+                consistent = false;
+        }
+        printf("snapshot %u: %zu keys, %s\n", round, n, consistent ? "consistent" : "INCONSISTENT");
+    }
+    writer.join();
+    printf("final map size: %zu\n", table.get_map().size());
+}
+
+// 多个线程用 compute 给同一组计数器加一，最后总数不能丢
+void test_lookup_table_compute()
+{
+    threadsafe_lookup_table<std::string, long> counters;
+    unsigned const num_threads = 4;
+    int const increments = 100000;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&counters] {
+            for (int i = 0; i < increments; ++i)
+                counters.compute("key" + std::to_string(i % 10), [](long& value) {return ++value;});
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    long total = 0;
+    counters.for_each([&total](std::string const&, long const& value) {total += value;});
+    printf("compute: total %ld, expected %ld\n", total, static_cast<long>(num_threads) * increments);
+
+    threadsafe_lookup_table<int, std::vector<int>> lists;
+    bool const first = lists.try_emplace(1, 3, 7);
+    bool const second = lists.try_emplace(1, 5, 9);
+    printf("try_emplace: %d %d, value size %zu\n", first, second, lists.value_for(1).size());
+    printf("compute_if_absent: size %zu\n",
+           lists.compute_if_absent(2, [] {return std::vector<int>{1, 2};}).size());
+    lists.compute(1, [](std::vector<int>& v) {v.push_back(8);});
+    bool const erased_wrong = lists.erase_if(1, [](std::vector<int> const& v) {return v.size() == 3;});
+    bool const erased_right = lists.erase_if(1, [](std::vector<int> const& v) {return v.size() == 4;});
+    printf("erase_if: %d %d, size %zu\n", erased_wrong, erased_right, lists.size());
+}
+
+// 批量读写：键分布在所有条带上，同一批里有重复的键（写入以后面的为准）和不存在的键；
+// 再让4个线程同时对交错的键批量写入、读出，每个线程都应读到自己最后写入的值
+void test_lookup_table_multi()
+{
+    threadsafe_lookup_table<int, int> table;
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < 1000; ++i)
+        items.emplace_back(i, i);
+    for (int i = 0; i < 1000; i += 3)
+        items.emplace_back(i, -i);
+    table.multi_put(items);
+
+    std::vector<int> keys;
+    for (int i = 0; i < 1000; ++i)
+        keys.push_back(i);
+    keys.push_back(7);
+    keys.push_back(7);
+    keys.push_back(5000);
+    std::vector<int> values;
+    table.multi_get(keys, values, -1);
+    bool ok = table.size() == 1000 && values.size() == keys.size();
+    for (std::size_t i = 0; ok && i < 1000; ++i)
+        ok = values[i] == (i % 3 == 0 ? -static_cast<int>(i) : static_cast<int>(i));
+    ok = ok && values[1000] == 7 && values[1001] == 7 && values[1002] == -1;
+    printf("multi_get/multi_put: %s\n", ok ? "ok" : "MISMATCH");
+
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&table, &mismatches, t] {
+            std::vector<int> own_keys;
+            for (int i = t; i < 1000; i += 4)
+                own_keys.push_back(i);
+            for (int round = 0; round < 200; ++round)
+            {
+                std::vector<std::pair<int, int>> batch;
+                for (int key : own_keys)
+                    batch.emplace_back(key, round * 1000 + key);
+                table.multi_put(batch);
+                std::vector<int> got;
+                table.multi_get(own_keys, got, -1);
+                for (std::size_t i = 0; i < own_keys.size(); ++i)
+                {
+                    if (got[i] != round * 1000 + own_keys[i])
+                        ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    printf("concurrent multi_get/multi_put: %d mismatches, size %zu\n", mismatches.load(), table.size());
+}
+
+// 单条带的开放寻址表，初始16个槽位，(元素数 + 墓碑数) 超过14时重建：
+// 覆盖写入、删除后经过墓碑重新插入、插入到远超过初始容量，反复删除再插入让墓碑触发原地重建，最后每个键都要查得到
+void test_flat_lookup_table()
+{
+    threadsafe_flat_lookup_table<int, int> table(1);
+    table.add_or_update_mapping(1, 10);
+    table.add_or_update_mapping(1, 11);
+    bool ok = table.size() == 1 && table.value_for(1, -1) == 11;
+    table.remove_mapping(1);
+    ok = ok && table.size() == 0 && table.value_for(1, -1) == -1;
+    table.add_or_update_mapping(1, 12);
+    ok = ok && table.size() == 1 && table.value_for(1, -1) == 12;
+    printf("flat table overwrite, remove, reinsert: %s\n", ok ? "ok" : "MISMATCH");
+
+    table.remove_mapping(1);
+    int const total = 1000;
+    for (int i = 0; i < total; ++i)
+    {
+        table.add_or_update_mapping(i, i);
+        if (table.value_for(i, -1) != i || table.size() != static_cast<std::size_t>(i + 1))
+            ok = false;
+    }
+    for (int round = 1; round <= 10; ++round)
+    {
+        for (int i = round % 2; i < total; i += 2)
+            table.remove_mapping(i);
+        for (int i = round % 2; i < total; i += 2)
+            table.add_or_update_mapping(i, i + round * total);
+    }
+    std::size_t found = 0;
+    for (int i = 0; i < total; ++i)
+    {
+        int const expected = i + (i % 2 == 0 ? 10 : 9) * total;
+        if (table.value_for(i, -1) == expected)
+            ++found;
+    }
+    ok = ok && found == static_cast<std::size_t>(total) && table.size() == found && table.get_map().size() == found;
+    printf("flat table growth and tombstones: %zu of %d keys found, %s\n", found, total, ok ? "ok" : "MISMATCH");
+}
+
+// 乐观读测试用的值：每个字都由键和 round 算出，读到写了一半的值时各个字对不上。
+// 值比较大，读者复制它的时间长一些，单核上被抢占在复制中途的机会也多一些
+struct checked_value
+{
+    static int const width = 16;
+    std::uint64_t words[width];
+};
+
+checked_value make_checked_value(int key, std::uint64_t round)
+{
+    checked_value res;
+    res.words[0] = round;
+    for (int i = 1; i < checked_value::width; ++i)
+        res.words[i] = (static_cast<std::uint64_t>(key) * 0x9e3779b97f4a7c15ULL) ^ (round * 0xff51afd7ed558ccdULL) ^ i;
+    return res;
+}
+
+bool is_checked_value(int key, checked_value const& value)
+{
+    checked_value const expected = make_checked_value(key, value.words[0]);
+    return std::equal(value.words, value.words + checked_value::width, expected.words);
+}
+
+// 乐观读：一个写线程反复写入 (k, f(k, round))，其间删除一部分键再写回来，墓碑被复用、槽位数组被重建，
+// 读线程不加锁读到的每个值都要满足 f(k, round)，round 也不能倒退
+void test_flat_lookup_table_optimistic()
+{
+    threadsafe_flat_lookup_table<int, checked_value, std::hash<int>, true> table(4);
+    int const keys = 512;
+    std::uint64_t const rounds = 200;
+    std::atomic<bool> done(false);
+    std::atomic<int> violations(0);
+    std::atomic<long> checked(0);
+    std::thread writer([&] {
+        for (std::uint64_t round = 1; round <= rounds; ++round)
+        {
+            for (int k = 0; k < keys; ++k)
+                table.add_or_update_mapping(k, make_checked_value(k, round));
+            if (round % 10 == 0)
+            {
+                for (int k = 0; k < keys; k += 3)
+                    table.remove_mapping(k);
+            }
+        }
+        done = true;
+    });
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t)
+    {
+        readers.emplace_back([&] {
+            std::vector<std::uint64_t> last_round(keys, 0);
+            long n = 0;
+            while (!done)
+            {
+                for (int k = 0; k < keys; ++k)
+                {
+                    checked_value const value = table.value_for(k, make_checked_value(k, 0));
+                    // round 为 0 是键刚被删除时读到的默认值
+                    if (!is_checked_value(k, value) || (value.words[0] != 0 && value.words[0] < last_round[k]))
+                        ++violations;
+                    if (value.words[0] != 0)
+                        last_round[k] = value.words[0];
+                    ++n;
+                }
+            }
+            checked += n;
+        });
+    }
+    writer.join();
+    for (auto& th : readers)
+        th.join();
+    printf("optimistic flat table: %ld values checked, %d violations\n", checked.load(), violations.load());
+}
+
+// 容量为4的单条带缓存：反复访问的键有第二次机会，只访问过一次的键先被淘汰
+void test_clock_cache()
+{
+    threadsafe_clock_cache<int, std::string> cache(4, 1);
+    for (int i = 0; i < 4; ++i)
+        cache.add_or_update_mapping(i, std::to_string(i));
+    std::string value;
+    cache.try_get(0, value);
+    cache.try_get(1, value);
+    cache.add_or_update_mapping(4, "4");
+    cache.add_or_update_mapping(5, "5");
+    printf("clock cache: size %zu, evictions %zu, keys:", cache.size(), cache.eviction_count());
+    for (auto const& item : cache.get_map())
+        printf(" %d", item.first);
+    printf("\n");
+}
+
+// 默认条带数下容量上限也要成立：容量小于条带数、不能整除条带数时都不能超出
+void test_clock_cache_capacity()
+{
+    bool ok = true;
+    for (std::size_t capacity : {1u, 4u, 15u, 100u, 1000u})
+    {
+        threadsafe_clock_cache<int, int> cache(capacity);
+        for (int i = 0; i < 5000; ++i)
+        {
+            cache.add_or_update_mapping(i, i);
+            if (cache.size() > capacity)
+                ok = false;
+        }
+        printf("clock cache capacity %zu: size %zu\n", capacity, cache.size());
+    }
+    printf("clock cache size <= capacity: %s\n", ok ? "ok" : "EXCEEDED");
+}
+
+// 复制时可能抛出异常的值：淘汰时抛出异常，缓存里的每个键仍然能查到
+struct throwing_value
+{
+    static bool fail;
+    int v;
+    throwing_value(int v_=0) : v(v_) {}
+    throwing_value(throwing_value const& other) : v(other.v)
+    {
+        if (fail)
+            throw std::runtime_error("copy failed");
+    }
+    throwing_value& operator=(throwing_value const& other)=default;
+};
+bool throwing_value::fail = false;
+
+void test_clock_cache_exception()
+{
+    threadsafe_clock_cache<int, throwing_value> cache(4, 1);
+    for (int i = 0; i < 4; ++i)
+        cache.add_or_update_mapping(i, throwing_value(i));
+    throwing_value::fail = true;
+    bool thrown = false;
+    try
+    {
+        cache.add_or_update_mapping(100, throwing_value(100));
+    }
+    catch (std::runtime_error const&)
+    {
+        thrown = true;
+    }
+    throwing_value::fail = false;
+    bool consistent = cache.size() == 4;
+    for (int i = 0; i < 4; ++i)
+    {
+        throwing_value value;
+        if (!cache.try_get(i, value) || value.v != i)
+            consistent = false;
+    }
+    cache.add_or_update_mapping(200, throwing_value(200));
+    consistent = consistent && cache.size() == 4 && cache.value_for(200).v == 200;
+    printf("clock cache copy throws: %s, %s\n", thrown ? "thrown" : "NOT THROWN", consistent ? "consistent" : "INCONSISTENT");
+}
+
+// 节点锁换成 parking_mutex：4个线程同时插入、遍历、删除，最后只剩偶数
+void test_list_parking_mutex()
+{
+    threadsafe_list<int, parking_mutex> list;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&list, t] {
+            for (int i = 0; i < 500; ++i)
+            {
+                list.push_front(t * 500 + i);
+                long sum = 0;
+                list.for_each([&sum](int const& item) {sum += item;});
+            }
+            list.remove_if([](int const& item) {return item % 2 != 0;});
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    int count = 0;
+    list.for_each([&count](int const&) {++count;});
+    printf("list with parking_mutex: %d elements, sizeof(parking_mutex) = %zu\n", count, sizeof(parking_mutex));
+}
+
+// 4个线程各压入 1000 个数再弹出 1000 次，弹出的总和应等于压入的总和
+template<typename Container>
+long flat_combining_round_trip(flat_combining<Container>& fc)
+{
+    std::atomic<long> popped(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&fc, &popped, t] {
+            for (int i = 0; i < 1000; ++i)
+                fc.push(t * 1000 + i);
+            long sum = 0;
+            int value = 0;
+            for (int i = 0; i < 1000; ++i)
+            {
+                if (fc.try_pop(value))
+                    sum += value;
+            }
+            popped += sum;
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+    int value = 0;
+    while (fc.try_pop(value))
+        popped += value;
+    return popped;
+}
+
+void test_flat_combining()
+{
+    flat_combining<std::stack<int>> stack;
+    flat_combining<std::queue<int>> queue;
+    flat_combining<std::priority_queue<int>> priority_queue;
+    long const expected = 3999L * 4000 / 2;
+    long const stack_sum = flat_combining_round_trip(stack);
+    long const queue_sum = flat_combining_round_trip(queue);
+    long const priority_queue_sum = flat_combining_round_trip(priority_queue);
+    priority_queue.push(3);
+    priority_queue.push(7);
+    priority_queue.push(5);
+    printf("flat combining sums (expected %ld): stack %ld, queue %ld, priority_queue %ld, top %d\n",
+           expected, stack_sum, queue_sum, priority_queue_sum, *priority_queue.pop());
+}
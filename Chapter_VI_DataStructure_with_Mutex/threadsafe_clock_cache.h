@@ -0,0 +1,241 @@
+//
+// Created by 13345 on 2024/4/18.
+// 有容量上限的线程安全缓存：和 threadsafe_lookup_table 一样按哈希分成若干条带，每个条带各自用 CLOCK 算法淘汰。
+// LRU 每次命中都要把元素移到链表头，必须加排他锁；CLOCK 命中时只需要置位元素的访问位，
+// 因此命中只加共享锁，并且访问位已经置位时不写任何共享内存。
+// 插入时如果条带已满，时钟指针依次扫过各个元素：访问位为1的清零后跳过（给第二次机会），遇到为0的就淘汰。
+//
+
+#ifndef CPP_CONCURRENCY_THREADSAFE_CLOCK_CACHE_H
+#define CPP_CONCURRENCY_THREADSAFE_CLOCK_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+template<typename Key, typename Value, typename Hash=std::hash<Key>>
+class threadsafe_clock_cache
+{
+private:
+    class alignas(64) shard_type
+    {
+    private:
+        struct entry
+        {
+            Key key;
+            Value value;
+            std::atomic<bool> referenced;
+            entry(Key const& key_, Value const& value_) : key(key_), value(value_), referenced(false) {}
+        };
+
+        // 元素在 slots 中的位置不变，index 记录键到位置的映射
+        std::vector<std::unique_ptr<entry>> slots;
+        std::unordered_map<Key, std::size_t, Hash> index;
+        std::size_t const capacity;
+        std::size_t hand;
+        std::size_t evictions;
+        mutable std::shared_mutex mutex;
+
+        static void touch(entry& e)
+        {
+            // 先读再写：热点元素的访问位通常已经置位，这样命中时不会让缓存行在核之间来回失效
+            if (!e.referenced.load(std::memory_order_relaxed))
+                e.referenced.store(true, std::memory_order_relaxed);
+        }
+
+        // 转动时钟指针找到一个可以淘汰的位置（调用者持有排他锁，且条带已满）；
+        // 只选出位置，元素和它在 index 中的记录由调用者替换
+        std::size_t pick_victim()
+        {
+            while (true)
+            {
+                entry& e = *slots[hand];
+                std::size_t const victim = hand;
+                hand = (hand + 1) % slots.size();
+                if (e.referenced.load(std::memory_order_relaxed))
+                {
+                    e.referenced.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+                return victim;
+            }
+        }
+
+    public:
+        shard_type(std::size_t capacity_, Hash const& hasher) :
+            index(0, hasher), capacity(capacity_ == 0 ? 1 : capacity_), hand(0), evictions(0)
+        {
+            slots.reserve(capacity);
+        }
+
+        bool try_get(Key const& key, Value& value) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            auto const it = index.find(key);
+            if (it == index.end())
+                return false;
+            entry& e = *slots[it->second];
+            value = e.value;
+            touch(e);
+            return true;
+        }
+
+        void add_or_update_mapping(Key const& key, Value const& value)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            auto const it = index.find(key);
+            if (it != index.end())
+            {
+                entry& e = *slots[it->second];
+                e.value = value;
+                touch(e);
+                return;
+            }
+            // 新元素的访问位为0：只被访问一次的元素会在时钟指针下一次经过时被淘汰
+            if (slots.size() < capacity)
+            {
+                slots.emplace_back(new entry(key, value));
+                index.emplace(key, slots.size() - 1);
+                return;
+            }
+            // 先构造新元素、登记新键，可能抛出异常的操作都完成之后才移除旧键、替换元素，
+            // 中途抛出异常时条带保持原样，不会留下 index 中找不到的元素
+            std::unique_ptr<entry> fresh(new entry(key, value));
+            std::size_t const victim = pick_victim();
+            index.emplace(key, victim);
+            index.erase(slots[victim]->key);
+            slots[victim].swap(fresh);
+            ++evictions;
+        }
+
+        bool remove_mapping(Key const& key)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            auto const it = index.find(key);
+            if (it == index.end())
+                return false;
+            // 把最后一个元素搬到空出来的位置，保持 slots 紧凑
+            std::size_t const pos = it->second;
+            index.erase(it);
+            if (pos != slots.size() - 1)
+            {
+                slots[pos].swap(slots.back());
+                index[slots[pos]->key] = pos;
+            }
+            slots.pop_back();
+            if (hand >= slots.size())
+                hand = 0;
+            return true;
+        }
+
+        std::size_t size() const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return slots.size();
+        }
+
+        std::size_t eviction_count() const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return evictions;
+        }
+
+        void copy_to(std::map<Key, Value>& res) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            for (auto const& e : slots)
+                res.emplace(e->key, e->value);
+        }
+    };
+
+    std::vector<std::unique_ptr<shard_type>> shards;
+    Hash hasher;
+
+    static std::size_t shard_count(std::size_t capacity, unsigned num_shards)
+    {
+        std::size_t const n = num_shards == 0 ? 1 : num_shards;
+        return capacity == 0 ? 1 : (capacity < n ? capacity : n);
+    }
+
+    shard_type& get_shard(Key const& key) const
+    {
+        return *shards[hasher(key) % shards.size()];
+    }
+
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef Hash hash_type;
+
+    // capacity 是整个缓存的容量上限（至少为1），分给 num_shards 个条带：前 capacity % num_shards 个条带多分一个，
+    // 各条带的容量之和正好是 capacity；capacity 小于 num_shards 时只用 capacity 个条带，每个条带至少能放一个元素
+    explicit threadsafe_clock_cache(std::size_t capacity, unsigned num_shards=16, Hash const& hasher_=Hash()) :
+        shards(shard_count(capacity, num_shards)), hasher(hasher_)
+    {
+        std::size_t const total = capacity == 0 ? 1 : capacity;
+        for (unsigned i = 0; i < shards.size(); ++i)
+        {
+            std::size_t const per_shard = total / shards.size() + (i < total % shards.size() ? 1 : 0);
+            shards[i].reset(new shard_type(per_shard, hasher_));
+        }
+    }
+
+    threadsafe_clock_cache(threadsafe_clock_cache const&)=delete;
+    threadsafe_clock_cache& operator=(threadsafe_clock_cache const&)=delete;
+
+    // 命中时返回 true 并把值写到 value，只加共享锁
+    bool try_get(Key const& key, Value& value) const
+    {
+        return get_shard(key).try_get(key, value);
+    }
+
+    Value value_for(Key const& key, Value const& default_value=Value()) const
+    {
+        Value res;
+        return try_get(key, res) ? res : default_value;
+    }
+
+    // 条带已满时按 CLOCK 淘汰一个元素
+    void add_or_update_mapping(Key const& key, Value const& value)
+    {
+        get_shard(key).add_or_update_mapping(key, value);
+    }
+
+    bool remove_mapping(Key const& key)
+    {
+        return get_shard(key).remove_mapping(key);
+    }
+
+    std::size_t size() const
+    {
+        std::size_t res = 0;
+        for (unsigned i = 0; i < shards.size(); ++i)
+            res += shards[i]->size();
+        return res;
+    }
+
+    std::size_t eviction_count() const
+    {
+        std::size_t res = 0;
+        for (unsigned i = 0; i < shards.size(); ++i)
+            res += shards[i]->eviction_count();
+        return res;
+    }
+
+    // 逐个条带复制，不是整张表的一致快照
+    std::map<Key, Value> get_map() const
+    {
+        std::map<Key, Value> res;
+        for (unsigned i = 0; i < shards.size(); ++i)
+            shards[i]->copy_to(res);
+        return res;
+    }
+};
+
+#endif //CPP_CONCURRENCY_THREADSAFE_CLOCK_CACHE_H
@@ -10,12 +10,13 @@
 #include <memory>
 #include <list>
 
-template<typename T>
+// Mutex 是每个节点上的锁，节点多、元素小时可以换成只占一个字节的 parking_mutex
+template<typename T, typename Mutex=std::mutex>
 class threadsafe_list
 {
     struct node
     {
-        std::mutex m;
+        Mutex m;
         std::shared_ptr<T> data;
         std::unique_ptr<node> next;
         node() : next() {}
@@ -27,14 +28,14 @@ public:
     threadsafe_list() {}
     ~threadsafe_list()
     {
-        remove_if([](node const&) {return true;});
+        remove_if([](T const&) {return true;});
     }
     threadsafe_list(threadsafe_list const&)=delete;
     threadsafe_list& operator=(threadsafe_list const&)=delete;
     void push_front(T const& value)
     {
         std::unique_ptr<node> new_node(new node(value));
-        std::lock_guard<std::mutex> lk(head.m);
+        std::lock_guard<Mutex> lk(head.m);
         new_node->next = std::move(head.next);
         head.next = std::move(new_node);
     }
@@ -43,10 +44,10 @@ public:
     void for_each(Function f)
     {
         node* current = &head;
-        std::unique_lock<std::mutex> lk(head.m);
+        std::unique_lock<Mutex> lk(head.m);
         while (node* const next = current->next.get())
         {
-            std::unique_lock<std::mutex> next_lk(next->m);
+            std::unique_lock<Mutex> next_lk(next->m);
             lk.unlock();
             f(*next->data);
             current = next;
@@ -58,10 +59,10 @@ public:
     std::shared_ptr<T> find_first_if(Predicate P)
     {
         node* current = &head;
-        std::unique_lock<std::mutex> lk(head.m);
+        std::unique_lock<Mutex> lk(head.m);
         while (node* const next = current->next.get())
         {
-            std::unique_lock<std::mutex> next_lk(next->m);
+            std::unique_lock<Mutex> next_lk(next->m);
             lk.unlock();
             if (P(*next->data))
             {
@@ -77,10 +78,10 @@ public:
     void remove_if(Predicate P)
     {
         node* current = &head;
-        std::unique_lock<std::mutex> lk(head.m);
+        std::unique_lock<Mutex> lk(head.m);
         while (node* const next = current->next.get())
         {
-            std::unique_lock<std::mutex> next_lk(next->m);
+            std::unique_lock<Mutex> next_lk(next->m);
             if (P(*next->data))
             {
                 std::unique_ptr<node> old_next = std::move(current->next);
@@ -1,6 +1,16 @@
 //
 // Created by 13345 on 2023/7/22.
 // 代码清单6.11 线程安全的查找表
+// 在清单6.11的基础上支持在线扩容：
+// 锁的数量（条带数）在构造时确定，每个条带拥有自己的桶数组，负载因子超过阈值时只把这个条带的桶数组加倍。
+// 旧桶中的元素不会一次性搬完，而是由之后访问这个条带的写操作（以及碰到迁移中条带的读操作）每次搬几个桶，
+// 用 std::list::splice 移动节点，不需要重新分配内存，因此不会出现整表停顿的 rehash。
+// 桶数组按段分配：加倍时新数组在锁外分配好再换进来，迁移完的旧桶按段在锁外释放，持有锁时不做和条带大小成正比的工作。
+// for_each 逐个条带遍历，得到的是某一时刻的一致视图，同时不会停住整张表：
+// 遍历开始时发布一个快照编号，每个桶记录它的内容已经交给了哪次快照。写操作修改一个还没交出去的桶之前，
+// 先把这个桶（而不是整个条带）的旧内容复制一份留给遍历者（写时复制）；遍历者每次加共享锁复制一小段桶，放锁后在锁外执行回调。
+// 条带被遍历完之前不迁移、不扩容，桶的布局保持不变，遍历者可以用下标记住遍历到的位置。
+// 条带的读写锁类型可以通过模板参数 SharedMutex 替换，例如读多写少时使用 distributed_shared_mutex。
 //
 
 #ifndef CPP_CONCURRENCY_THREADSAFE_LOOKUP_TABLE_H
@@ -10,12 +20,23 @@
 #include <mutex>
 #include <shared_mutex>
 #include <utility>
+#include <tuple>
+#include <iterator>
 #include <list>
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 
-template<typename Key, typename Value, typename Hash=std::hash<Key>>
+inline void prefetch(void const* address)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#endif
+}
+
+template<typename Key, typename Value, typename Hash=std::hash<Key>, typename SharedMutex=std::shared_mutex>
 class threadsafe_lookup_table
 {
 private:
@@ -24,59 +45,551 @@ private:
     private:
         typedef std::pair<Key, Value> bucket_value;
         typedef std::list<bucket_value> bucket_data;
+    public:
+        typedef std::vector<bucket_value> snapshot_data;
+    private:
         // 这里的 typename 让编译器知道 iterator 是一种类型，而不是 bucket_data 的静态成员。
         typedef typename bucket_data::iterator bucket_iterator;
 
+        // 每次写操作顺带迁移的旧桶数量
+        static unsigned const migrate_batch = 2;
+
+        // 遍历者每次持有共享锁复制的桶数
+        static std::size_t const snapshot_chunk = 256;
+
+        // 桶数组的一段，最多 segment_size 个桶；tags[i] 是第 i 个桶的内容已经交给的快照编号
+        static constexpr std::size_t segment_bits = 10;
+        static constexpr std::size_t segment_size = std::size_t(1) << segment_bits;
+        struct segment
+        {
+            std::unique_ptr<bucket_data[]> lists;
+            std::unique_ptr<std::uint64_t[]> tags;
+        };
+
+        class bucket_array
+        {
+        private:
+            std::vector<segment> segments;
+            std::size_t count;
+            // [0, released) 的段已经释放
+            std::size_t released;
+
+        public:
+            bucket_array() : count(0), released(0) {}
+            explicit bucket_array(std::size_t n) : segments((n + segment_size - 1) >> segment_bits), count(n), released(0)
+            {
+                for (std::size_t i = 0; i < segments.size(); ++i)
+                {
+                    std::size_t const length = std::min(segment_size, n - (i << segment_bits));
+                    segments[i].lists.reset(new bucket_data[length]);
+                    segments[i].tags.reset(new std::uint64_t[length]());
+                }
+            }
+
+            std::size_t size() const
+            {
+                return count;
+            }
+
+            bool empty() const
+            {
+                return count == 0;
+            }
+
+            bucket_data& operator[](std::size_t i) const
+            {
+                return segments[i >> segment_bits].lists[i & (segment_size - 1)];
+            }
+
+            std::uint64_t& tag(std::size_t i) const
+            {
+                return segments[i >> segment_bits].tags[i & (segment_size - 1)];
+            }
+
+            void swap(bucket_array& other) noexcept
+            {
+                segments.swap(other.segments);
+                std::swap(count, other.count);
+                std::swap(released, other.released);
+            }
+
+            // 把 [0, pos) 中完整的段移到 retired，这些桶都已经迁移完、是空的；pos 等于 size() 时全部移走
+            void release_before(std::size_t pos, std::vector<segment>& retired)
+            {
+                std::size_t const end = pos == count ? segments.size() : (pos >> segment_bits);
+                for (; released < end; ++released)
+                    retired.push_back(std::move(segments[released]));
+            }
+        };
+
+        // 写操作在锁外要做的事：释放迁移完的旧桶段、需要时扩容。在加锁之前构造，析构时锁已经释放
+        class unlocked_work
+        {
+        private:
+            bucket_type& owner;
+        public:
+            Hash const& hasher;
+            std::size_t const stripes;
+            std::vector<segment> retired;
+            bool grow;
+
+            unlocked_work(bucket_type& owner_, Hash const& hasher_, std::size_t stripes_) :
+                owner(owner_), hasher(hasher_), stripes(stripes_), grow(false) {}
+            unlocked_work(unlocked_work const&)=delete;
+            unlocked_work& operator=(unlocked_work const&)=delete;
+
+            ~unlocked_work()
+            {
+                retired.clear();
+                if (grow)
+                {
+                    try
+                    {
+                        owner.grow();
+                    }
+                    catch (...)
+                    {
+                        // 分配失败时不扩容，表仍然正确，只是链表变长
+                    }
+                }
+            }
+        };
+
+        // 一个条带内的桶数组，数量总是2的幂；old_data 非空时表示正在迁移，[0, migrate_pos) 的旧桶已经搬完
         // find_entry_for这个函数不知道在哪个地方会修改data，所以这里要声明为mutable（因为find_entry_for是const的）
-        mutable bucket_data data;
-        mutable std::shared_mutex mutex;
+        mutable bucket_array data;
+        mutable bucket_array old_data;
+        std::size_t migrate_pos;
+        std::size_t count;
+        float const max_load_factor;
+        mutable SharedMutex mutex;
+        // 正在进行的快照编号（0 表示没有），由整张表共享
+        std::atomic<std::uint64_t> const& active_snapshot;
+        // 已经遍历完本条带的最近一次快照编号；saved 是写操作为正在进行的快照保留的旧桶内容
+        std::uint64_t captured_snapshot;
+        snapshot_data saved;
+
+        bool migrating() const
+        {
+            return !old_data.empty();
+        }
+
+        // 有快照正在遍历、还没有遍历完本条带：这段时间桶的布局不能变
+        bool frozen() const
+        {
+            std::uint64_t const snapshot = active_snapshot.load();
+            return snapshot != 0 && captured_snapshot != snapshot;
+        }
+
+        bool can_migrate() const
+        {
+            return migrating() && !frozen();
+        }
+
+        // 元素所在的链表：还没有迁移的旧桶，或者新桶
+        bucket_data& home_of(std::size_t hash) const
+        {
+            if (migrating())
+            {
+                std::size_t const old_index = hash & (old_data.size() - 1);
+                if (old_index >= migrate_pos)
+                    return old_data[old_index];
+            }
+            return data[hash & (data.size() - 1)];
+        }
+
+        std::uint64_t& tag_of(std::size_t hash) const
+        {
+            if (migrating())
+            {
+                std::size_t const old_index = hash & (old_data.size() - 1);
+                if (old_index >= migrate_pos)
+                    return old_data.tag(old_index);
+            }
+            return data.tag(hash & (data.size() - 1));
+        }
+
+        // 遍历者的第 position 个桶：先是新桶，再是还没有迁移的旧桶
+        bucket_data& bucket_at(std::size_t position) const
+        {
+            return position < data.size() ? data[position] : old_data[position - data.size() + migrate_pos];
+        }
 
-        bucket_iterator find_entry_for(Key const& key) const
+        std::uint64_t& tag_at(std::size_t position) const
         {
-            return std::find_if(data.begin(), data.end(),
+            return position < data.size() ? data.tag(position) : old_data.tag(position - data.size() + migrate_pos);
+        }
+
+        bucket_iterator find_entry_for(bucket_data& bucket, Key const& key) const
+        {
+            return std::find_if(bucket.begin(), bucket.end(),
                                 [&](bucket_value const& item)
                                 {return item.first == key;});
         }
 
+        void migrate_step(unlocked_work& work, std::size_t buckets_to_move)
+        {
+            if (!can_migrate())
+                return;
+            while (migrating() && buckets_to_move--)
+            {
+                bucket_data& from = old_data[migrate_pos];
+                while (!from.empty())
+                {
+                    std::size_t const hash = work.hasher(from.front().first) / work.stripes;
+                    bucket_data& to = data[hash & (data.size() - 1)];
+                    to.splice(to.end(), from, from.begin());
+                }
+                if (++migrate_pos == old_data.size())
+                {
+                    old_data.release_before(migrate_pos, work.retired);
+                    bucket_array().swap(old_data);
+                    migrate_pos = 0;
+                    return;
+                }
+            }
+            old_data.release_before(migrate_pos, work.retired);
+        }
+
+        // 修改 bucket 之前调用（持有排他锁）：快照还没拿到这个桶时，先给它留一份旧内容
+        void save_for_snapshot(std::size_t hash, bucket_data const& bucket)
+        {
+            if (!frozen())
+                return;
+            std::uint64_t& tag = tag_of(hash);
+            std::uint64_t const snapshot = active_snapshot.load();
+            if (tag != snapshot)
+            {
+                saved.insert(saved.end(), bucket.begin(), bucket.end());
+                tag = snapshot;
+            }
+        }
+
+        // 写操作的公共前缀（持有排他锁）：顺带迁移几个旧桶，返回元素所在的链表
+        bucket_data& bucket_for_write(std::size_t hash, unlocked_work& work)
+        {
+            migrate_step(work, migrate_batch);
+            return home_of(hash);
+        }
+
+        // 在链表末尾原地构造新元素，值由 args 构造
+        template<typename... Args>
+        bucket_iterator emplace_entry(bucket_data& bucket, std::size_t hash, Key const& key, Args&&... args)
+        {
+            save_for_snapshot(hash, bucket);
+            bucket.emplace_back(std::piecewise_construct,
+                                std::forward_as_tuple(key),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+            ++count;
+            return std::prev(bucket.end());
+        }
+
+        // 上一次扩容迁移完之前不再扩容，保证同一时刻只有两个桶数组；
+        // 迁移每次写操作搬两个旧桶，元素数再翻一倍之前就能搬完。快照遍历本条带期间也不扩容
+        bool needs_growth() const
+        {
+            return count > max_load_factor * data.size() && !migrating() && !frozen();
+        }
+
+        // 在锁外分配两倍大小的桶数组，再加排他锁换进来；换下来的空数组在放锁之后释放
+        void grow()
+        {
+            std::size_t size;
+            {
+                std::shared_lock<SharedMutex> lock(mutex);
+                if (!needs_growth())
+                    return;
+                size = data.size();
+            }
+            bucket_array fresh(size * 2);
+            std::unique_lock<SharedMutex> lock(mutex);
+            // 放锁期间别的线程可能已经扩容了
+            if (!needs_growth() || data.size() != size)
+                return;
+            old_data.swap(data);
+            data.swap(fresh);
+            migrate_pos = 0;
+        }
+
     public:
-        Value value_for(Key const& key, Value const& default_value) const
+        bucket_type(float max_load_factor_, std::atomic<std::uint64_t> const& active_snapshot_) :
+            data(1), migrate_pos(0), count(0), max_load_factor(max_load_factor_),
+            active_snapshot(active_snapshot_), captured_snapshot(0) {}
+
+        Value value_for(Key const& key, std::size_t hash, Value const& default_value,
+                        Hash const& hasher, std::size_t stripes)
         {
-            std::shared_lock<std::shared_mutex> lock(mutex);
-            bucket_iterator const found_entry = find_entry_for(key);
-            return (found_entry == data.end()) ? default_value : found_entry->second;
+            bool needs_help;
+            {
+                std::shared_lock<SharedMutex> lock(mutex);
+                bucket_data& bucket = home_of(hash);
+                bucket_iterator const found_entry = find_entry_for(bucket, key);
+                needs_help = can_migrate();
+                if (!needs_help)
+                    return (found_entry == bucket.end()) ? default_value : found_entry->second;
+                if (found_entry != bucket.end())
+                {
+                    Value res = found_entry->second;
+                    lock.unlock();
+                    help_migrate(hasher, stripes);
+                    return res;
+                }
+            }
+            help_migrate(hasher, stripes);
+            return default_value;
         }
 
-        void add_or_update_mapping(Key const& key, Value const& value)
+        void add_or_update_mapping(Key const& key, std::size_t hash, Value const& value,
+                                   Hash const& hasher, std::size_t stripes)
         {
-            std::unique_lock<std::shared_mutex> lock(mutex);
-            bucket_iterator const found_entry = find_entry_for(key);
-            if (found_entry == data.end())
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex);
+            bucket_data& bucket = bucket_for_write(hash, work);
+            bucket_iterator const found_entry = find_entry_for(bucket, key);
+            if (found_entry == bucket.end())
             {
-                data.push_back(bucket_value(key, value));
+                emplace_entry(bucket, hash, key, value);
+                work.grow = needs_growth();
             }
             else
             {
+                save_for_snapshot(hash, bucket);
                 found_entry->second = value;
             }
         }
 
-        void remove_mapping(Key const& key)
+        void remove_mapping(Key const& key, std::size_t hash, Hash const& hasher, std::size_t stripes)
         {
-            std::unique_lock<std::shared_mutex> lock(mutex);
-            bucket_iterator const found_entry = find_entry_for(key);
-            if (found_entry != data.end())
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex);
+            bucket_data& bucket = bucket_for_write(hash, work);
+            bucket_iterator const found_entry = find_entry_for(bucket, key);
+            if (found_entry != bucket.end())
             {
-                data.erase(found_entry);
+                save_for_snapshot(hash, bucket);
+                bucket.erase(found_entry);
+                --count;
             }
         }
+
+        template<typename Function>
+        auto compute(Key const& key, std::size_t hash, Function& f, Hash const& hasher, std::size_t stripes)
+            -> decltype(f(std::declval<Value&>()))
+        {
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex);
+            bucket_data& bucket = bucket_for_write(hash, work);
+            bucket_iterator found_entry = find_entry_for(bucket, key);
+            if (found_entry != bucket.end())
+            {
+                save_for_snapshot(hash, bucket);
+                return f(found_entry->second);
+            }
+            found_entry = emplace_entry(bucket, hash, key);
+            try
+            {
+                // 扩容在放锁之后才进行，f 执行期间 found_entry 一直在 bucket 中
+                work.grow = needs_growth();
+                return f(found_entry->second);
+            }
+            catch (...)
+            {
+                // f 抛出异常时不留下值初始化的元素
+                bucket.erase(found_entry);
+                --count;
+                work.grow = false;
+                throw;
+            }
+        }
+
+        template<typename Factory>
+        Value compute_if_absent(Key const& key, std::size_t hash, Factory& factory,
+                                Hash const& hasher, std::size_t stripes)
+        {
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex);
+            bucket_data& bucket = bucket_for_write(hash, work);
+            bucket_iterator found_entry = find_entry_for(bucket, key);
+            if (found_entry == bucket.end())
+            {
+                found_entry = emplace_entry(bucket, hash, key, factory());
+                work.grow = needs_growth();
+            }
+            return found_entry->second;
+        }
+
+        template<typename... Args>
+        bool try_emplace(Key const& key, std::size_t hash, Hash const& hasher, std::size_t stripes,
+                         Args&&... args)
+        {
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex);
+            bucket_data& bucket = bucket_for_write(hash, work);
+            if (find_entry_for(bucket, key) != bucket.end())
+                return false;
+            emplace_entry(bucket, hash, key, std::forward<Args>(args)...);
+            work.grow = needs_growth();
+            return true;
+        }
+
+        template<typename Predicate>
+        bool erase_if(Key const& key, std::size_t hash, Predicate& p, Hash const& hasher, std::size_t stripes)
+        {
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex);
+            bucket_data& bucket = bucket_for_write(hash, work);
+            bucket_iterator const found_entry = find_entry_for(bucket, key);
+            if (found_entry == bucket.end() || !p(static_cast<Value const&>(found_entry->second)))
+                return false;
+            save_for_snapshot(hash, bucket);
+            bucket.erase(found_entry);
+            --count;
+            return true;
+        }
+        // 批量查找 keys[order[i]]，i 属于 [first, last)，结果写到 out 的对应位置（out 已经填好默认值）
+        void multi_value_for(std::vector<Key> const& keys, std::vector<std::size_t> const& hashes,
+                             std::size_t const* first, std::size_t const* last, std::vector<Value>& out,
+                             Hash const& hasher, std::size_t stripes)
+        {
+            bool needs_help;
+            {
+                std::shared_lock<SharedMutex> lock(mutex);
+                // 先预取这一组键所在的链表头，再逐个查找，让多次缓存未命中重叠起来
+                for (std::size_t const* it = first; it != last; ++it)
+                    prefetch(&home_of(hashes[*it] / stripes));
+                for (std::size_t const* it = first; it != last; ++it)
+                {
+                    bucket_data& bucket = home_of(hashes[*it] / stripes);
+                    bucket_iterator const found_entry = find_entry_for(bucket, keys[*it]);
+                    if (found_entry != bucket.end())
+                        out[*it] = found_entry->second;
+                }
+                needs_help = can_migrate();
+            }
+            if (needs_help)
+                help_migrate(hasher, stripes);
+        }
+
+        void multi_add_or_update(std::vector<std::pair<Key, Value>> const& items,
+                                 std::vector<std::size_t> const& hashes,
+                                 std::size_t const* first, std::size_t const* last,
+                                 Hash const& hasher, std::size_t stripes)
+        {
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex);
+            for (std::size_t const* it = first; it != last; ++it)
+                prefetch(&home_of(hashes[*it] / stripes));
+            for (std::size_t const* it = first; it != last; ++it)
+            {
+                Key const& key = items[*it].first;
+                std::size_t const hash = hashes[*it] / stripes;
+                bucket_data& bucket = bucket_for_write(hash, work);
+                bucket_iterator const found_entry = find_entry_for(bucket, key);
+                if (found_entry == bucket.end())
+                {
+                    emplace_entry(bucket, hash, key, items[*it].second);
+                    work.grow = needs_growth();
+                }
+                else
+                {
+                    save_for_snapshot(hash, bucket);
+                    found_entry->second = items[*it].second;
+                }
+            }
+        }
+
+        // 读操作碰到正在迁移的条带时，如果能立刻拿到排他锁就帮忙搬几个桶
+        void help_migrate(Hash const& hasher, std::size_t stripes)
+        {
+            unlocked_work work(*this, hasher, stripes);
+            std::unique_lock<SharedMutex> lock(mutex, std::try_to_lock);
+            if (lock.owns_lock())
+                migrate_step(work, migrate_batch);
+        }
+
+        // 快照遍历本条带期间迁移暂停，这时返回 false
+        bool is_migrating() const
+        {
+            std::shared_lock<SharedMutex> lock(mutex);
+            return can_migrate();
+        }
+
+        std::size_t size() const
+        {
+            std::shared_lock<SharedMutex> lock(mutex);
+            return count;
+        }
+
+        std::size_t bucket_count() const
+        {
+            std::shared_lock<SharedMutex> lock(mutex);
+            return data.size();
+        }
+
+        // 取出本条带在快照 snapshot 时刻的一段内容，cursor 记录遍历到的桶，返回 true 表示本条带已经取完。
+        // 每次最多复制 snapshot_chunk 个快照还没拿到的桶；所有桶都看过之后，再一次拿走写操作留下的旧内容。
+        // 只有遍历者会在共享锁下碰桶的快照编号、saved 和 captured_snapshot，而遍历者之间由表的 snapshot_mutex 串行化
+        bool take_snapshot(std::uint64_t snapshot, snapshot_data& res, std::size_t& cursor)
+        {
+            std::shared_lock<SharedMutex> lock(mutex);
+            if (captured_snapshot == snapshot)
+            {
+                res.swap(saved);
+                snapshot_data().swap(saved);
+                return true;
+            }
+            std::size_t const total = data.size() + old_data.size() - migrate_pos;
+            for (std::size_t const end = std::min(total, cursor + snapshot_chunk); cursor != end; ++cursor)
+            {
+                std::uint64_t& tag = tag_at(cursor);
+                if (tag != snapshot)
+                {
+                    bucket_data const& bucket = bucket_at(cursor);
+                    res.insert(res.end(), bucket.begin(), bucket.end());
+                    tag = snapshot;
+                }
+            }
+            if (cursor == total)
+                captured_snapshot = snapshot;
+            return false;
+        }
+
+        // 遍历中途放弃时释放写操作留下的旧内容
+        void discard_snapshot(std::uint64_t snapshot)
+        {
+            std::unique_lock<SharedMutex> lock(mutex);
+            if (captured_snapshot == snapshot)
+                snapshot_data().swap(saved);
+            captured_snapshot = snapshot;
+        }
     };
 
     std::vector<std::unique_ptr<bucket_type>> buckets;
     Hash hasher;
-    bucket_type& get_bucket(Key const& key) const
+    mutable std::atomic<std::uint64_t> active_snapshot;
+    mutable std::uint64_t last_snapshot;
+    mutable std::mutex snapshot_mutex;
+
+    // 高位部分（除以条带数之后）用来在条带内部选桶
+    bucket_type& get_bucket(std::size_t hash) const
     {
-        std::size_t const bucket_index = hasher(key) % buckets.size();
-        return *buckets[bucket_index];
+        return *buckets[hash % buckets.size()];
+    }
+
+    // 按条带给批量操作的下标排序（计数排序），第 i 个条带的下标是 order[starts[i], starts[i+1])
+    void group_by_stripe(std::vector<std::size_t> const& hashes,
+                         std::vector<std::size_t>& order, std::vector<std::size_t>& starts) const
+    {
+        std::size_t const stripes = buckets.size();
+        starts.assign(stripes + 1, 0);
+        for (std::size_t i = 0; i < hashes.size(); ++i)
+            ++starts[hashes[i] % stripes + 1];
+        for (std::size_t i = 0; i < stripes; ++i)
+            starts[i + 1] += starts[i];
+        std::vector<std::size_t> next(starts.begin(), starts.end() - 1);
+        order.resize(hashes.size());
+        for (std::size_t i = 0; i < hashes.size(); ++i)
+            order[next[hashes[i] % stripes]++] = i;
     }
 
 public:
@@ -84,48 +597,169 @@ public:
     typedef Value mapped_type;
     typedef Hash hash_type;
 
-    threadsafe_lookup_table(unsigned num_buckets=19, Hash const& hasher_=Hash()) :
-        buckets(num_buckets), hasher(hasher_)
+    // num_buckets 是锁的条带数，每个条带内部的桶数组会随元素增多自动加倍
+    threadsafe_lookup_table(unsigned num_buckets=19, Hash const& hasher_=Hash(), float max_load_factor=1.0f) :
+        buckets(num_buckets), hasher(hasher_), active_snapshot(0), last_snapshot(0)
     {
         for (unsigned i = 0; i < num_buckets; ++i)
         {
-            buckets[i].reset(new bucket_type);
+            buckets[i].reset(new bucket_type(max_load_factor, active_snapshot));
         }
     }
 
-    threadsafe_lookup_table(threadsafe_lookup_table const&)=default;
+    threadsafe_lookup_table(threadsafe_lookup_table const&)=delete;
     threadsafe_lookup_table& operator=(threadsafe_lookup_table const&)=delete;
 
     Value value_for(Key const& key, Value const& default_value=Value()) const
     {
-        return get_bucket(key).value_for(key, default_value);
+        std::size_t const hash = hasher(key);
+        return get_bucket(hash).value_for(key, hash / buckets.size(), default_value, hasher, buckets.size());
     }
 
     void add_or_update_mapping(Key const& key, Value const& value)
     {
-        get_bucket(key).add_or_update_mapping(key, value);
+        std::size_t const hash = hasher(key);
+        get_bucket(hash).add_or_update_mapping(key, hash / buckets.size(), value, hasher, buckets.size());
     }
 
     void remove_mapping(Key const& key)
     {
-        get_bucket(key).remove_mapping(key);
+        std::size_t const hash = hasher(key);
+        get_bucket(hash).remove_mapping(key, hash / buckets.size(), hasher, buckets.size());
     }
 
-    std::map<Key, Value> get_map() const
+    // 在一次加锁、一次查找内完成读-改-写：键不存在时先原地值初始化一个 Value，再调用 f(value)，返回 f 的返回值
+    template<typename Function>
+    auto compute(Key const& key, Function f) -> decltype(f(std::declval<Value&>()))
+    {
+        std::size_t const hash = hasher(key);
+        return get_bucket(hash).compute(key, hash / buckets.size(), f, hasher, buckets.size());
+    }
+
+    // 键不存在时用 factory() 的结果原地构造值；返回键当前对应的值
+    template<typename Factory>
+    Value compute_if_absent(Key const& key, Factory factory)
+    {
+        std::size_t const hash = hasher(key);
+        return get_bucket(hash).compute_if_absent(key, hash / buckets.size(), factory, hasher, buckets.size());
+    }
+
+    // 键不存在时用 args 原地构造值并返回 true，已存在时什么也不做并返回 false
+    template<typename... Args>
+    bool try_emplace(Key const& key, Args&&... args)
+    {
+        std::size_t const hash = hasher(key);
+        return get_bucket(hash).try_emplace(key, hash / buckets.size(), hasher, buckets.size(),
+                                            std::forward<Args>(args)...);
+    }
+
+    // 键存在且 p(value) 为 true 时删除，返回是否删除了
+    template<typename Predicate>
+    bool erase_if(Key const& key, Predicate p)
+    {
+        std::size_t const hash = hasher(key);
+        return get_bucket(hash).erase_if(key, hash / buckets.size(), p, hasher, buckets.size());
+    }
+
+    // 批量查找：先算出所有键的哈希并按条带分组，每个条带只加一次锁。out[i] 是 keys[i] 对应的值
+    void multi_get(std::vector<Key> const& keys, std::vector<Value>& out,
+                   Value const& default_value=Value()) const
+    {
+        std::vector<std::size_t> hashes(keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            hashes[i] = hasher(keys[i]);
+        std::vector<std::size_t> order, starts;
+        group_by_stripe(hashes, order, starts);
+        out.assign(keys.size(), default_value);
+        for (std::size_t i = 0; i < buckets.size(); ++i)
+        {
+            if (starts[i] != starts[i + 1])
+                buckets[i]->multi_value_for(keys, hashes, order.data() + starts[i], order.data() + starts[i + 1],
+                                            out, hasher, buckets.size());
+        }
+    }
+
+    // 批量插入或更新，每个条带只加一次锁；同一个键出现多次时以后面的为准
+    void multi_put(std::vector<std::pair<Key, Value>> const& items)
+    {
+        std::vector<std::size_t> hashes(items.size());
+        for (std::size_t i = 0; i < items.size(); ++i)
+            hashes[i] = hasher(items[i].first);
+        std::vector<std::size_t> order, starts;
+        group_by_stripe(hashes, order, starts);
+        for (std::size_t i = 0; i < buckets.size(); ++i)
+        {
+            if (starts[i] != starts[i + 1])
+                buckets[i]->multi_add_or_update(items, hashes, order.data() + starts[i],
+                                                order.data() + starts[i + 1], hasher, buckets.size());
+        }
+    }
+
+    // 让所有正在迁移的条带尽快完成迁移（例如在读多写少的阶段调用）
+    void help_migrate()
     {
-        std::vector<std::unique_lock<std::shared_mutex>> locks;
         for (unsigned i = 0; i < buckets.size(); ++i)
         {
-            locks.push_back(std::unique_lock<std::shared_mutex>(buckets[i].mutex));
+            while (buckets[i]->is_migrating())
+                buckets[i]->help_migrate(hasher, buckets.size());
         }
-        std::map<Key, Value> res;
+    }
+
+    std::size_t size() const
+    {
+        std::size_t res = 0;
+        for (unsigned i = 0; i < buckets.size(); ++i)
+            res += buckets[i]->size();
+        return res;
+    }
+
+    std::size_t bucket_count() const
+    {
+        std::size_t res = 0;
         for (unsigned i = 0; i < buckets.size(); ++i)
+            res += buckets[i]->bucket_count();
+        return res;
+    }
+
+    // 对调用开始时刻的一致视图中的每个元素调用 f(key, value)，期间读写照常进行。
+    // 同一时刻只有一个遍历在进行，回调里不能再调用本表的 for_each 或 get_map
+    template<typename Function>
+    void for_each(Function f) const
+    {
+        std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex);
+        std::uint64_t const snapshot = ++last_snapshot;
+        active_snapshot.store(snapshot);
+        unsigned i = 0;
+        try
         {
-            for (typename std::list<std::pair<Key, Value>>::iterator it = buckets[i].data.begin(); it != buckets[i].data.end(); ++it)
+            typename bucket_type::snapshot_data items;
+            for (; i < buckets.size(); ++i)
             {
-                res.insert(*it);
+                std::size_t cursor = 0;
+                bool done;
+                do
+                {
+                    items.clear();
+                    done = buckets[i]->take_snapshot(snapshot, items, cursor);
+                    for (auto const& item : items)
+                        f(item.first, item.second);
+                } while (!done);
             }
         }
+        catch (...)
+        {
+            active_snapshot.store(0);
+            for (; i < buckets.size(); ++i)
+                buckets[i]->discard_snapshot(snapshot);
+            throw;
+        }
+        active_snapshot.store(0);
+    }
+
+    std::map<Key, Value> get_map() const
+    {
+        std::map<Key, Value> res;
+        for_each([&res](Key const& key, Value const& value) {res.emplace(key, value);});
         return res;
     }
 };
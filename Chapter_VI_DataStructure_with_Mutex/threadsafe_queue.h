@@ -6,10 +6,11 @@
 #ifndef CPP_CONCURRENCY_THREADSAFE_QUEUE_H
 #define CPP_CONCURRENCY_THREADSAFE_QUEUE_H
 
-#include <memeory>
+#include <memory>
 #include <mutex>
 
-template<typename T>
+// Lock 是头尾两把锁的类型
+template<typename T, typename Lock=std::mutex>
 class threadsafe_queue
 {
 private:
@@ -18,20 +19,20 @@ private:
         std::shared_ptr<T> data;
         std::unique_ptr<node> next;
     };
-    std::mutex head_mutex;
+    Lock head_mutex;
     // 通过智能指针控制内存的管理，普通的指针标记虚拟的尾节点
     std::unique_ptr<node> head;
-    std::mutex tail_mutex;
+    Lock tail_mutex;
     node* tail;
     node* get_tail()
     {
-        std::lock_guard<std::mutex> tail_lock(tail_mutex);
+        std::lock_guard<Lock> tail_lock(tail_mutex);
         return tail;
     }
     std::unique_ptr<node> pop_head()
     {
         // 整个pop都上锁，确保每一次pop的行为都是确定的
-        std::lock_guard<std::mutex> head_lock(head_mutex);
+        std::lock_guard<Lock> head_lock(head_mutex);
 
         if (head.get() == get_tail())
         {
@@ -56,7 +57,7 @@ public:
         std::unique_ptr<node> p(new node);
         node* const new_tail = p.get();
         //减小锁的粒度，提高程序的性能
-        std::lock_guard<std::mutex> tail_lock(tail_mutex);
+        std::lock_guard<Lock> tail_lock(tail_mutex);
         tail->data = new_data;
         tail->next = std::move(p);
         tail = new_tail;